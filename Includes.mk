@@ -7,8 +7,11 @@ MODELS=\
 	models/srcs/BaseBlock.cpp\
 	models/srcs/CommonExceptions.cpp\
 	models/srcs/Server.cpp\
+	models/srcs/CompiledLocation.cpp\
 	models/srcs/Container.cpp\
 	models/srcs/LocationConfig.cpp\
+	models/srcs/LocationMatcher.cpp\
+	models/srcs/AhoCorasick.cpp\
 	models/srcs/parser.cpp\
 	models/srcs/lexer.cpp\
 	models/srcs/readFile.cpp\
@@ -20,15 +23,34 @@ MODELS=\
 	models/srcs/requestContext.cpp\
 	models/srcs/ResourceGuards.cpp\
 	models/srcs/CgiHandle.cpp\
+	models/srcs/CgiJob.cpp\
+	models/srcs/CgiCollapser.cpp\
+	models/srcs/CgiCache.cpp\
+	models/srcs/OpenFileCache.cpp\
+	models/srcs/ContentCache.cpp\
+	models/srcs/DocrootWatcher.cpp\
+	models/srcs/MappedFile.cpp\
+	models/srcs/PackArchive.cpp\
+	models/srcs/GzipFilter.cpp\
+	models/srcs/SendQueue.cpp\
+	models/srcs/VirtualHosts.cpp\
+	models/srcs/ConfigSnapshot.cpp\
+	models/srcs/Metrics.cpp\
+	models/srcs/MasterProcess.cpp\
 
 TEMPLATES=\
+	SharedPtr.hpp\
+	HashTable.hpp\
 
 HEADERS=\
 	models/headers/BaseBlock.hpp\
 	models/headers/CommonExceptions.hpp\
 	models/headers/Server.hpp\
+	models/headers/CompiledLocation.hpp\
 	models/headers/Container.hpp\
 	models/headers/LocationConfig.hpp\
+	models/headers/LocationMatcher.hpp\
+	models/headers/AhoCorasick.hpp\
 	models/headers/parser.hpp\
 	models/headers/SocketManager.hpp\
 	models/headers/HttpUtils.hpp\
@@ -38,3 +60,17 @@ HEADERS=\
 	models/headers/requestContext.hpp\
 	models/headers/ResourceGuards.hpp\
 	models/headers/CgiHandle.hpp\
+	models/headers/CgiJob.hpp\
+	models/headers/CgiCollapser.hpp\
+	models/headers/CgiCache.hpp\
+	models/headers/OpenFileCache.hpp\
+	models/headers/ContentCache.hpp\
+	models/headers/DocrootWatcher.hpp\
+	models/headers/MappedFile.hpp\
+	models/headers/PackArchive.hpp\
+	models/headers/GzipFilter.hpp\
+	models/headers/SendQueue.hpp\
+	models/headers/VirtualHosts.hpp\
+	models/headers/ConfigSnapshot.hpp\
+	models/headers/Metrics.hpp\
+	models/headers/MasterProcess.hpp\
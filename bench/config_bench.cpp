@@ -0,0 +1,109 @@
+// Load cost of large generated configs: lexing, parsing and compiling
+// 1k to 10k virtual servers, each with three locations, as a multi-tenant
+// setup would have. Every size runs in its own child process so the peak
+// resident size reported is that load's alone. Built with the project's
+// flags, which do not optimise, so only the trend across rows is meaningful.
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Container.hpp"
+#include "parser.hpp"
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static long peakKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static std::string makeConfig(size_t servers)
+{
+    std::ostringstream out;
+    out << "http {\n";
+    for (size_t i = 0; i < servers; ++i)
+    {
+        out << "  server {\n"
+            << "    listen " << 8000 + i % 64 << ";\n"
+            << "    server_name tenant" << i << ".example.com *.tenant" << i << ".example.net;\n"
+            << "    root /srv/tenants/" << i << "/public;\n"
+            << "    index index.html index.htm;\n"
+            << "    client_max_body_size 10M;\n"
+            << "    gzip on;\n"
+            << "    # tenant " << i << "\n"
+            << "    location / {\n"
+            << "      allow_methods GET HEAD;\n"
+            << "      expires 1h;\n"
+            << "    }\n"
+            << "    location ^~ /uploads/ {\n"
+            << "      allow_methods GET POST DELETE;\n"
+            << "      upload_dir /srv/tenants/" << i << "/uploads;\n"
+            << "      add_header X-Tenant \"tenant-" << i << "\";\n"
+            << "    }\n"
+            << "    location ~ \\.php$ {\n"
+            << "      cgi_enabled on;\n"
+            << "      cgi_pass .php /usr/bin/php-cgi;\n"
+            << "    }\n"
+            << "  }\n";
+    }
+    out << "}\n";
+    return out.str();
+}
+
+static int run(size_t servers)
+{
+    std::string content = makeConfig(servers);
+    long before = peakKb();
+
+    double start = now();
+    std::vector<Token> tokens = lexer(content);
+    checks(tokens);
+    double lexed = now();
+    Container container = parser(tokens);
+    double parsed = now();
+    container.compile();
+    double compiled = now();
+
+    if (container.getServers().size() != servers)
+        return 1;
+    std::cout << std::setw(8) << servers << std::setw(9) << content.size() / 1024 << " KB" << std::setw(10)
+              << tokens.size() << std::fixed << std::setprecision(0) << std::setw(8) << (lexed - start) * 1e3
+              << " ms" << std::setw(8) << (parsed - lexed) * 1e3 << " ms" << std::setw(8)
+              << (compiled - parsed) * 1e3 << " ms" << std::setw(9) << (peakKb() - before) / 1024 << " MB"
+              << std::endl;
+    return 0;
+}
+
+int main()
+{
+    const size_t counts[] = {1000, 5000, 10000};
+
+    std::cout << std::setw(8) << "servers" << std::setw(12) << "config" << std::setw(10) << "tokens"
+              << std::setw(11) << "lex" << std::setw(11) << "parse" << std::setw(11) << "compile"
+              << std::setw(12) << "peak RSS" << std::endl;
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+            return 1;
+        if (pid == 0)
+            std::exit(run(counts[c]));
+        int status;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            return 1;
+    }
+    return 0;
+}
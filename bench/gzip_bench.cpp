@@ -0,0 +1,116 @@
+// CPU cost against bytes saved for every gzip_comp_level, running the
+// GzipFilter stage over the text files of a docroot (HTML, CSS, JS, JSON).
+// Each body goes through the filter as a generated response would, so the
+// pooled deflate streams are part of what is measured.
+#include <dirent.h>
+#include <sys/stat.h>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "GzipFilter.hpp"
+#include "HttpResponse.hpp"
+#include "Server.hpp"
+#include "utils.hpp"
+
+struct Sample {
+    std::string type;
+    std::string body;
+};
+
+static void collect(const std::string &dir, std::vector<Sample> &out)
+{
+    DIR *handle = opendir(dir.c_str());
+    if (!handle)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL)
+    {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1)
+            continue;
+        if (S_ISDIR(st.st_mode))
+        {
+            collect(path, out);
+            continue;
+        }
+        std::string type = getMimeType(path);
+        if (!S_ISREG(st.st_mode) || GzipFilter::isPrecompressedType(type) || type == "application/octet-stream")
+            continue;
+        std::ifstream in(path.c_str(), std::ios::binary);
+        std::ostringstream content;
+        content << in.rdbuf();
+        Sample sample;
+        sample.type = type;
+        sample.body = content.str();
+        out.push_back(sample);
+    }
+    closedir(handle);
+}
+
+int main(int argc, char **argv)
+{
+    std::string root = argc > 1 ? argv[1] : "www/website";
+    std::vector<Sample> samples;
+    collect(root, samples);
+    if (samples.empty())
+    {
+        std::cerr << "no text files under " << root << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> types(1, "*");
+    const int rounds = 20;
+    GzipPool pool;
+
+    std::cout << samples.size() << " files from " << root << ", " << rounds << " rounds per level" << std::endl;
+    std::cout << std::setw(6) << "level" << std::setw(12) << "in" << std::setw(12) << "out" << std::setw(9)
+              << "saved" << std::setw(14) << "cpu/MB in" << std::setw(14) << "cpu/KB saved" << std::endl;
+
+    for (int level = 1; level <= 9; ++level)
+    {
+        Server server;
+        server.setGzip(true);
+        server.setGzipTypes(types);
+        server.setGzipCompLevel(std::string(1, static_cast<char>('0' + level)));
+        server.compile();
+        const CompiledLocation &block = server.getCompiled(NULL);
+
+        unsigned long long in = 0;
+        unsigned long long out = 0;
+        clock_t cpu = 0;
+        for (int round = 0; round < rounds; ++round)
+        {
+            for (size_t i = 0; i < samples.size(); ++i)
+            {
+                HttpResponse res;
+                res.setHeader("Content-Type", samples[i].type);
+                res.setBody(samples[i].body);
+                size_t bytesIn = samples[i].body.size();
+                size_t bytesOut = bytesIn;
+
+                clock_t start = clock();
+                if (!GzipFilter::compress(res, block, pool, bytesIn, bytesOut))
+                    bytesOut = bytesIn = samples[i].body.size();
+                cpu += clock() - start;
+                in += bytesIn;
+                out += bytesOut;
+            }
+        }
+
+        double seconds = static_cast<double>(cpu) / CLOCKS_PER_SEC;
+        double saved = static_cast<double>(in - out);
+        std::cout << std::setw(6) << level << std::setw(12) << in / rounds << std::setw(12) << out / rounds
+                  << std::setw(8) << std::fixed << std::setprecision(1) << 100.0 * saved / in << "%"
+                  << std::setw(11) << std::setprecision(2) << seconds * 1000 / (in / 1048576.0) << " ms"
+                  << std::setw(11) << std::setprecision(4) << (saved > 0 ? seconds * 1000 / (saved / 1024) : 0)
+                  << " ms" << std::endl;
+    }
+    return 0;
+}
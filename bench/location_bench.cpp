@@ -0,0 +1,107 @@
+// Per-request cost of location lookup as the number of regex locations
+// grows, against running every regex in turn as a naive matcher would.
+// Half the patterns are extension matches (\.extN$), half anchored API
+// routes, every third one case-insensitive; the URIs hit the first, the
+// last and none of them. Built with the project's flags, which do not
+// optimise, so only the trend across rows is meaningful.
+#include <regex.h>
+#include <sys/time.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "LocationConfig.hpp"
+#include "Server.hpp"
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static std::string pattern(size_t i)
+{
+    std::ostringstream out;
+    if (i % 2 == 0)
+        out << "\\.ext" << i << "$";
+    else
+        out << "^/api/v" << i << "/[a-z]+/.*\\.json$";
+    return out.str();
+}
+
+int main()
+{
+    const size_t counts[] = {1, 10, 50, 100, 250, 500};
+    const int rounds = 20000;
+
+    std::cout << std::setw(8) << "regexes" << std::setw(14) << "matcher" << std::setw(14) << "sequential"
+              << std::setw(12) << "load" << std::endl;
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+    {
+        size_t count = counts[c];
+        double loadStart = now();
+        Server server;
+        server.addLocation(LocationConfig("/", PREFIX));
+        server.addLocation(LocationConfig("/static/", PREFIX));
+        std::vector<regex_t> naive(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            MatchType type = i % 3 == 2 ? REGEX_ICASE : REGEX_CASE;
+            server.addLocation(LocationConfig(pattern(i), type));
+            regcomp(&naive[i], pattern(i).c_str(),
+                    REG_EXTENDED | REG_NOSUB | (type == REGEX_ICASE ? REG_ICASE : 0));
+        }
+        server.compile();
+        double load = now() - loadStart;
+
+        std::vector<std::string> uris;
+        uris.push_back("/static/img/logo.png");
+        uris.push_back("/files/report.ext0");
+        if (count > 1)
+        {
+            // the last route pattern: every regex before it is tried first
+            std::ostringstream last;
+            last << "/api/v" << ((count - 1) % 2 == 1 ? count - 1 : count - 2) << "/users/list.json";
+            uris.push_back(last.str());
+        }
+        uris.push_back("/index.html");
+
+        size_t found = 0;
+        double start = now();
+        for (int r = 0; r < rounds; ++r)
+        {
+            for (size_t u = 0; u < uris.size(); ++u)
+                found += server.findLocation(uris[u]) != NULL;
+        }
+        double matcher = now() - start;
+
+        start = now();
+        for (int r = 0; r < rounds; ++r)
+        {
+            for (size_t u = 0; u < uris.size(); ++u)
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    if (regexec(&naive[i], uris[u].c_str(), 0, NULL, 0) == 0)
+                    {
+                        ++found;
+                        break;
+                    }
+                }
+            }
+        }
+        double sequential = now() - start;
+        for (size_t i = 0; i < count; ++i)
+            regfree(&naive[i]);
+
+        double lookups = static_cast<double>(rounds) * uris.size();
+        std::cout << std::setw(8) << count << std::fixed << std::setprecision(0) << std::setw(11)
+                  << matcher / lookups * 1e9 << " ns" << std::setw(11) << sequential / lookups * 1e9 << " ns"
+                  << std::setprecision(1) << std::setw(9) << load * 1e3 << " ms" << std::endl;
+        if (found == 0)
+            return 1;
+    }
+    return 0;
+}
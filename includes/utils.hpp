@@ -33,11 +33,26 @@ class LocationConfig;
 #define MAX_MEGABYTE 17592186044416UL
 #define MAX_GIGABYTE 17179869184UL
 
+// cgi_buffers defaults: output beyond count * size is spilled to a temp file
+#define DEFAULT_CGI_BUFFER_COUNT 8
+#define DEFAULT_CGI_BUFFER_SIZE 8192
+#define MAX_CGI_BUFFER_COUNT 1024
+#define CGI_TEMP_PATH "/tmp/pginx_cgi_XXXXXX"
+#define DEFAULT_CGI_CACHE_KEY "$host$request_uri"
+#define DEFAULT_OPEN_FILE_CACHE_INACTIVE 60
+#define DEFAULT_OPEN_FILE_CACHE_VALID 60
+#define DEFAULT_CONTENT_CACHE_MAX_FILE 1048576
+#define DEFAULT_GZIP_MIN_LENGTH 20
+#define DEFAULT_GZIP_COMP_LEVEL 1
+#define MAX_BYTE_RANGES 16
+// drain_timeout default: how long SIGQUIT waits for requests in flight
+#define DEFAULT_DRAIN_TIMEOUT 30
+#define MAX_WORKER_PROCESSES 256
+
 #define PORT 4269
 #define DEFAULT_PATH "config/default.conf"
 #define MAX_EXT_LENGTH 30
 #define MAX_TOKENS_LENGTH 8192
-#define MAX_TOKEN_COUNT 102400
 
 std::string initValidation(int argc, char** argv);
 std::vector<std::string> split(const std::string& str, char delimiter);
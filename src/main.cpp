@@ -1,6 +1,8 @@
+#include <csignal>
 #include <cstring>
 #include <iostream>
 #include "Container.hpp"
+#include "MasterProcess.hpp"
 #include "SocketManager.hpp"
 #include "parser.hpp"
 #include "utils.hpp"
@@ -32,23 +34,32 @@ int main(int argc, char **argv)
   try
   {
     initValidation(argc, argv);
-    std::string content = readFile(configFile);
-    std::vector<Token> tokens = lexer(content);
-    checks(tokens);
-    Container container = parser(tokens);
+    Container container = loadConfig(configFile);
 
     std::vector<ServerSocketInfo> socketInfos =
         convertServersToSocketInfo(container.getServers());
 
     SocketManager socketManager;
     socketManager.setServers(container.getServers());
+    socketManager.setConfigFile(configFile);
+    socketManager.setCommandLine(argv);
 
     if (!socketManager.initSockets(socketInfos))
       throw std::runtime_error("Failed to initialize sockets.");
 
+    // sendfile() and pipe writes report a vanished peer as EPIPE only when
+    // the signal is ignored
+    signal(SIGPIPE, SIG_IGN);
+
     // Check
     std::cout << "Server initialized. Waiting for clients..." << std::endl;
-    socketManager.handleClients();
+    if (socketManager.getConfig().workerProcesses() > 0)
+    {
+      MasterProcess master(socketManager);
+      master.run();
+    }
+    else
+      socketManager.handleClients();
   }
   catch (const std::exception &e)
   {
@@ -0,0 +1,33 @@
+#ifndef AHOCORASICK_HPP
+#define AHOCORASICK_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Finds which of a set of literals occur in a text in one pass, ignoring
+// ASCII case. The automaton is a full DFA over byte classes: bytes that occur
+// in no literal share one class, so a table row is only as wide as the
+// literals' alphabet. Literals are numbered in the order they were added.
+class AhoCorasick {
+private:
+  std::vector<std::string> literals;
+  uint8_t byteClass[256];
+  size_t classCount;
+  std::vector<uint32_t> transitions;  // state * classCount + class
+  std::vector<std::vector<size_t> > outputs;  // literals ending at a state
+
+public:
+  AhoCorasick();
+  ~AhoCorasick();
+
+  size_t add(const std::string& literal);
+  // Rebuilds the automaton; needed after add() for scan() to see a literal
+  void build();
+  // Appends the index of every literal occurring in text to found, once per
+  // occurrence
+  void scan(const std::string& text, std::vector<size_t>& found) const;
+  size_t size() const;
+};
+
+#endif
@@ -15,9 +15,45 @@ protected:
   bool _cgiEnabled;
   bool _cgiExplicitlySet;
   std::map<std::string, std::string> _cgiPassMap;
+  size_t _cgiBufferCount;
+  size_t _cgiBufferSize;
+  bool _cgiBuffersExplicitlySet;
+  bool _cgiCollapsing;
+  bool _cgiCollapsingExplicitlySet;
+  size_t _cgiCacheSize;  // 0: cgi_cache off
+  bool _cgiCacheExplicitlySet;
+  std::string _cgiCacheKey;
+  time_t _cgiCacheValid;  // -1: not set here
+  size_t _openFileCacheMax;  // 0: open_file_cache off
+  time_t _openFileCacheInactive;
+  time_t _openFileCacheValid;
+  bool _openFileCacheExplicitlySet;
+  size_t _contentCacheSize;  // 0: content_cache off
+  size_t _contentCacheMaxFile;
+  bool _contentCacheExplicitlySet;
+  size_t _mmapMaxFile;  // 0: mmap off
+  bool _mmapExplicitlySet;
+  std::string _rootPack;  // "": serve from _root
+  bool _gzipStatic;
+  bool _gzipStaticExplicitlySet;
+  bool _gzip;
+  bool _gzipExplicitlySet;
+  std::vector<std::string> _gzipTypes;  // empty: not set here
+  size_t _gzipMinLength;
+  bool _gzipMinLengthExplicitlySet;
+  int _gzipCompLevel;  // 0: not set here
+  std::string _expiresHeaders;  // rendered Cache-Control/Expires lines
+  bool _expiresExplicitlySet;
+  std::string _addedHeaders;  // rendered add_header lines
+  std::string _addedHeadersAlways;  // the ones marked "always"
+  bool _addedHeadersExplicitlySet;
+  std::string _successHeaders;  // all of the above, sent as one block
+  time_t _drainTimeout;
+  size_t _workerProcesses;  // 0: not set, serve from a single process
   BaseBlock();
   BaseBlock(const BaseBlock& obj);
   virtual ~BaseBlock();
+  void renderResponseHeaders();
 
 public:
   void setRoot(const std::string& root);
@@ -36,11 +72,54 @@ public:
   void inheritCgiFromParent(bool parentCgiEnabled);
   void setCgiPassMapping(const std::string& extension,
     const std::string& interpreterPath);
-  std::map<std::string, std::string> getCgiPassMap() const;
+  const std::map<std::string, std::string>& getCgiPassMap() const;
   void inheritCgiPassFromParent(
     const std::map<std::string, std::string>& parentCgiPassMap);
+  void setCgiBuffers(const std::string& count, std::string& sSize);
+  size_t getCgiBufferCount() const;
+  size_t getCgiBufferSize() const;
+  size_t getCgiBufferLimit() const;
+  void setCgiCollapsing(bool enabled);
+  bool isCgiCollapsingEnabled() const;
+  void setCgiCache(std::string& sSize);
+  void setCgiCacheKey(const std::string& keyTemplate);
+  void setCgiCacheValid(const std::string& sTime);
+  size_t getCgiCacheSize() const;
+  const std::string& getCgiCacheKey() const;
+  time_t getCgiCacheValid() const;
+  void setOpenFileCache(const std::vector<std::string>& params);
+  size_t getOpenFileCacheMax() const;
+  time_t getOpenFileCacheInactive() const;
+  time_t getOpenFileCacheValid() const;
+  void setContentCache(const std::vector<std::string>& params);
+  size_t getContentCacheSize() const;
+  size_t getContentCacheMaxFile() const;
+  void setMmap(std::string& sSize);
+  size_t getMmapMaxFile() const;
+  void setRootPack(const std::string& archivePath);
+  const std::string& getRootPack() const;
+  void setGzipStatic(bool enabled);
+  bool isGzipStaticEnabled() const;
+  void setGzip(bool enabled);
+  void setGzipTypes(const std::vector<std::string>& types);
+  void setGzipMinLength(std::string& sSize);
+  void setGzipCompLevel(const std::string& level);
+  bool isGzipEnabled() const;
+  const std::vector<std::string>& getGzipTypes() const;
+  size_t getGzipMinLength() const;
+  int getGzipCompLevel() const;
+  void setExpires(const std::string& value);
+  void addHeader(const std::vector<std::string>& params);
+  const std::string& getResponseHeaders(int statusCode) const;
+  static bool sendsAllHeaders(int statusCode);
+  void inheritTuningFromParent(const BaseBlock& parent);
+  void setDrainTimeout(const std::string& sTime);
+  time_t getDrainTimeout() const;
+  void setWorkerProcesses(const std::string& count);
+  size_t getWorkerProcesses() const;
   const std::vector<std::string>& getIndexFiles() const;
   const std::string* getErrorPage(const u_int16_t code) const;
+  const std::map<u_int16_t, std::string>& getErrorPages() const;
   bool getAutoIndex() const;
 };
 
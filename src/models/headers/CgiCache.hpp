@@ -0,0 +1,64 @@
+#ifndef CGICACHE_HPP
+#define CGICACHE_HPP
+
+#include <ctime>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include "HttpResponse.hpp"
+
+// An expired entry is served stale for at most this many TTLs past its
+// expiry; after that a lookup drops it and reports a miss
+#define CGI_CACHE_STALE_TTLS 10
+
+class HttpRequest;
+
+// Micro-cache for CGI responses (cgi_cache), one per server/location block.
+// Entries live for the TTL the script asks for (Cache-Control / Expires) or
+// cgi_cache_valid, are evicted least-recently-used once the block's memory
+// limit is reached, and may be served stale for a bounded time while a
+// single background run of the script refreshes them.
+class CgiCache {
+public:
+  enum Status { MISS, HIT, STALE };
+
+private:
+  struct Entry {
+    HttpResponse response;
+    time_t expires;
+    time_t staleUntil;
+    size_t size;
+    std::list<std::string>::iterator lruPos;
+  };
+  std::map<std::string, Entry> entries;
+  std::list<std::string> lru;  // most recently used first
+  std::set<std::string> refreshing;
+  size_t limit;
+  size_t used;
+
+  void evict(std::map<std::string, Entry>::iterator entry);
+
+public:
+  CgiCache();
+  ~CgiCache();
+
+  // False when the request bypasses the cache (not a GET, carries cookies or
+  // credentials, or cgi_cache is off for its block)
+  static bool makeKey(const HttpRequest& request, std::string& key);
+  // How long res may be reused; false if it must not be cached at all
+  static bool freshnessOf(const HttpResponse& res, time_t defaultTtl,
+    time_t now, time_t& ttl);
+
+  void setLimit(size_t bytes);
+  HttpResponse* lookup(const std::string& key, time_t now, Status& status);
+  void store(const std::string& key, const HttpResponse& res, time_t ttl,
+    time_t now);
+  void remove(const std::string& key);
+
+  // Only one refresh per key runs at a time
+  bool beginRefresh(const std::string& key);
+  void endRefresh(const std::string& key);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef CGICOLLAPSER_HPP
+#define CGICOLLAPSER_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+class HttpRequest;
+
+// Request collapsing for idempotent CGI GET/HEAD (cgi_request_collapsing).
+// The first request for a key owns the running job; identical requests that
+// arrive while it runs wait on it and get a copy of its response. Keys are
+// built from the virtual host, script path, query and the request headers a
+// script is likely to vary on.
+class CgiCollapser {
+private:
+  std::map<std::string, int> owners;        // key -> owner client fd
+  std::map<int, std::string> keys;          // owner client fd -> key
+  std::map<int, std::vector<int> > waiters; // owner client fd -> waiting fds
+  std::map<int, int> waitingOn;             // waiting fd -> owner client fd
+
+public:
+  CgiCollapser();
+  ~CgiCollapser();
+
+  // False when the request must run on its own (body, cookies, credentials,
+  // method other than GET/HEAD, or collapsing disabled for its location)
+  static bool makeKey(const HttpRequest& request, std::string& key);
+
+  int findOwner(const std::string& key) const;
+  void addOwner(int ownerFd, const std::string& key);
+  void addWaiter(int ownerFd, int waiterFd);
+  bool isWaiting(int fd) const;
+  bool hasWaiters(int ownerFd) const;
+  void removeWaiter(int fd);
+
+  // The owner left: the first waiter takes over the job and the rest of the
+  // queue. Returns the new owner, or -1 if nobody was waiting.
+  int promote(int ownerFd);
+  // The job is done: forgets the key and hands back everyone still waiting
+  std::vector<int> complete(int ownerFd);
+};
+
+#endif
@@ -17,21 +17,22 @@
 #include "HttpRequest.hpp"
 #include "requestContext.hpp"
 #include "Server.hpp"
+#include "ResourceGuards.hpp"
+#include "SharedPtr.hpp"
 class HttpRequest;
 class RequestContext;
+class CgiJob;
 
 class CgiHandle {
 
 public:
   CgiHandle();
   void buildCgiEnvironment(const HttpRequest& request, const RequestContext& ctx, const std::string& scriptPath, u_int16_t serverPort, const std::string& clientIP, const std::string& serverName, std::map<std::string, std::string>& envVars);
-  std::string readCgiResponse(const std::string& inputData, int stdinPipe, int stdoutPipe, int epollFd, pid_t childPid);
-  void getInterpreterForScript(const std::map<std::string, std::string>& cgiPassMap, const std::string& scriptPath, std::string& interpreterPath);
   void getDirectoryFromPath(const std::string& path, std::string& directoryPath);
   void buildCgiScript(const std::string& scriptPath, const RequestContext& ctx, HttpResponse& res, HttpRequest& request, sockaddr_in& clientAddr, int epollFd);
-  std::string executeCgiScript(const std::string& scriptPath, const std::map<std::string, std::string>& envVars, const std::string& inputData, const std::map<std::string, std::string>& cgiPassMap, int epollFd);
-  void sendCgiOutputToClient(const std::string& cgiOutput, HttpResponse& res);
-  void parseCgiResponse(const std::string& cgiOutput, HttpResponse& res);
+  CgiJob* executeCgiScript(const std::string& scriptPath, const std::map<std::string, std::string>& envVars, const std::string& interpreterPath, const RequestContext& ctx, int epollFd);
+  void parseCgiResponse(std::string& cgiOutput, HttpResponse& res, std::string& localRedirect,
+    const SharedPtr<FileGuard>& spill = SharedPtr<FileGuard>(), size_t spilled = 0);
 
 
   class CgiExecutionException : public std::exception {
@@ -0,0 +1,82 @@
+#ifndef CGIJOB_HPP
+#define CGIJOB_HPP
+
+#include <sys/types.h>
+#include <ctime>
+#include <string>
+#include "ConfigSnapshot.hpp"
+#include "ResourceGuards.hpp"
+#include "SharedPtr.hpp"
+#include "requestContext.hpp"
+
+class HttpResponse;
+
+// A CGI child that runs alongside the event loop instead of blocking it.
+// The job owns the child's stdin/stdout pipes; SocketManager routes their
+// epoll events (and the client socket while the body is still arriving) here.
+// Output is read as fast as the script produces it, whatever the client's
+// speed: up to cgi_buffers worth stays in memory, the rest is spilled to an
+// unlinked temp file that the response later streams with sendfile().
+class CgiJob {
+private:
+  SharedPtr<ConfigSnapshot> config;  // keeps ctx's blocks alive over a reload
+  RequestContext ctx;
+  pid_t pid;
+  int stdinFd;
+  int stdoutFd;
+  int epollFd;
+  int clientFd;
+  bool stdinArmed;
+  std::string input;
+  size_t inputOffset;
+  size_t socketBodyRemaining;
+  std::string output;
+  size_t outputLimit;
+  SharedPtr<FileGuard> spill;
+  size_t spilled;
+  time_t startTime;
+  bool failed;
+  bool timedOut;
+
+  CgiJob(const CgiJob& other);
+  CgiJob& operator=(const CgiJob& other);
+
+  void armStdin(bool enable);
+  void closeStdin();
+  void closeStdout();
+  void reapChild(bool force);
+  bool spliceFromSocket();
+  void storeOutput(const char* data, size_t length);
+  bool spillOutput(const char* data, size_t length);
+
+public:
+  static const int TIMEOUT = 5;
+
+  CgiJob(const RequestContext& ctx, pid_t pid, int stdinFd, int stdoutFd,
+    int epollFd);
+  ~CgiJob();
+
+  bool watchOutput();
+  void startInput(int clientFd, const std::string& bufferedBody,
+    size_t socketBody);
+
+  int getStdinFd() const;
+  int getStdoutFd() const;
+  bool wantsSocketBody() const;
+  bool isFinished() const;
+  bool hasTimedOut(time_t now) const;
+
+  void onStdinWritable();
+  void onStdoutReadable();
+  void onPipeHangup(int fd);
+  void onSocketReadable();
+  // SIGCHLD: reaps the child if its output is already complete
+  void onChildExit();
+  void abort(bool timeout);
+  const RequestContext& getContext() const;
+  void holdConfig(const SharedPtr<ConfigSnapshot>& snapshot);
+  const SharedPtr<ConfigSnapshot>& getConfig() const;
+  void buildResponse(HttpResponse& res, std::string& localRedirect);
+};
+
+#endif
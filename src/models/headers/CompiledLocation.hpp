@@ -0,0 +1,73 @@
+#ifndef COMPILEDLOCATION_HPP
+#define COMPILEDLOCATION_HPP
+
+#include <sys/types.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "HashTable.hpp"
+#include "SharedPtr.hpp"
+
+class LocationConfig;
+class Server;
+
+enum MethodBit {
+  METHOD_GET = 1 << 0,
+  METHOD_HEAD = 1 << 1,
+  METHOD_POST = 1 << 2,
+  METHOD_PUT = 1 << 3,
+  METHOD_DELETE = 1 << 4,
+  METHOD_PATCH = 1 << 5,
+  METHOD_OPTIONS = 1 << 6
+};
+
+// What a request under one location (or under a server with no matching
+// location) runs with, with every location -> server fallback already
+// resolved. Built once by Server::compile() after parsing and only read
+// afterwards. It points into no other object, so copies of the Server stay
+// valid. The fields every request touches come first so they share a cache
+// line; the strings and tables follow.
+struct CompiledLocation {
+  unsigned methods;  // MethodBit set
+  bool autoIndex;
+  bool cgiEnabled;
+  bool cgiCollapsing;
+  bool gzip;
+  bool gzipStatic;
+  int gzipCompLevel;
+  size_t gzipMinLength;
+  size_t mmapMaxFile;
+  u_int16_t redirectCode;  // 0: no return directive
+  size_t clientMaxBodySize;
+  size_t cgiBufferLimit;
+  std::string root;
+  std::string rootPrefix;  // root ending in '/', request paths go after it
+  std::string uploadDir;
+  std::vector<std::string> indexFiles;
+  HashTable<std::string> cgiPass;  // ".ext" -> interpreter
+  SharedPtr<std::string> redirectHead;  // whole response, headers included
+  SharedPtr<std::string> redirectBody;
+  std::map<u_int16_t, SharedPtr<std::string> > errorPages;  // loaded bodies
+  std::vector<std::string> gzipTypes;
+  std::string rootPack;  // "": served from root
+  std::string successHeaders;  // expires and add_header lines, pre-rendered
+  std::string alwaysHeaders;   // add_header ... always only
+
+  // location may be NULL; pages caches error page files by path so blocks
+  // sharing one read it once
+  CompiledLocation(const Server& server, const LocationConfig* location,
+                   std::map<std::string, SharedPtr<std::string> >& pages);
+
+  static unsigned methodBit(const std::string& method);
+  bool isMethodAllowed(const std::string& method) const;
+  std::string getFullPath(const std::string& requestPath) const;
+  // NULL when the script's extension has no cgi_pass
+  const std::string* interpreterFor(const std::string& scriptPath) const;
+  // NULL when no error_page for code could be loaded
+  const std::string* getErrorPage(u_int16_t code) const;
+  bool isGzipType(const std::string& mimeType) const;
+  // The pre-rendered header lines for a response with this status
+  const std::string& getResponseHeaders(int statusCode) const;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef CONFIGSNAPSHOT_HPP
+#define CONFIGSNAPSHOT_HPP
+
+#include <netinet/in.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "CgiCache.hpp"
+#include "ContentCache.hpp"
+#include "OpenFileCache.hpp"
+#include "Server.hpp"
+#include "VirtualHosts.hpp"
+
+// One loaded configuration: its servers, the Host tables of every listen
+// address and the caches kept per block. SocketManager publishes it through
+// a SharedPtr and swaps in a new one on reload; a CGI job holds the one its
+// request started under, so the blocks it points into outlive the swap.
+// Caches are keyed by block address and therefore never shared between
+// snapshots.
+struct ConfigSnapshot {
+  std::vector<Server> servers;
+  std::map<std::string, VirtualHosts> virtualHosts;  // by listen "addr:port"
+  std::map<const BaseBlock*, CgiCache> cgiCaches;  // one per cgi_cache block
+  std::map<const BaseBlock*, OpenFileCache> openFileCaches;
+  std::map<const BaseBlock*, ContentCache> contentCaches;
+
+  explicit ConfigSnapshot(const std::vector<Server>& servers);
+
+  // The servers a connection accepted on local can reach: its specific
+  // address first, then the wildcard on that port. NULL if neither listens.
+  const VirtualHosts* hostsFor(const sockaddr_in& local) const;
+  // The root of every server and location that sets one
+  std::vector<std::string> docroots() const;
+  // The longest drain_timeout of any server
+  time_t drainTimeout() const;
+  // The most worker_processes any server asks for; 0: single process
+  size_t workerProcesses() const;
+
+private:
+  ConfigSnapshot(const ConfigSnapshot& other);
+  ConfigSnapshot& operator=(const ConfigSnapshot& other);
+};
+
+#endif
@@ -11,7 +11,11 @@ public:
   Container();
   ~Container();
   void insertServer(const Server& server);
+  // A new default Server at the end of the list
+  Server& addServer();
+  void reserveServers(size_t count);
   const std::vector<Server>& getServers() const;
+  void compile();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef CONTENTCACHE_HPP
+#define CONTENTCACHE_HPP
+
+#include <sys/stat.h>
+#include <list>
+#include <map>
+#include <string>
+#include "SharedPtr.hpp"
+
+struct ServerMetrics;
+
+// A cached static response: the serialized header block and the file body,
+// both shared with every send queue that is still delivering them
+struct CachedContent {
+  SharedPtr<std::string> head;
+  SharedPtr<std::string> body;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+};
+
+// content_cache: hot static files kept in memory, keyed by full path and
+// checked against the stat() data of each request (inode, size, mtime), so
+// with open_file_cache in front a hit costs no filesystem syscall at all.
+// Bounded by a byte budget and a per-file cap; least recently used first out.
+class ContentCache {
+private:
+  struct Entry {
+    CachedContent content;
+    size_t size;
+    std::list<std::string>::iterator lruPos;
+  };
+  std::map<std::string, Entry> entries;
+  std::list<std::string> lru;  // most recently used first
+  size_t budget;
+  size_t maxFile;
+  size_t used;
+  ServerMetrics* metrics;
+
+  void evict(std::map<std::string, Entry>::iterator entry);
+
+public:
+  ContentCache();
+  ~ContentCache();
+
+  void configure(size_t budget, size_t maxFile, ServerMetrics* metrics);
+  bool fits(off_t size) const;
+  const CachedContent* lookup(const std::string& path, const struct stat& st);
+  const CachedContent* store(const std::string& path, const struct stat& st,
+    const std::string& head, std::string& body);
+  void invalidate(const std::string& path);
+  void invalidateAll();
+};
+
+#endif
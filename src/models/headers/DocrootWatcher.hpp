@@ -0,0 +1,50 @@
+#ifndef DOCROOTWATCHER_HPP
+#define DOCROOTWATCHER_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+// What changed under the watched roots since the last read
+struct DocrootChanges {
+  std::vector<std::string> paths;  // files created, written, removed or renamed
+  bool all;  // queue overflow or a directory moved: trust nothing cached
+
+  DocrootChanges();
+};
+
+// inotify on every directory below the configured roots. Its descriptor sits
+// in the main epoll set; each readable event turns into per-path changes that
+// SocketManager hands to the file caches. A root whose tree could not be
+// watched completely (watch limit, unreadable or symlinked directories) is
+// not covered, and caches below it keep revalidating on their own timer.
+class DocrootWatcher {
+private:
+  struct Root {
+    std::string dir;  // collapsed, without trailing slash
+    bool complete;
+  };
+  int fd;
+  std::map<int, std::string> dirs;          // watch descriptor -> directory
+  std::map<std::string, Root> roots;        // configured root -> state
+
+  DocrootWatcher(const DocrootWatcher& other);
+  DocrootWatcher& operator=(const DocrootWatcher& other);
+
+  bool watchTree(const std::string& dir);
+  void unwatchTree(const std::string& dir);
+  Root* rootOf(const std::string& path);
+
+public:
+  DocrootWatcher();
+  ~DocrootWatcher();
+
+  bool start(const std::vector<std::string>& rootDirs);
+  // Drops every watch; start() can be called again afterwards
+  void stop();
+  int getFd() const;
+  bool covers(const std::string& rootDir) const;
+  void readEvents(DocrootChanges& changes);
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef GZIPFILTER_HPP
+#define GZIPFILTER_HPP
+
+#include <zlib.h>
+#include <string>
+#include <vector>
+
+struct CompiledLocation;
+class HttpResponse;
+
+// Deflate streams kept between responses: deflateReset() is far cheaper
+// than setting up a stream's state and window again. One free list per
+// compression level, each capped so an idle server does not hoard memory.
+class GzipPool {
+private:
+  static const size_t MAX_IDLE_PER_LEVEL = 8;
+  std::vector<z_stream*> idle[10];
+
+  GzipPool(const GzipPool& other);
+  GzipPool& operator=(const GzipPool& other);
+
+public:
+  GzipPool();
+  ~GzipPool();
+
+  z_stream* acquire(int level);
+  void release(z_stream* stream, int level);
+};
+
+// The on-the-fly gzip stage for generated bodies (CGI output, autoindex and
+// error pages): gzip, gzip_types, gzip_min_length and gzip_comp_level. The
+// body is deflated a chunk at a time from wherever it lives, memory or a
+// spilled temp file, so a large CGI response is never held twice.
+class GzipFilter {
+public:
+  static bool accepts(const std::string& acceptEncoding);
+  // Whether the block's settings and the response let gzip run at all
+  static bool applies(const HttpResponse& res, const CompiledLocation& block);
+  // Replaces the body with its gzip encoding when the block's settings and
+  // the response allow it and it actually gets smaller; returns whether it did
+  static bool compress(HttpResponse& res, const CompiledLocation& block, GzipPool& pool,
+    size_t& bytesIn, size_t& bytesOut);
+  static bool isPrecompressedType(const std::string& mimeType);
+};
+
+#endif
@@ -8,10 +8,15 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "HttpUtils.hpp"
 #include "Server.hpp"
+#include "SharedPtr.hpp"
 #include "requestContext.hpp"
 class HttpResponse;
+class FileGuard;
+class MappedFile;
 class Server;
+class CgiJob;
 
 class HttpRequest {
 protected:
@@ -23,8 +28,18 @@ protected:
     std::string body;
     std::map<std::string, std::string> query;
     bool enabledCgi;
+    CgiJob* cgiJob;
 
     void handleGetOrHead(HttpResponse& res, bool includeBody, sockaddr_in& clientAddr, int epollFd);
+    void servePacked(HttpResponse& res, bool includeBody);
+    std::vector<std::string> acceptedPrecompressed() const;
+    bool isNotModified(const std::string& etag, time_t mtime) const;
+    enum RangeResult { RANGE_NONE, RANGE_PARTIAL, RANGE_UNSATISFIABLE };
+    RangeResult selectRanges(const std::string& etag, time_t mtime, off_t size,
+        std::vector<ByteRange>& ranges) const;
+    void serveRanges(HttpResponse& res, const std::vector<ByteRange>& ranges, off_t size,
+        const std::string& mimeType, const SharedPtr<FileGuard>& file,
+        const SharedPtr<MappedFile>& mapping, off_t base);
     bool isCgiEnabledForRequest() const;
 
 private:
@@ -37,6 +52,7 @@ public:
     virtual ~HttpRequest();
 
     // Accessors
+    const RequestContext& getContext() const;
     const std::string& getMethod() const;
     const std::string& getPath() const;
     const std::string& getVersion() const;
@@ -52,6 +68,8 @@ public:
     void appendBody(const std::string& data);
     void setQuery(const std::map<std::string, std::string>& q);
     void setEnabledCgi(bool enabled);
+    void setCgiJob(CgiJob* job);
+    CgiJob* releaseCgiJob();
 
     // Helpers
     bool isChunked() const;
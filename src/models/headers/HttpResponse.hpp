@@ -4,21 +4,46 @@
 #include <map>
 #include <string>
 #include <vector>
+#include "MappedFile.hpp"
+#include "ResourceGuards.hpp"
+#include "SharedPtr.hpp"
 
 // Forward declaration
 class HttpRequest;
 class RequestContext;
+class SendQueue;
 
 class HttpResponse
 {
 private:
+  // A piece of a body assembled from several sources (multipart/byteranges):
+  // literal bytes, or a file range when file is set
+  struct BodyPart
+  {
+    std::string data;
+    SharedPtr<FileGuard> file;
+    SharedPtr<MappedFile> mapping;
+    off_t offset;
+    size_t length;
+  };
   int statusCode;
   std::map<std::string, std::string> headers;
   std::vector<std::string> setCookieHeaders;
+  std::string renderedHeaders; // ready-made lines from the config
   std::string body;
+  size_t bodyOffset; // body bytes before this belong to the producer
+  SharedPtr<FileGuard> bodyFile; // body continues with this file range
+  off_t bodyFileOffset;
+  size_t bodyFileLength;
+  SharedPtr<MappedFile> bodyMap; // when set, the file range is sent from here
+  SharedPtr<std::string> sharedHead; // pre-serialized, replaces the built head
+  SharedPtr<std::string> sharedBody;
+  std::vector<BodyPart> bodyParts; // sent after everything above, in order
   std::string version;
   std::string statusMessage;
 
+  static size_t readPart(const BodyPart &part, size_t pos, char *buffer, size_t length);
+
 public:
   HttpResponse();
   ~HttpResponse();
@@ -27,13 +52,30 @@ public:
   void setStatus(int code, const std::string &reason);
   void setHeader(const std::string &key, const std::string &value);
   void setBody(const std::string &b);
+  void setBodySlice(std::string &data, size_t offset, size_t length);
+  void setBodyFile(const SharedPtr<FileGuard> &file, off_t offset, size_t length);
+  void setBodyMapping(const SharedPtr<MappedFile> &map, off_t offset, size_t length);
+  void setSharedContent(const SharedPtr<std::string> &head, const SharedPtr<std::string> &body);
+  void appendBodyText(const std::string &text);
+  void appendBodyRange(const SharedPtr<FileGuard> &file, const SharedPtr<MappedFile> &map, off_t offset,
+                       size_t length);
+  size_t getBodySize() const;
   void setVersion(const std::string &v);
   void addSetCookieHeader(const std::string &value);
+  void setRenderedHeaders(const std::string &lines);
   std::string getHostHeader() const;
+  std::string getHeader(const std::string &key) const;
+  bool hasBodyFile() const;
+  bool hasSharedContent() const;
+  size_t readBody(size_t pos, char *buffer, size_t length) const;
   std::vector<std::string> getSetCookieHeaders() const;
   int getStatusCode() const;
 
   std::string build() const;
+  std::string buildHead() const;
+  void moveInto(SendQueue &queue);
+  void copyInto(SendQueue &queue) const;
+  static std::string reasonPhrase(int code);
 
   // Error handling methods
   void setError(int code, const std::string &reason);
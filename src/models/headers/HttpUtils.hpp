@@ -3,7 +3,15 @@
 
 #include <string>
 #include <ctime>
+#include <vector>
 #include <sys/types.h>
+#include <sys/stat.h>
+
+// One satisfiable range of a Range header, both ends inclusive
+struct ByteRange {
+    off_t first;
+    off_t last;
+};
 
 struct DirEntry {
     std::string name;
@@ -29,6 +37,13 @@ std::string itoa_int(int n);
 std::string urlDecode(const std::string& s);
 bool setNonBlocking(int fd);
 std::string extractFileName(const std::string& path);
+std::string collapsePath(const std::string& path);
+std::string formatHttpDate(time_t when);
+bool parseHttpDate(const std::string& date, time_t& when);
+std::string makeETag(const struct stat& st);
+bool etagListMatches(const std::string& list, const std::string& etag);
+bool parseByteRanges(const std::string& header, off_t size, std::vector<ByteRange>& ranges);
+double acceptQuality(const std::string& acceptEncoding, const std::string& coding);
 std::string generateAutoIndexPage(const std::string& dirPath, const std::string& requestPath);
 bool compareEntries(const std::pair<std::string, struct stat>& a, const std::pair<std::string, struct stat>& b);
 std::string formatFileSize(off_t size);
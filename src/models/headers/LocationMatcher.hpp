@@ -0,0 +1,76 @@
+#ifndef LOCATIONMATCHER_HPP
+#define LOCATIONMATCHER_HPP
+
+#include <regex.h>
+#include <string>
+#include <vector>
+#include "AhoCorasick.hpp"
+#include "HashTable.hpp"
+#include "LocationConfig.hpp"
+#include "SharedPtr.hpp"
+
+// A server's locations compiled for lookup, as indexes into its location
+// list. "=" locations go in a hash table, prefix and "^~" locations in a
+// radix trie whose edges carry runs of bytes, so one walk along the request
+// path finds the longest prefix whatever the number of locations.
+//
+// "~" and "~*" locations are POSIX extended regexes compiled once. Each one's
+// longest literal that any match must contain feeds an Aho-Corasick
+// automaton, so one pass over the path rules out most of them; only the rest
+// run regexec(), in declaration order, and the first match wins.
+//
+// Precedence is nginx's: an exact match, then the longest prefix if it is
+// "^~", then the first matching regex, then the longest prefix.
+class LocationMatcher {
+private:
+  struct Regex {
+    regex_t compiled;
+
+    Regex(const std::string& pattern, bool ignoreCase);
+    ~Regex();
+
+  private:
+    Regex(const Regex& other);
+    Regex& operator=(const Regex& other);
+  };
+  struct RegexLocation {
+    SharedPtr<Regex> regex;
+    size_t location;
+  };
+
+  struct Node {
+    std::string label;  // bytes on the edge from the parent
+    std::vector<size_t> children;
+    long location;  // -1: no location ends here
+    bool priority;  // "^~"
+
+    Node();
+  };
+  HashTable<size_t> exact;
+  std::vector<Node> nodes;  // nodes[0] is the root
+  std::vector<RegexLocation> regexes;
+  AhoCorasick literals;
+  std::vector<size_t> literalOwner;  // literal -> index in regexes
+  std::vector<size_t> unfiltered;  // regexes without a literal, always tried
+
+  size_t findChild(size_t node, char first) const;
+  size_t insertPrefix(const std::string& path);
+  long longestPrefix(const std::string& path, bool& priority) const;
+  long firstRegex(const std::string& path) const;
+
+public:
+  LocationMatcher();
+  ~LocationMatcher();
+
+  // false when a location of the same kind already has this path; the
+  // first one declared is kept, as before. Throws InvalidValue for a regex
+  // that does not compile.
+  bool add(const std::string& path, MatchType type, size_t index);
+  // Builds the regex literal filter once every location is added; regex
+  // locations added since the last build are not matched until it runs
+  void build();
+  // Index of the location for path, -1 when none applies
+  long match(const std::string& path) const;
+};
+
+#endif
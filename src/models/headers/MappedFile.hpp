@@ -0,0 +1,33 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <sys/types.h>
+#include "ResourceGuards.hpp"
+#include "SharedPtr.hpp"
+
+// A read-only mapping of a whole file, shared by every response that sends
+// from it and unmapped with the last one. The descriptor is kept so the file
+// can be checked before bytes are copied out of the mapping: pages past a
+// truncated end cannot be read.
+class MappedFile {
+private:
+  SharedPtr<FileGuard> file;
+  void* data;
+  size_t length;
+
+  MappedFile(const MappedFile& other);
+  MappedFile& operator=(const MappedFile& other);
+
+public:
+  MappedFile(const SharedPtr<FileGuard>& file, size_t length);
+  ~MappedFile();
+
+  bool isValid() const;
+  const char* bytes() const;
+  size_t size() const;
+  const SharedPtr<FileGuard>& getFile() const;
+  // Whether the file still holds everything before end
+  bool covers(size_t end) const;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef MASTERPROCESS_HPP
+#define MASTERPROCESS_HPP
+
+#include <sys/types.h>
+#include <ctime>
+#include <map>
+#include <vector>
+
+class SocketManager;
+
+// The nginx process model, used when the config sets worker_processes. The
+// master parses the config and opens the listeners, then forks the workers,
+// each running SocketManager::handleClients() on its own copy of everything.
+// The master never accepts; it respawns workers that die and turns signals
+// into worker generations:
+//  - SIGHUP reloads here, starts workers on the new config and sends the
+//    old ones SIGQUIT
+//  - SIGQUIT and SIGTERM are passed on, and the master exits once every
+//    worker has
+//  - SIGUSR2 hands the listeners to a new master binary, then stops the
+//    workers gracefully once it serves
+class MasterProcess {
+private:
+  struct Worker {
+    time_t started;
+    unsigned generation;
+  };
+  SocketManager& manager;
+  int signalFd;
+  int epfd;
+  unsigned generation;          // the workers new ones are counted against
+  std::map<pid_t, Worker> workers;
+  std::vector<time_t> respawns;  // when each queued respawn may run
+  bool stopping;
+
+  static const int RESPAWN_DELAY = 1;  // for a worker that died right away
+
+  MasterProcess(const MasterProcess& other);
+  MasterProcess& operator=(const MasterProcess& other);
+
+  size_t workerCount() const;
+  void spawnWorker();
+  void startGeneration();
+  void signalWorkers(int signo, bool oldOnly);
+  void reapWorkers();
+  void runRespawns();
+  void handleSignals();
+  void stop(int signo);
+
+public:
+  explicit MasterProcess(SocketManager& manager);
+  ~MasterProcess();
+
+  void run();
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <ostream>
+
+// Counters kept by the event loop; printed on demand and at shutdown.
+struct ServerMetrics {
+  unsigned long connectionsAccepted;
+  unsigned long requestsHandled;
+  unsigned long cgiStarted;
+  unsigned long cgiCollapsed;     // requests answered by another's CGI run
+  unsigned long cgiCacheHits;
+  unsigned long cgiCacheMisses;
+  unsigned long cgiCacheStale;    // served stale while a refresh ran
+  unsigned long contentCacheHits;
+  unsigned long contentCacheMisses;
+  unsigned long long contentBytesSaved;  // body bytes not read from disk
+  unsigned long gzipResponses;
+  unsigned long long gzipBytesIn;
+  unsigned long long gzipBytesOut;
+  unsigned long abortedRequests;  // client left while work was in flight
+  unsigned long abortedCgi;       // CGI children killed because of that
+  unsigned long configReloads;
+
+  ServerMetrics();
+  double contentHitRatio() const;
+  void print(std::ostream& out) const;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef OPENFILECACHE_HPP
+#define OPENFILECACHE_HPP
+
+#include <sys/stat.h>
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include "MappedFile.hpp"
+#include "ResourceGuards.hpp"
+#include "SharedPtr.hpp"
+
+// What the static file path needs to know about a resolved path
+struct OpenFileInfo {
+  bool exists;
+  int error;  // errno of the failed stat() for negative entries
+  struct stat st;
+  std::string mimeType;
+
+  OpenFileInfo();
+};
+
+// open_file_cache: stat() results, open descriptors, resolved index files,
+// MIME types and failed lookups, keyed by full path. An entry is trusted for
+// `valid` seconds before it is stat()ed again, dropped once unused for
+// `inactive` seconds, and the least recently used entries go first when
+// more than `max` are held. Without configuration nothing is kept longer
+// than the object itself, so a scratch instance serves uncached lookups.
+// While the docroot watcher covers the root, entries stay valid until it
+// reports a change, however old they are.
+class OpenFileCache {
+private:
+  struct Entry {
+    OpenFileInfo info;
+    SharedPtr<FileGuard> file;
+    SharedPtr<MappedFile> mapping;
+    bool indexResolved;
+    std::string indexPath;  // directories: first existing index file
+    time_t validated;
+    time_t lastUsed;
+    std::list<std::string>::iterator lruPos;
+  };
+  std::map<std::string, Entry> entries;
+  std::list<std::string> lru;  // most recently used first
+  size_t max;
+  time_t inactive;
+  time_t valid;
+  bool watched;
+
+  Entry& fetch(const std::string& path, time_t now);
+  void evict(std::map<std::string, Entry>::iterator entry);
+
+public:
+  OpenFileCache();
+  ~OpenFileCache();
+
+  void configure(size_t max, time_t inactive, time_t valid);
+  void setWatched(bool watched);
+  OpenFileInfo stat(const std::string& path, time_t now);
+  // The first index file that exists inside dirPath, "" if none does
+  std::string resolveIndex(const std::string& dirPath,
+    const std::vector<std::string>& indexFiles, time_t now);
+  // Read-only descriptor for a regular file, shared with earlier callers
+  SharedPtr<FileGuard> open(const std::string& path, time_t now);
+  // The whole file mapped read-only, likewise shared; invalid if mmap fails
+  SharedPtr<MappedFile> map(const std::string& path, time_t now);
+
+  void expire(time_t now);
+  void invalidate(const std::string& path);
+  void invalidateAll();
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef PACKARCHIVE_HPP
+#define PACKARCHIVE_HPP
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <exception>
+#include <string>
+#include "MappedFile.hpp"
+#include "SharedPtr.hpp"
+
+// On-disk layout of a docroot packed by `make pack` (tools/pack.cpp), in the
+// byte order of the host that built it:
+//
+//   PackHeader | PackRecord[entryCount] | uint32_t buckets[bucketCount]
+//   | string table | padding | file contents, each starting on a page
+//
+// The buckets are an open-addressing hash table (linear probing) over the
+// request paths; a bucket holds 1 + the record index, 0 when empty. Paths,
+// MIME types and ETags live in the string table.
+#define PACK_MAGIC "PGXPACK1"
+#define PACK_ALIGN 4096
+
+enum PackVariant {
+  PACK_IDENTITY = 0,
+  PACK_GZIP,
+  PACK_BROTLI,
+  PACK_VARIANTS
+};
+
+struct PackHeader {
+  char magic[8];
+  uint32_t entryCount;
+  uint32_t bucketCount;  // power of two
+  uint64_t stringsOffset;
+  uint64_t stringsSize;
+};
+
+struct PackString {
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct PackRecord {
+  PackString path;  // "/css/main.css", relative to the packed docroot
+  PackString mimeType;
+  PackString etag;  // quoted, ready to send
+  int64_t mtime;
+  uint32_t variants;  // bit i set: variant i is present
+  uint32_t reserved;
+  uint64_t offset[PACK_VARIANTS];
+  uint64_t length[PACK_VARIANTS];
+};
+
+uint32_t packHash(const char* data, size_t length);
+
+// A packed docroot mapped read-only. Lookups touch only the mapping, never
+// the filesystem; responses keep the mapping alive through SharedPtr, so the
+// archive can be swapped underneath them.
+class PackArchive {
+private:
+  SharedPtr<MappedFile> mapping;
+  std::string path;
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  const PackHeader* header;
+  const PackRecord* records;
+  const uint32_t* buckets;
+  const char* strings;
+
+  PackArchive(const PackArchive& other);
+  PackArchive& operator=(const PackArchive& other);
+
+  bool validString(const PackString& s) const;
+  bool validate() const;
+
+public:
+  class InvalidPack : public std::exception {
+  public:
+    virtual const char* what() const throw();
+  };
+
+  // Maps the archive at path; throws InvalidPack when it is unreadable or
+  // malformed
+  explicit PackArchive(const std::string& path);
+  ~PackArchive();
+
+  // Whether path now names a different file than the one mapped
+  bool isReplaced() const;
+  const std::string& getPath() const;
+  const SharedPtr<MappedFile>& getMapping() const;
+
+  const PackRecord* find(const std::string& requestPath) const;
+  std::string getString(const PackString& s) const;
+};
+
+#endif
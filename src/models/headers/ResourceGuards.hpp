@@ -53,4 +53,20 @@ public:
     bool isValid() const;
 };
 
+// RAII guard for regular file FDs (temp files, cached files) - auto-closes
+class FileGuard {
+private:
+    int fd;
+
+    FileGuard(const FileGuard&);
+    FileGuard& operator=(const FileGuard&);
+
+public:
+    explicit FileGuard(int file_fd = -1);
+    ~FileGuard();
+    int get() const;
+    int release();
+    bool isValid() const;
+};
+
 #endif
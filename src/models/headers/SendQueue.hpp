@@ -0,0 +1,58 @@
+#ifndef SENDQUEUE_HPP
+#define SENDQUEUE_HPP
+
+#include <sys/types.h>
+#include <deque>
+#include <string>
+#include "MappedFile.hpp"
+#include "ResourceGuards.hpp"
+#include "SharedPtr.hpp"
+
+// Outgoing bytes for one connection, kept as a list of segments so that a
+// response body can be handed over without being copied behind its headers.
+// A segment either owns bytes in memory, shares a buffer with other queues
+// (cached content), or refers to a range of an open file, which is sent with
+// sendfile() and never read into user space. A file range that is also
+// mapped goes out with the memory segments in one sendmsg() instead.
+class SendQueue {
+private:
+  struct Segment {
+    std::string data;
+    SharedPtr<std::string> shared; // set for shared segments, used instead of data
+    SharedPtr<FileGuard> file; // set for file segments; offsets are in the file
+    SharedPtr<MappedFile> mapping; // optional mapping of file, dropped if it shrank
+    size_t offset;
+    size_t end;
+  };
+  std::deque<Segment> segments;
+
+  ssize_t flushMemory(int fd);
+  ssize_t flushFile(int fd);
+  static bool sendsFromMemory(Segment& segment);
+
+public:
+  SendQueue();
+  ~SendQueue();
+
+  void clear();
+  bool empty() const;
+  size_t size() const;
+
+  // Copies the string into the queue
+  void append(const std::string& data);
+  // Takes over the storage of data (left empty) and queues [offset, end)
+  void adopt(std::string& data, size_t offset, size_t end);
+  // Queues [offset, offset + length) of a buffer other queues may share
+  void appendShared(const SharedPtr<std::string>& buffer, size_t offset,
+    size_t length);
+  // Queues [offset, offset + length) of the file; the file stays open for as
+  // long as any queue still refers to it
+  void appendFile(const SharedPtr<FileGuard>& file, off_t offset, size_t length,
+    const SharedPtr<MappedFile>& mapping = SharedPtr<MappedFile>());
+
+  // Writes as much as the socket accepts; returns bytes sent, 0 when the
+  // socket would block, -1 on error
+  ssize_t flush(int fd);
+};
+
+#endif
@@ -2,7 +2,9 @@
 #define SERVER_HPP
 
 #include <BaseBlock.hpp>
+#include <CompiledLocation.hpp>
 #include <LocationConfig.hpp>
+#include <LocationMatcher.hpp>
 
 struct ListenCtx {
   u_int16_t port;
@@ -24,6 +26,9 @@ private:
   std::vector<std::string> _serverNames;
   std::string _root;
   std::vector<LocationConfig> _locations;
+  LocationMatcher _locationMatcher;  // indexes into _locations
+  // one per location, then the one for requests matching none
+  std::vector<CompiledLocation> _compiled;
 
   bool validateAddress(const std::string& addr) const;
 
@@ -49,6 +54,11 @@ public:
   void addLocation(const LocationConfig& location);
   const std::vector<LocationConfig>& getLocations() const;
   const LocationConfig* findLocation(const std::string& path) const;
+
+  // Resolves every block once the whole config is parsed
+  void compile();
+  // location: NULL or one returned by findLocation()
+  const CompiledLocation& getCompiled(const LocationConfig* location) const;
 };
 
 #endif
\ No newline at end of file
@@ -4,20 +4,39 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/types.h>
 #include <map>
 #include <memory>
 #include <string>
 #include <vector>
+#include "CgiCollapser.hpp"
+#include "ConfigSnapshot.hpp"
+#include "DocrootWatcher.hpp"
+#include "GzipFilter.hpp"
+#include "Metrics.hpp"
+#include "PackArchive.hpp"
+#include "SendQueue.hpp"
 
 class HttpParser;
 class HttpRequest;
 class HttpResponse;
 class Server;
+class BaseBlock;
+class CgiJob;
 
 #define EPOLL_DEFAULT 0
+// A client is watched for input and a peer shutdown until its response is
+// queued, so one that leaves while a CGI runs is noticed; only then is it
+// watched for EPOLLOUT, which would otherwise fire on every loop pass
+#define CLIENT_EPOLL_EVENTS (EPOLLIN | EPOLLRDHUP)
+#define RESPONSE_EPOLL_EVENTS EPOLLOUT
 #define MAX_HEADER_SIZE 4096                                // 4 KB
 #define MAX_BODY_SIZE 65536                                 // 64 KB
 #define MAX_REQUEST_SIZE (MAX_HEADER_SIZE + MAX_BODY_SIZE)  // 68 KB
+// Set for a binary started by an upgrade: "host:port=fd;..." of the
+// listening sockets it inherits, and the pipe it reports readiness on
+#define LISTEN_FDS_ENV "WEBSERV_LISTEN_FDS"
+#define UPGRADE_READY_ENV "WEBSERV_UPGRADE_READY"
 
 struct ServerSocketInfo {
   std::string host;
@@ -34,12 +53,41 @@ struct ServerSocketInfo {
 class SocketManager {
 private:
   std::vector<int> listeningSockets;
+  std::map<std::string, int> listenAddresses;  // "host:port" -> its socket
   std::map<int, std::string> requestBuffers;
   std::map<int, time_t> lastActivity;
-  std::map<int, std::string> sendBuffers;
+  std::map<int, SendQueue> sendBuffers;
   std::map<int, sockaddr_in> clientAddresses;
+  std::map<int, CgiJob*> cgiJobs;  // client fd -> running CGI
+  std::map<int, int> cgiPipes;     // CGI pipe fd -> client fd
+  std::map<int, int> localRedirects;  // client fd -> CGI local redirects so far
+  std::map<int, std::string> requestHosts;  // client fd -> Host of its request
+  CgiCollapser cgiCollapser;
+  std::map<int, std::pair<const BaseBlock*, std::string> > cacheFills;  // job -> entry
+  int nextRefreshId;  // background refreshes run under negative client ids
+  DocrootWatcher docrootWatcher;
+  std::map<std::string, SharedPtr<PackArchive> > packs;  // by archive path
+  std::map<std::string, time_t> rejectedPacks;  // path -> mtime of a broken replacement
+  time_t lastPackCheck;
+  std::map<int, const CompiledLocation*> gzipClients;  // fd -> its block, if it takes gzip
+  GzipPool gzipPool;
+  static const int MAX_LOCAL_REDIRECTS = 10;
   static const int CLIENT_TIMEOUT = 60;
-  std::vector<Server> serverList;
+  static const int PACK_CHECK_INTERVAL = 1;  // seconds between archive stats
+  SharedPtr<ConfigSnapshot> config;  // what new requests are served with
+  std::string configFile;            // read again on SIGHUP
+  int signalFd;
+  bool draining;        // SIGQUIT: no new connections, finishing the rest
+  bool stopped;         // the event loop returns
+  time_t drainDeadline;
+  size_t drainPending;  // connections still busy when the drain began
+  std::vector<std::string> commandLine;  // what SIGUSR2 executes again
+  pid_t upgradePid;  // the new binary while it starts, else -1
+  int upgradeFd;     // its readiness pipe, else -1
+  int readyFd;       // in the new binary: the old one's pipe, else -1
+  std::map<int, sockaddr_in> localAddresses;  // client fd -> address it reached
+  std::map<int, const VirtualHosts*> clientHosts;  // client fd, in config
+  ServerMetrics metrics;
 
   std::auto_ptr<HttpParser> httpParser;
   std::auto_ptr<HttpResponse> responseBuilder;
@@ -50,15 +98,31 @@ public:
 
   // Server management
   void setServers(const std::vector<Server>& servers);
-  Server& selectServerForClient(int clientFd);
+  void setConfigFile(const std::string& path);
+  void setCommandLine(char** argv);
+  Server& selectServerForClient(int clientFd, const std::string& host = "");
 
   bool initSockets(const std::vector<ServerSocketInfo>& servers);
+  int openListener(const std::string& host, const std::string& port);
+  bool updateListeners(const std::vector<ServerSocketInfo>& servers, int epfd);
   void closeSocket();
 
   bool isServerSocket(int fd) const;
   const std::vector<int>& getSockets() const;
 
   void handleClients();
+  void watchSignals(int epfd);
+  void handleSignals(int epfd);
+  void reapCgiJobs(int epfd);
+  bool reloadConfig(int epfd);
+  void beginDrain(int epfd);
+  void checkDrain(int epfd);
+  void stopNow(int epfd);
+  size_t abortAll(int epfd);
+  void startUpgrade(int epfd);
+  bool finishUpgrade(int epfd);
+  void notifyUpgradeReady();
+  void reportShutdown(const char* how, size_t drained, size_t aborted);
   void handleRequest(int readyServerFd, int epoll_fd);
   void acceptNewClient(int readyServerFd, int epoll_fd);
   void handleTimeouts(int epoll_fd);
@@ -72,11 +136,44 @@ public:
   void sendHttpError(int fd, const std::string& status, int epfd);
   bool isBodyTooLarge(int fd);
   bool hasInvalidPercentEncoding(int fd);
+  size_t bodyLimitForRequest(int fd, const std::string& headers);
   HttpRequest* fillRequest(const std::string& rawRequest, Server& server);
+  OpenFileCache* openFileCacheFor(const BaseBlock& block,
+    const std::string& rootDir);
+  void watchDocroots(int epfd);
+  void applyDocrootChanges();
+  void loadPacks(const std::vector<Server>& servers,
+    std::map<std::string, SharedPtr<PackArchive> >& loaded) const;
+  void refreshPacks(time_t now);
+  ContentCache* contentCacheFor(const BaseBlock& block);
   void processFullRequest(int readyServerFd,
     int epfd,
     const std::string& rawRequest,
     sockaddr_in& clientAddr);
+  void closeConnection(int fd, int epfd);
+  bool hasWorkInFlight(int fd) const;
+  void abortConnection(int fd, int epfd);
+  const ServerMetrics& getMetrics() const;
+  const ConfigSnapshot& getConfig() const;
+  int getUpgradeFd() const;
+
+  // CGI jobs driven by the event loop
+  bool isCgiPipe(int fd) const;
+  void startCgiJob(int clientFd, CgiJob* job, const HttpRequest& request);
+  void handleCgiEvent(int pipeFd, uint32_t events, int epfd);
+  void completeCgiJob(int clientFd, int epfd);
+  void queueResponse(int clientFd, int epfd, HttpResponse& res, bool shared);
+  void noteGzipClient(int clientFd, const HttpRequest& request);
+  bool compressResponse(int clientFd, HttpResponse& res);
+  bool serveFromCache(int clientFd, int epfd, HttpRequest& request,
+    sockaddr_in& clientAddr, std::string& cacheKey,
+    const BaseBlock*& cacheBlock);
+  void startCacheRefresh(HttpRequest& request, sockaddr_in& clientAddr,
+    int epfd, const BaseBlock* cacheBlock, const std::string& key);
+  void fillCache(int clientFd, ConfigSnapshot& snapshot, HttpResponse& res,
+    const std::string& redirect);
+  void trackCgiPipes(int clientFd);
+  void untrackCgiPipes(int clientFd);
 };
 
 #endif
\ No newline at end of file
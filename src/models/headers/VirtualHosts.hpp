@@ -0,0 +1,38 @@
+#ifndef VIRTUALHOSTS_HPP
+#define VIRTUALHOSTS_HPP
+
+#include <string>
+#include <vector>
+#include "HashTable.hpp"
+
+// The servers behind one listening address, as indexes into the server
+// list, resolved by Host the way nginx does: an exact server_name from a
+// hash table, else the longest "*.example.com" wildcard from a trie keyed by
+// labels right to left, else the first server declared for the address.
+// ".example.com" is both example.com and *.example.com. Names and hosts
+// are compared without case.
+class VirtualHosts {
+private:
+  struct Node {
+    HashTable<size_t> children;  // next label to the left -> node
+    long server;  // "*." name ending here, -1: none
+
+    Node();
+  };
+  size_t defaultServer;
+  HashTable<size_t> exact;
+  std::vector<Node> nodes;  // nodes[0] is the root
+
+  void addWildcard(const std::string& suffix, size_t server);
+
+public:
+  explicit VirtualHosts(size_t defaultServer = 0);
+  ~VirtualHosts();
+
+  // The first server to claim a name keeps it
+  void addName(const std::string& name, size_t server);
+  // host as sent, port and trailing dot allowed
+  size_t find(const std::string& host) const;
+};
+
+#endif
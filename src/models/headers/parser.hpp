@@ -1,6 +1,7 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -8,18 +9,45 @@
 
 enum TokenType { ATTRIBUTE, LEVEL, KEYWORD, NUMBER, STRING, SYMBOL };
 
+// A token's text as a slice of the buffer the lexer ran over, which has to
+// outlive the tokens; nothing is copied until a directive takes a value.
+struct TokenText {
+  const char* data;
+  size_t length;
+
+  std::string str() const { return std::string(data, length); }
+  operator std::string() const { return str(); }
+  size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+  char operator[](size_t i) const { return data[i]; }
+  bool operator==(const char* s) const {
+    return std::strncmp(data, s, length) == 0 && s[length] == '\0';
+  }
+  bool operator==(const std::string& s) const {
+    return s.size() == length && std::memcmp(data, s.data(), length) == 0;
+  }
+  bool operator!=(const char* s) const { return !(*this == s); }
+  bool operator!=(const std::string& s) const { return !(*this == s); }
+};
+
 struct Token {
   TokenType type;
-  std::string value;
+  TokenText value;
   int quoted;
 };
 
 class Container;
 
+// The tokens point into content
 std::vector<Token> lexer(const std::string& content);
 std::string readFile(const std::string& filename);
 void checks(const std::vector<Token>& tokens);
 int isAllowedTokens(const std::vector<Token>& tokens);
+bool isAllDigits(const std::string& s);
+// Whether name is a directive the parser has a handler for
+bool isDirective(const char* name, size_t length);
 Container parser(const std::vector<Token>& tokens);
+// readFile, lexer, checks, parser and compile in one go; throws on any error
+Container loadConfig(const std::string& filename);
 
-#endif
\ No newline at end of file
+#endif
@@ -2,25 +2,41 @@
 #define REQUESTCONTEXT_HPP
 
 #include <string>
+#include "CompiledLocation.hpp"
 #include "LocationConfig.hpp"
 #include "Server.hpp"
 
+class HttpResponse;
+class OpenFileCache;
+class ContentCache;
+class PackArchive;
+
 class RequestContext {
 public:
   const Server& server;
   const LocationConfig* location;
-  std::string rootDir;
+  const CompiledLocation& compiled;  // everything below is read from here
+  const std::string& rootDir;
+  OpenFileCache* openFileCache;  // set by SocketManager when open_file_cache is on
+  ContentCache* contentCache;    // likewise for content_cache
+  PackArchive* pack;             // root_pack archive replacing rootDir
 
   RequestContext(const Server& srv, const LocationConfig* loc);
+  const BaseBlock& getBlock() const;
+  void invalidateCachedPath(const std::string& fullPath) const;
   const std::vector<std::string>& getIndexFiles() const;
   size_t getClientMaxBodySize() const;
+  size_t getCgiBufferLimit() const;
+  bool isCgiCollapsingEnabled() const;
   bool getAutoIndex() const;
-  const std::string* getErrorPage(const u_int16_t code) const;
+  bool isCgiEnabled() const;
+  const std::string& getUploadDir() const;
+  const std::string* getCgiInterpreter(const std::string& scriptPath) const;
   bool isMethodAllowed(const std::string& method) const;
   std::string getFullPath(const std::string& requestPath) const;
-  std::string getErrorPageContent(u_int16_t code) const;
+  const std::string* getErrorPage(u_int16_t code) const;
   bool hasReturn() const;
-  const std::pair<u_int16_t, std::string>& getReturnData() const;
+  void setReturnResponse(HttpResponse& res, bool includeBody) const;
 };
 
 #endif
@@ -0,0 +1,102 @@
+#include "AhoCorasick.hpp"
+#include <cctype>
+#include <cstring>
+#include <deque>
+
+AhoCorasick::AhoCorasick() : literals(), classCount(1), transitions(), outputs()
+{
+    std::memset(byteClass, 0, sizeof(byteClass));
+}
+
+AhoCorasick::~AhoCorasick() {}
+
+size_t AhoCorasick::add(const std::string &literal)
+{
+    literals.push_back(literal);
+    return literals.size() - 1;
+}
+
+void AhoCorasick::build()
+{
+    // Class 0 is every byte no literal uses; letters share their case's class
+    std::memset(byteClass, 0, sizeof(byteClass));
+    classCount = 1;
+    for (size_t i = 0; i < literals.size(); ++i)
+    {
+        for (size_t j = 0; j < literals[i].size(); ++j)
+        {
+            unsigned char c = std::tolower(static_cast<unsigned char>(literals[i][j]));
+            if (byteClass[c] == 0)
+                byteClass[c] = classCount++;
+        }
+    }
+    for (int c = 'A'; c <= 'Z'; ++c)
+        byteClass[c] = byteClass[std::tolower(c)];
+
+    // The trie; state 0 is the root, so 0 also means "no edge" while building
+    transitions.assign(classCount, 0);
+    outputs.assign(1, std::vector<size_t>());
+    for (size_t i = 0; i < literals.size(); ++i)
+    {
+        uint32_t state = 0;
+        for (size_t j = 0; j < literals[i].size(); ++j)
+        {
+            size_t edge = state * classCount + byteClass[static_cast<unsigned char>(literals[i][j])];
+            if (transitions[edge] == 0)
+            {
+                transitions[edge] = outputs.size();
+                transitions.resize(transitions.size() + classCount, 0);
+                outputs.push_back(std::vector<size_t>());
+            }
+            state = transitions[edge];
+        }
+        outputs[state].push_back(i);
+    }
+
+    // Breadth first, missing edges take the failure state's edge, and each
+    // state reports what its failure state reports
+    std::vector<uint32_t> failure(outputs.size(), 0);
+    std::deque<uint32_t> queue;
+    for (size_t c = 1; c < classCount; ++c)
+    {
+        if (transitions[c] != 0)
+            queue.push_back(transitions[c]);
+    }
+    while (!queue.empty())
+    {
+        uint32_t state = queue.front();
+        queue.pop_front();
+        const std::vector<size_t> &inherited = outputs[failure[state]];
+        outputs[state].insert(outputs[state].end(), inherited.begin(), inherited.end());
+        for (size_t c = 1; c < classCount; ++c)
+        {
+            size_t edge = state * classCount + c;
+            uint32_t fallback = transitions[failure[state] * classCount + c];
+            if (transitions[edge] == 0)
+            {
+                transitions[edge] = fallback;
+                continue;
+            }
+            failure[transitions[edge]] = fallback;
+            queue.push_back(transitions[edge]);
+        }
+    }
+}
+
+void AhoCorasick::scan(const std::string &text, std::vector<size_t> &found) const
+{
+    if (outputs.empty())
+        return;
+    uint32_t state = 0;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        state = transitions[state * classCount + byteClass[static_cast<unsigned char>(text[i])]];
+        const std::vector<size_t> &hits = outputs[state];
+        found.insert(found.end(), hits.begin(), hits.end());
+    }
+}
+
+size_t AhoCorasick::size() const
+{
+    return literals.size();
+}
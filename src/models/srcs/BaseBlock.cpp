@@ -1,5 +1,7 @@
 #include <BaseBlock.hpp>
 #include <cerrno>
+#include <sstream>
+#include "HttpUtils.hpp"
 
 BaseBlock::BaseBlock()
   : _root(DEFAULT_ROOT_PATH),
@@ -10,7 +12,42 @@ BaseBlock::BaseBlock()
   _autoIndex(false),
   _cgiEnabled(false),
   _cgiExplicitlySet(false),
-  _cgiPassMap() {
+  _cgiPassMap(),
+  _cgiBufferCount(DEFAULT_CGI_BUFFER_COUNT),
+  _cgiBufferSize(DEFAULT_CGI_BUFFER_SIZE),
+  _cgiBuffersExplicitlySet(false),
+  _cgiCollapsing(false),
+  _cgiCollapsingExplicitlySet(false),
+  _cgiCacheSize(0),
+  _cgiCacheExplicitlySet(false),
+  _cgiCacheKey(),
+  _cgiCacheValid(-1),
+  _openFileCacheMax(0),
+  _openFileCacheInactive(DEFAULT_OPEN_FILE_CACHE_INACTIVE),
+  _openFileCacheValid(DEFAULT_OPEN_FILE_CACHE_VALID),
+  _openFileCacheExplicitlySet(false),
+  _contentCacheSize(0),
+  _contentCacheMaxFile(DEFAULT_CONTENT_CACHE_MAX_FILE),
+  _contentCacheExplicitlySet(false),
+  _mmapMaxFile(0),
+  _mmapExplicitlySet(false),
+  _rootPack(),
+  _gzipStatic(false),
+  _gzipStaticExplicitlySet(false),
+  _gzip(false),
+  _gzipExplicitlySet(false),
+  _gzipTypes(),
+  _gzipMinLength(DEFAULT_GZIP_MIN_LENGTH),
+  _gzipMinLengthExplicitlySet(false),
+  _gzipCompLevel(0),
+  _expiresHeaders(),
+  _expiresExplicitlySet(false),
+  _addedHeaders(),
+  _addedHeadersAlways(),
+  _addedHeadersExplicitlySet(false),
+  _successHeaders(),
+  _drainTimeout(DEFAULT_DRAIN_TIMEOUT),
+  _workerProcesses(0) {
 }
 
 BaseBlock::BaseBlock(const BaseBlock& obj)
@@ -22,7 +59,42 @@ BaseBlock::BaseBlock(const BaseBlock& obj)
   _autoIndex(obj._autoIndex),
   _cgiEnabled(obj._cgiEnabled),
   _cgiExplicitlySet(obj._cgiExplicitlySet),
-  _cgiPassMap(obj._cgiPassMap) {
+  _cgiPassMap(obj._cgiPassMap),
+  _cgiBufferCount(obj._cgiBufferCount),
+  _cgiBufferSize(obj._cgiBufferSize),
+  _cgiBuffersExplicitlySet(obj._cgiBuffersExplicitlySet),
+  _cgiCollapsing(obj._cgiCollapsing),
+  _cgiCollapsingExplicitlySet(obj._cgiCollapsingExplicitlySet),
+  _cgiCacheSize(obj._cgiCacheSize),
+  _cgiCacheExplicitlySet(obj._cgiCacheExplicitlySet),
+  _cgiCacheKey(obj._cgiCacheKey),
+  _cgiCacheValid(obj._cgiCacheValid),
+  _openFileCacheMax(obj._openFileCacheMax),
+  _openFileCacheInactive(obj._openFileCacheInactive),
+  _openFileCacheValid(obj._openFileCacheValid),
+  _openFileCacheExplicitlySet(obj._openFileCacheExplicitlySet),
+  _contentCacheSize(obj._contentCacheSize),
+  _contentCacheMaxFile(obj._contentCacheMaxFile),
+  _contentCacheExplicitlySet(obj._contentCacheExplicitlySet),
+  _mmapMaxFile(obj._mmapMaxFile),
+  _mmapExplicitlySet(obj._mmapExplicitlySet),
+  _rootPack(obj._rootPack),
+  _gzipStatic(obj._gzipStatic),
+  _gzipStaticExplicitlySet(obj._gzipStaticExplicitlySet),
+  _gzip(obj._gzip),
+  _gzipExplicitlySet(obj._gzipExplicitlySet),
+  _gzipTypes(obj._gzipTypes),
+  _gzipMinLength(obj._gzipMinLength),
+  _gzipMinLengthExplicitlySet(obj._gzipMinLengthExplicitlySet),
+  _gzipCompLevel(obj._gzipCompLevel),
+  _expiresHeaders(obj._expiresHeaders),
+  _expiresExplicitlySet(obj._expiresExplicitlySet),
+  _addedHeaders(obj._addedHeaders),
+  _addedHeadersAlways(obj._addedHeadersAlways),
+  _addedHeadersExplicitlySet(obj._addedHeadersExplicitlySet),
+  _successHeaders(obj._successHeaders),
+  _drainTimeout(obj._drainTimeout),
+  _workerProcesses(obj._workerProcesses) {
 }
 
 void BaseBlock::setRoot(const std::string& root) {
@@ -50,9 +122,11 @@ bool BaseBlock::hasReturn() const {
 
 BaseBlock::~BaseBlock() {};
 
-void BaseBlock::setClientMaxBodySize(std::string& sSize) {
+// Parses "<n>[k|m|g]" into a byte count
+static size_t parseSize(std::string& sSize) {
   char sizeCategory = 0;
   char* endptr;
+  size_t size;
 
   if (sSize.empty() || sSize.find('.') != std::string::npos)
     throw CommonExceptions::InvalidValue();
@@ -60,34 +134,418 @@ void BaseBlock::setClientMaxBodySize(std::string& sSize) {
     sizeCategory = tolower(str_back(sSize));
     sSize.erase(sSize.size() - 1);
   }
-  this->_clientMaxBodySize = strtoul(sSize.c_str(), &endptr, 10);
+  errno = 0;
+  size = strtoul(sSize.c_str(), &endptr, 10);
 
-  if (*endptr || errno == ERANGE)
+  if (sSize.empty() || *endptr || errno == ERANGE)
     throw CommonExceptions::InvalidValue();
 
   switch (sizeCategory) {
   case 0:
-    return;
+    return size;
   case 'k':
-    if (this->_clientMaxBodySize > MAX_KILOBYTE)
+    if (size > MAX_KILOBYTE)
       throw CommonExceptions::InvalidValue();
-    this->_clientMaxBodySize *= KILOBYTE;
-    return;
+    return size * KILOBYTE;
   case 'm':
-    if (this->_clientMaxBodySize > MAX_MEGABYTE)
+    if (size > MAX_MEGABYTE)
       throw CommonExceptions::InvalidValue();
-    this->_clientMaxBodySize *= MEGABYTE;
-    return;
+    return size * MEGABYTE;
   case 'g':
-    if (this->_clientMaxBodySize > MAX_GIGABYTE)
+    if (size > MAX_GIGABYTE)
       throw CommonExceptions::InvalidValue();
-    this->_clientMaxBodySize *= GIGABYTE;
-    return;
+    return size * GIGABYTE;
   default:
     throw CommonExceptions::InvalidValue();
   }
 }
 
+// Parses "<n>[s|m|h|d]" into seconds; seconds when no unit is given
+static time_t parseTime(const std::string& sTime) {
+  char* endptr;
+
+  errno = 0;
+  long value = strtol(sTime.c_str(), &endptr, 10);
+  if (sTime.empty() || endptr == sTime.c_str() || value < 0 || errno == ERANGE)
+    throw CommonExceptions::InvalidValue();
+  std::string unit(endptr);
+  if (unit == "m")
+    value *= 60;
+  else if (unit == "h")
+    value *= 3600;
+  else if (unit == "d")
+    value *= 86400;
+  else if (!unit.empty() && unit != "s")
+    throw CommonExceptions::InvalidValue();
+  return value;
+}
+
+void BaseBlock::setClientMaxBodySize(std::string& sSize) {
+  this->_clientMaxBodySize = parseSize(sSize);
+}
+
+void BaseBlock::setCgiBuffers(const std::string& count, std::string& sSize) {
+  char* endptr;
+
+  errno = 0;
+  size_t buffers = strtoul(count.c_str(), &endptr, 10);
+  if (count.empty() || *endptr || errno == ERANGE)
+    throw CommonExceptions::InvalidValue();
+  size_t size = parseSize(sSize);
+
+  if (buffers == 0 || size == 0 || buffers > MAX_CGI_BUFFER_COUNT)
+    throw CommonExceptions::InvalidValue();
+  this->_cgiBufferCount = buffers;
+  this->_cgiBufferSize = size;
+  this->_cgiBuffersExplicitlySet = true;
+}
+
+size_t BaseBlock::getCgiBufferCount() const {
+  return this->_cgiBufferCount;
+}
+
+size_t BaseBlock::getCgiBufferSize() const {
+  return this->_cgiBufferSize;
+}
+
+// How much CGI output is kept in memory before the rest goes to a temp file
+size_t BaseBlock::getCgiBufferLimit() const {
+  return this->_cgiBufferCount * this->_cgiBufferSize;
+}
+
+void BaseBlock::setCgiCollapsing(bool enabled) {
+  this->_cgiCollapsing = enabled;
+  this->_cgiCollapsingExplicitlySet = true;
+}
+
+bool BaseBlock::isCgiCollapsingEnabled() const {
+  return this->_cgiCollapsing;
+}
+
+void BaseBlock::setCgiCache(std::string& sSize) {
+  this->_cgiCacheSize = sSize == "off" ? 0 : parseSize(sSize);
+  this->_cgiCacheExplicitlySet = true;
+}
+
+void BaseBlock::setCgiCacheKey(const std::string& keyTemplate) {
+  if (keyTemplate.empty())
+    throw CommonExceptions::InvalidValue();
+  this->_cgiCacheKey = keyTemplate;
+}
+
+void BaseBlock::setCgiCacheValid(const std::string& sTime) {
+  this->_cgiCacheValid = parseTime(sTime);
+}
+
+size_t BaseBlock::getCgiCacheSize() const {
+  return this->_cgiCacheSize;
+}
+
+const std::string& BaseBlock::getCgiCacheKey() const {
+  static const std::string defaultKey(DEFAULT_CGI_CACHE_KEY);
+  return this->_cgiCacheKey.empty() ? defaultKey : this->_cgiCacheKey;
+}
+
+void BaseBlock::setDrainTimeout(const std::string& sTime) {
+  this->_drainTimeout = parseTime(sTime);
+}
+
+// How long a graceful shutdown lets requests in flight finish
+time_t BaseBlock::getDrainTimeout() const {
+  return this->_drainTimeout;
+}
+
+// worker_processes <n> | auto, auto being one per online CPU
+void BaseBlock::setWorkerProcesses(const std::string& count) {
+  if (count == "auto") {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    this->_workerProcesses = cpus > 0 ? cpus : 1;
+    return;
+  }
+  char* endptr;
+  errno = 0;
+  unsigned long value = strtoul(count.c_str(), &endptr, 10);
+  if (count.empty() || *endptr || errno == ERANGE || value == 0 ||
+      value > MAX_WORKER_PROCESSES)
+    throw CommonExceptions::InvalidValue();
+  this->_workerProcesses = value;
+}
+
+size_t BaseBlock::getWorkerProcesses() const {
+  return this->_workerProcesses;
+}
+
+// TTL for responses that carry no Cache-Control/Expires of their own
+time_t BaseBlock::getCgiCacheValid() const {
+  return this->_cgiCacheValid < 0 ? 0 : this->_cgiCacheValid;
+}
+
+// open_file_cache max=N [inactive=time] [valid=time] | off
+void BaseBlock::setOpenFileCache(const std::vector<std::string>& params) {
+  if (params.empty())
+    throw CommonExceptions::InvalidValue();
+  this->_openFileCacheExplicitlySet = true;
+  this->_openFileCacheMax = 0;
+  this->_openFileCacheInactive = DEFAULT_OPEN_FILE_CACHE_INACTIVE;
+  this->_openFileCacheValid = DEFAULT_OPEN_FILE_CACHE_VALID;
+  if (params.size() == 1 && params[0] == "off")
+    return;
+
+  for (size_t i = 0; i < params.size(); ++i) {
+    size_t eq = params[i].find('=');
+    if (eq == std::string::npos)
+      throw CommonExceptions::InvalidValue();
+    std::string name = params[i].substr(0, eq);
+    std::string value = params[i].substr(eq + 1);
+    if (name == "max") {
+      char* endptr;
+      errno = 0;
+      this->_openFileCacheMax = strtoul(value.c_str(), &endptr, 10);
+      if (value.empty() || *endptr || errno == ERANGE)
+        throw CommonExceptions::InvalidValue();
+    } else if (name == "inactive") {
+      this->_openFileCacheInactive = parseTime(value);
+    } else if (name == "valid") {
+      this->_openFileCacheValid = parseTime(value);
+    } else {
+      throw CommonExceptions::InvalidValue();
+    }
+  }
+  if (this->_openFileCacheMax == 0)
+    throw CommonExceptions::InvalidValue();
+}
+
+size_t BaseBlock::getOpenFileCacheMax() const {
+  return this->_openFileCacheMax;
+}
+
+time_t BaseBlock::getOpenFileCacheInactive() const {
+  return this->_openFileCacheInactive;
+}
+
+time_t BaseBlock::getOpenFileCacheValid() const {
+  return this->_openFileCacheValid;
+}
+
+// content_cache <size> [max_file=size] | off
+void BaseBlock::setContentCache(const std::vector<std::string>& params) {
+  if (params.empty())
+    throw CommonExceptions::InvalidValue();
+  this->_contentCacheExplicitlySet = true;
+  this->_contentCacheMaxFile = DEFAULT_CONTENT_CACHE_MAX_FILE;
+  if (params.size() == 1 && params[0] == "off") {
+    this->_contentCacheSize = 0;
+    return;
+  }
+
+  std::string sSize = params[0];
+  this->_contentCacheSize = parseSize(sSize);
+  for (size_t i = 1; i < params.size(); ++i) {
+    if (params[i].compare(0, 9, "max_file=") != 0)
+      throw CommonExceptions::InvalidValue();
+    std::string sMax = params[i].substr(9);
+    this->_contentCacheMaxFile = parseSize(sMax);
+  }
+  if (this->_contentCacheSize == 0)
+    throw CommonExceptions::InvalidValue();
+}
+
+size_t BaseBlock::getContentCacheSize() const {
+  return this->_contentCacheSize;
+}
+
+size_t BaseBlock::getContentCacheMaxFile() const {
+  return this->_contentCacheMaxFile;
+}
+
+// mmap <max file size> | off
+void BaseBlock::setMmap(std::string& sSize) {
+  this->_mmapMaxFile = sSize == "off" ? 0 : parseSize(sSize);
+  this->_mmapExplicitlySet = true;
+}
+
+size_t BaseBlock::getMmapMaxFile() const {
+  return this->_mmapMaxFile;
+}
+
+void BaseBlock::setRootPack(const std::string& archivePath) {
+  if (archivePath.empty())
+    throw CommonExceptions::InvalidValue();
+  this->_rootPack = archivePath;
+}
+
+const std::string& BaseBlock::getRootPack() const {
+  return this->_rootPack;
+}
+
+void BaseBlock::setGzipStatic(bool enabled) {
+  this->_gzipStatic = enabled;
+  this->_gzipStaticExplicitlySet = true;
+}
+
+bool BaseBlock::isGzipStaticEnabled() const {
+  return this->_gzipStatic;
+}
+
+void BaseBlock::setGzip(bool enabled) {
+  this->_gzip = enabled;
+  this->_gzipExplicitlySet = true;
+}
+
+// gzip_types mime/type... | *; text/html is always included
+void BaseBlock::setGzipTypes(const std::vector<std::string>& types) {
+  if (types.empty())
+    throw CommonExceptions::InvalidValue();
+  this->_gzipTypes.clear();
+  for (size_t i = 0; i < types.size(); ++i) {
+    if (types[i] != "*" && types[i].find('/') == std::string::npos)
+      throw CommonExceptions::InvalidValue();
+    this->_gzipTypes.push_back(toLowerStr(types[i]));
+  }
+}
+
+void BaseBlock::setGzipMinLength(std::string& sSize) {
+  this->_gzipMinLength = parseSize(sSize);
+  this->_gzipMinLengthExplicitlySet = true;
+}
+
+void BaseBlock::setGzipCompLevel(const std::string& level) {
+  if (level.size() != 1 || level[0] < '1' || level[0] > '9')
+    throw CommonExceptions::InvalidValue();
+  this->_gzipCompLevel = level[0] - '0';
+}
+
+bool BaseBlock::isGzipEnabled() const {
+  return this->_gzip;
+}
+
+const std::vector<std::string>& BaseBlock::getGzipTypes() const {
+  return this->_gzipTypes;
+}
+
+size_t BaseBlock::getGzipMinLength() const {
+  return this->_gzipMinLength;
+}
+
+int BaseBlock::getGzipCompLevel() const {
+  return this->_gzipCompLevel ? this->_gzipCompLevel : DEFAULT_GZIP_COMP_LEVEL;
+}
+
+// expires <time> | -<time> | epoch | max | off. A relative time becomes
+// Cache-Control: max-age alone, so the lines never depend on when they are
+// sent and are rendered once here; past times are sent as the epoch.
+void BaseBlock::setExpires(const std::string& value) {
+  std::string lines;
+  if (value == "epoch" || (!value.empty() && value[0] == '-')) {
+    if (value != "epoch")
+      parseTime(value.substr(1));
+    lines = "Expires: Thu, 01 Jan 1970 00:00:01 GMT\r\nCache-Control: no-cache\r\n";
+  } else if (value == "max") {
+    lines = "Expires: Thu, 31 Dec 2037 23:55:55 GMT\r\nCache-Control: max-age=315360000\r\n";
+  } else if (value != "off") {
+    std::ostringstream line;
+    line << "Cache-Control: max-age=" << parseTime(value) << "\r\n";
+    lines = line.str();
+  }
+  this->_expiresHeaders = lines;
+  this->_expiresExplicitlySet = true;
+  renderResponseHeaders();
+}
+
+// add_header <name> <value> [always]
+void BaseBlock::addHeader(const std::vector<std::string>& params) {
+  if (params.size() < 2 || params.size() > 3 ||
+      (params.size() == 3 && params[2] != "always") || params[0].empty())
+    throw CommonExceptions::InvalidValue();
+  for (size_t i = 0; i < params[0].size(); ++i) {
+    unsigned char c = params[0][i];
+    if (!isalnum(c) && std::string("!#$%&'*+-.^_`|~").find(c) == std::string::npos)
+      throw CommonExceptions::InvalidValue();
+  }
+  if (params[1].find_first_of("\r\n") != std::string::npos)
+    throw CommonExceptions::InvalidValue();
+  std::string line = params[0] + ": " + params[1] + "\r\n";
+  if (params.size() == 3)
+    this->_addedHeadersAlways += line;
+  else
+    this->_addedHeaders += line;
+  this->_addedHeadersExplicitlySet = true;
+  renderResponseHeaders();
+}
+
+void BaseBlock::renderResponseHeaders() {
+  this->_successHeaders =
+      this->_expiresHeaders + this->_addedHeaders + this->_addedHeadersAlways;
+}
+
+// The pre-rendered lines for a response with this status: everything on
+// success, redirects and 304, as nginx does, only the "always" ones otherwise
+const std::string& BaseBlock::getResponseHeaders(int statusCode) const {
+  return sendsAllHeaders(statusCode) ? this->_successHeaders
+                                     : this->_addedHeadersAlways;
+}
+
+bool BaseBlock::sendsAllHeaders(int statusCode) {
+  switch (statusCode) {
+  case 200: case 201: case 204: case 206: case 301: case 302: case 303:
+  case 304: case 307: case 308:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Tuning directives a location did not set itself come from its server
+void BaseBlock::inheritTuningFromParent(const BaseBlock& parent) {
+  if (!this->_cgiBuffersExplicitlySet) {
+    this->_cgiBufferCount = parent._cgiBufferCount;
+    this->_cgiBufferSize = parent._cgiBufferSize;
+  }
+  if (!this->_cgiCollapsingExplicitlySet) {
+    this->_cgiCollapsing = parent._cgiCollapsing;
+  }
+  if (!this->_cgiCacheExplicitlySet) {
+    this->_cgiCacheSize = parent._cgiCacheSize;
+  }
+  if (this->_cgiCacheKey.empty()) {
+    this->_cgiCacheKey = parent._cgiCacheKey;
+  }
+  if (this->_cgiCacheValid < 0) {
+    this->_cgiCacheValid = parent._cgiCacheValid;
+  }
+  if (!this->_openFileCacheExplicitlySet) {
+    this->_openFileCacheMax = parent._openFileCacheMax;
+    this->_openFileCacheInactive = parent._openFileCacheInactive;
+    this->_openFileCacheValid = parent._openFileCacheValid;
+  }
+  if (!this->_contentCacheExplicitlySet) {
+    this->_contentCacheSize = parent._contentCacheSize;
+    this->_contentCacheMaxFile = parent._contentCacheMaxFile;
+  }
+  if (!this->_mmapExplicitlySet)
+    this->_mmapMaxFile = parent._mmapMaxFile;
+  if (this->_rootPack.empty())
+    this->_rootPack = parent._rootPack;
+  if (!this->_gzipStaticExplicitlySet)
+    this->_gzipStatic = parent._gzipStatic;
+  if (!this->_gzipExplicitlySet)
+    this->_gzip = parent._gzip;
+  if (this->_gzipTypes.empty())
+    this->_gzipTypes = parent._gzipTypes;
+  if (!this->_gzipMinLengthExplicitlySet)
+    this->_gzipMinLength = parent._gzipMinLength;
+  if (this->_gzipCompLevel == 0)
+    this->_gzipCompLevel = parent._gzipCompLevel;
+  if (!this->_expiresExplicitlySet)
+    this->_expiresHeaders = parent._expiresHeaders;
+  // Like nginx, add_header lines are inherited only by a block with none
+  if (!this->_addedHeadersExplicitlySet) {
+    this->_addedHeaders = parent._addedHeaders;
+    this->_addedHeadersAlways = parent._addedHeadersAlways;
+  }
+  renderResponseHeaders();
+}
+
 void BaseBlock::setCgiEnabled(bool enabled) {
   this->_cgiEnabled = enabled;
   this->_cgiExplicitlySet = true;
@@ -112,7 +570,7 @@ void BaseBlock::setCgiPassMapping(const std::string& extension,
   this->_cgiPassMap[extension] = interpreterPath;
 }
 
-std::map<std::string, std::string> BaseBlock::getCgiPassMap() const {
+const std::map<std::string, std::string>& BaseBlock::getCgiPassMap() const {
   return this->_cgiPassMap;
 }
 
@@ -161,6 +619,10 @@ const std::string* BaseBlock::getErrorPage(const u_int16_t code) const {
   return &cIt->second;
 }
 
+const std::map<u_int16_t, std::string>& BaseBlock::getErrorPages() const {
+  return this->_errorPages;
+}
+
 void BaseBlock::activateAutoIndex() {
   this->_autoIndex = true;
 }
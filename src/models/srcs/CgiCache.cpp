@@ -0,0 +1,192 @@
+#include "CgiCache.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include "HttpRequest.hpp"
+#include "HttpUtils.hpp"
+
+CgiCache::CgiCache() : entries(), lru(), refreshing(), limit(0), used(0) {}
+
+CgiCache::~CgiCache() {}
+
+static std::string queryString(const std::map<std::string, std::string> &query)
+{
+    std::string args;
+    for (std::map<std::string, std::string>::const_iterator it = query.begin(); it != query.end(); ++it)
+    {
+        if (!args.empty())
+            args += '&';
+        args += it->first + '=' + it->second;
+    }
+    return args;
+}
+
+// Expands the cgi_cache_key template. Known variables: $host, $uri, $args,
+// $request_uri, $method and $http_<header>; anything else is kept literally.
+bool CgiCache::makeKey(const HttpRequest &request, std::string &key)
+{
+    const RequestContext &ctx = request.getContext();
+    const BaseBlock &block = ctx.getBlock();
+    if (block.getCgiCacheSize() == 0 || !block.isCgiEnabled() || request.getMethod() != "GET")
+        return false;
+
+    const std::map<std::string, std::string> &headers = request.getHeaders();
+    if (headers.count("cookie") || headers.count("authorization"))
+        return false;
+
+    const std::string &tmpl = block.getCgiCacheKey();
+    std::string args = queryString(request.getQuery());
+    key.clear();
+    size_t i = 0;
+    while (i < tmpl.size())
+    {
+        if (tmpl[i] != '$')
+        {
+            key += tmpl[i++];
+            continue;
+        }
+        size_t end = i + 1;
+        while (end < tmpl.size() && (std::isalnum(static_cast<unsigned char>(tmpl[end])) || tmpl[end] == '_'))
+            ++end;
+        std::string name = tmpl.substr(i + 1, end - i - 1);
+        i = end;
+
+        if (name == "host")
+        {
+            std::map<std::string, std::string>::const_iterator host = headers.find("host");
+            key += host != headers.end() ? toLowerStr(host->second) : "";
+        }
+        else if (name == "uri")
+            key += request.getPath();
+        else if (name == "args")
+            key += args;
+        else if (name == "request_uri")
+            key += args.empty() ? request.getPath() : request.getPath() + '?' + args;
+        else if (name == "method")
+            key += request.getMethod();
+        else if (name.compare(0, 5, "http_") == 0)
+        {
+            std::string header = toLowerStr(name.substr(5));
+            for (size_t c = 0; c < header.size(); ++c)
+                if (header[c] == '_')
+                    header[c] = '-';
+            std::map<std::string, std::string>::const_iterator it = headers.find(header);
+            if (it != headers.end())
+                key += it->second;
+        }
+        else
+            key += '$' + name;
+    }
+    return true;
+}
+
+static bool parseMaxAge(const std::string &cacheControl, const char *directive, time_t &ttl)
+{
+    std::string lower = toLowerStr(cacheControl);
+    size_t pos = lower.find(directive);
+    if (pos == std::string::npos)
+        return false;
+    pos += std::strlen(directive);
+    if (pos >= lower.size() || lower[pos] != '=')
+        return false;
+    ttl = std::strtol(lower.c_str() + pos + 1, NULL, 10);
+    return true;
+}
+
+bool CgiCache::freshnessOf(const HttpResponse &res, time_t defaultTtl, time_t now, time_t &ttl)
+{
+    int code = res.getStatusCode();
+    if ((code != 200 && code != 301 && code != 302) || !res.getSetCookieHeaders().empty() ||
+        res.hasBodyFile())
+        return false;
+
+    std::string cacheControl = toLowerStr(res.getHeader("Cache-Control"));
+    if (cacheControl.find("no-store") != std::string::npos ||
+        cacheControl.find("no-cache") != std::string::npos ||
+        cacheControl.find("private") != std::string::npos)
+        return false;
+    if (parseMaxAge(cacheControl, "s-maxage", ttl) || parseMaxAge(cacheControl, "max-age", ttl))
+        return ttl > 0;
+
+    std::string expires = res.getHeader("Expires");
+    if (!expires.empty())
+    {
+        time_t when;
+        if (!parseHttpDate(expires, when))
+            return false; // an invalid date means "already expired"
+        ttl = when - now;
+        return ttl > 0;
+    }
+
+    ttl = defaultTtl;
+    return ttl > 0;
+}
+
+void CgiCache::setLimit(size_t bytes)
+{
+    limit = bytes;
+    while (used > limit && !lru.empty())
+        evict(entries.find(lru.back()));
+}
+
+HttpResponse *CgiCache::lookup(const std::string &key, time_t now, Status &status)
+{
+    std::map<std::string, Entry>::iterator it = entries.find(key);
+    if (it == entries.end())
+    {
+        status = MISS;
+        return NULL;
+    }
+    if (now >= it->second.staleUntil)
+    {
+        evict(it);
+        status = MISS;
+        return NULL;
+    }
+    lru.splice(lru.begin(), lru, it->second.lruPos);
+    status = now < it->second.expires ? HIT : STALE;
+    return &it->second.response;
+}
+
+void CgiCache::store(const std::string &key, const HttpResponse &res, time_t ttl, time_t now)
+{
+    remove(key);
+    size_t size = key.size() + res.buildHead().size() + res.getBodySize();
+    if (size > limit)
+        return;
+    while (used + size > limit && !lru.empty())
+        evict(entries.find(lru.back()));
+
+    lru.push_front(key);
+    Entry &entry = entries[key];
+    entry.response = res;
+    entry.expires = now + ttl;
+    entry.staleUntil = entry.expires + ttl * CGI_CACHE_STALE_TTLS;
+    entry.size = size;
+    entry.lruPos = lru.begin();
+    used += size;
+}
+
+void CgiCache::remove(const std::string &key)
+{
+    std::map<std::string, Entry>::iterator it = entries.find(key);
+    if (it != entries.end())
+        evict(it);
+}
+
+void CgiCache::evict(std::map<std::string, Entry>::iterator entry)
+{
+    used -= entry->second.size;
+    lru.erase(entry->second.lruPos);
+    entries.erase(entry);
+}
+
+bool CgiCache::beginRefresh(const std::string &key)
+{
+    return refreshing.insert(key).second;
+}
+
+void CgiCache::endRefresh(const std::string &key)
+{
+    refreshing.erase(key);
+}
@@ -0,0 +1,125 @@
+#include "CgiCollapser.hpp"
+#include <algorithm>
+#include <sstream>
+#include "HttpRequest.hpp"
+
+// Request headers that take part in the key; anything else a script reads
+// from the environment is assumed not to change its output
+static const char *const COLLAPSE_KEY_HEADERS[] = {
+    "host", "accept", "accept-encoding", "accept-language", NULL};
+
+CgiCollapser::CgiCollapser() : owners(), keys(), waiters(), waitingOn() {}
+
+CgiCollapser::~CgiCollapser() {}
+
+bool CgiCollapser::makeKey(const HttpRequest &request, std::string &key)
+{
+    const RequestContext &ctx = request.getContext();
+    if (!ctx.isCgiCollapsingEnabled())
+        return false;
+
+    const std::string &method = request.getMethod();
+    if (method != "GET" && method != "HEAD")
+        return false;
+
+    const std::map<std::string, std::string> &headers = request.getHeaders();
+    if (request.isChunked() || request.contentLength() > 0 || !request.getBody().empty() ||
+        headers.count("cookie") || headers.count("authorization"))
+        return false;
+
+    std::ostringstream out;
+    out << static_cast<const void *>(&ctx.server) << ' ' << method << ' ' << request.getPath() << '?';
+    const std::map<std::string, std::string> &query = request.getQuery();
+    for (std::map<std::string, std::string>::const_iterator it = query.begin(); it != query.end(); ++it)
+        out << it->first << '=' << it->second << '&';
+    for (size_t i = 0; COLLAPSE_KEY_HEADERS[i]; ++i)
+    {
+        std::map<std::string, std::string>::const_iterator it = headers.find(COLLAPSE_KEY_HEADERS[i]);
+        out << '\n' << (it != headers.end() ? it->second : "");
+    }
+    key = out.str();
+    return true;
+}
+
+int CgiCollapser::findOwner(const std::string &key) const
+{
+    std::map<std::string, int>::const_iterator it = owners.find(key);
+    return it == owners.end() ? -1 : it->second;
+}
+
+void CgiCollapser::addOwner(int ownerFd, const std::string &key)
+{
+    owners[key] = ownerFd;
+    keys[ownerFd] = key;
+}
+
+void CgiCollapser::addWaiter(int ownerFd, int waiterFd)
+{
+    waiters[ownerFd].push_back(waiterFd);
+    waitingOn[waiterFd] = ownerFd;
+}
+
+bool CgiCollapser::isWaiting(int fd) const
+{
+    return waitingOn.find(fd) != waitingOn.end();
+}
+
+bool CgiCollapser::hasWaiters(int ownerFd) const
+{
+    return waiters.find(ownerFd) != waiters.end();
+}
+
+void CgiCollapser::removeWaiter(int fd)
+{
+    std::map<int, int>::iterator it = waitingOn.find(fd);
+    if (it == waitingOn.end())
+        return;
+    std::vector<int> &queue = waiters[it->second];
+    queue.erase(std::remove(queue.begin(), queue.end(), fd), queue.end());
+    if (queue.empty())
+        waiters.erase(it->second);
+    waitingOn.erase(it);
+}
+
+int CgiCollapser::promote(int ownerFd)
+{
+    std::map<int, std::vector<int> >::iterator queue = waiters.find(ownerFd);
+    std::map<int, std::string>::iterator key = keys.find(ownerFd);
+    if (queue == waiters.end() || key == keys.end())
+    {
+        complete(ownerFd);
+        return -1;
+    }
+
+    std::vector<int> rest(queue->second.begin() + 1, queue->second.end());
+    int next = queue->second.front();
+    std::string ownedKey = key->second;
+    waiters.erase(queue);
+    keys.erase(key);
+    waitingOn.erase(next);
+
+    addOwner(next, ownedKey);
+    for (size_t i = 0; i < rest.size(); ++i)
+        addWaiter(next, rest[i]);
+    return next;
+}
+
+std::vector<int> CgiCollapser::complete(int ownerFd)
+{
+    std::vector<int> done;
+    std::map<int, std::string>::iterator key = keys.find(ownerFd);
+    if (key == keys.end())
+        return done;
+    owners.erase(key->second);
+    keys.erase(key);
+
+    std::map<int, std::vector<int> >::iterator queue = waiters.find(ownerFd);
+    if (queue != waiters.end())
+    {
+        done.swap(queue->second);
+        waiters.erase(queue);
+    }
+    for (size_t i = 0; i < done.size(); ++i)
+        waitingOn.erase(done[i]);
+    return done;
+}
@@ -1,7 +1,8 @@
 #include "CgiHandle.hpp"
+#include "CgiJob.hpp"
 #include "HttpResponse.hpp"
-#include <fcntl.h>
-#include <sys/epoll.h>
+#include "HttpUtils.hpp"
+#include <csignal>
 
 const char *CgiHandle::CgiExecutionException::what() const throw()
 {
@@ -146,320 +147,196 @@ void CgiHandle::buildCgiEnvironment(
     }
 }
 
-std::string CgiHandle::readCgiResponse(const std::string &inputData, int stdinPipe, int stdoutPipe, int epollFd, pid_t childPid)
+void CgiHandle::getDirectoryFromPath(const std::string &path, std::string &directoryPath)
 {
-    int flags = fcntl(stdinPipe, F_GETFL, 0);
-    fcntl(stdinPipe, F_SETFL, flags | O_NONBLOCK);
-    flags = fcntl(stdoutPipe, F_GETFL, 0);
-    fcntl(stdoutPipe, F_SETFL, flags | O_NONBLOCK);
-
-    struct epoll_event event;
-
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = stdoutPipe;
-    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, stdoutPipe, &event) == -1)
-    {
-        close(stdinPipe);
-        close(stdoutPipe);
-        throw CgiExecutionException();
-    }
-
-    bool needToWrite = !inputData.empty();
-    size_t bytesWritten = 0;
-    if (needToWrite)
+    size_t pos = path.find_last_of('/');
+    if (pos != std::string::npos)
     {
-        event.events = EPOLLOUT | EPOLLET;
-        event.data.fd = stdinPipe;
-        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, stdinPipe, &event) == -1)
-        {
-            epoll_ctl(epollFd, EPOLL_CTL_DEL, stdoutPipe, NULL);
-            close(stdinPipe);
-            close(stdoutPipe);
-            throw CgiExecutionException();
-        }
+        directoryPath = path.substr(0, pos);
     }
     else
     {
-        close(stdinPipe);
-    }
-
-    std::string output;
-    char buffer[4096];
-    time_t startTime = time(NULL);
-    int timeout = 5; // 5 second timeout
-    bool stdoutClosed = false;
-
-    struct epoll_event events[2];
-
-    while (!stdoutClosed)
-    {
-        // Check for timeout
-        if (time(NULL) - startTime > timeout)
-        {
-            if (needToWrite)
-            {
-                epoll_ctl(epollFd, EPOLL_CTL_DEL, stdinPipe, NULL);
-                close(stdinPipe);
-            }
-            epoll_ctl(epollFd, EPOLL_CTL_DEL, stdoutPipe, NULL);
-            close(stdoutPipe);
-            kill(childPid, SIGKILL);
-            waitpid(childPid, NULL, 0);
-            throw CgiTimeoutException();
-        }
-
-        int nfds = epoll_wait(epollFd, events, 2, 100);
-
-        if (nfds == -1)
-        {
-            if (needToWrite)
-            {
-                epoll_ctl(epollFd, EPOLL_CTL_DEL, stdinPipe, NULL);
-                close(stdinPipe);
-            }
-            epoll_ctl(epollFd, EPOLL_CTL_DEL, stdoutPipe, NULL);
-            close(stdoutPipe);
-            throw CgiExecutionException();
-        }
-
-        for (int i = 0; i < nfds; i++)
-        {
-            if (events[i].data.fd == stdinPipe && (events[i].events & EPOLLOUT))
-            {
-                ssize_t written = write(stdinPipe, inputData.c_str() + bytesWritten,
-                                        inputData.length() - bytesWritten);
-                if (written > 0)
-                {
-                    bytesWritten += written;
-                    if (bytesWritten >= inputData.length())
-                    {
-                        epoll_ctl(epollFd, EPOLL_CTL_DEL, stdinPipe, NULL);
-                        close(stdinPipe);
-                        needToWrite = false;
-                    }
-                }
-                else if (written == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
-                {
-                    epoll_ctl(epollFd, EPOLL_CTL_DEL, stdinPipe, NULL);
-                    close(stdinPipe);
-                    epoll_ctl(epollFd, EPOLL_CTL_DEL, stdoutPipe, NULL);
-                    close(stdoutPipe);
-                    throw CgiExecutionException();
-                }
-            }
-
-            if (events[i].data.fd == stdoutPipe && (events[i].events & EPOLLIN))
-            {
-                while (true)
-                {
-                    ssize_t bytesRead = read(stdoutPipe, buffer, sizeof(buffer));
-                    if (bytesRead > 0)
-                    {
-                        output.append(buffer, bytesRead);
-                    }
-                    else if (bytesRead == 0)
-                    {
-                        epoll_ctl(epollFd, EPOLL_CTL_DEL, stdoutPipe, NULL);
-                        close(stdoutPipe);
-                        stdoutClosed = true;
-                        break;
-                    }
-                    else if (bytesRead == -1)
-                    {
-                        if (errno == EAGAIN || errno == EWOULDBLOCK)
-                        {
-                            break;
-                        }
-                        else
-                        {
-                            epoll_ctl(epollFd, EPOLL_CTL_DEL, stdoutPipe, NULL);
-                            close(stdoutPipe);
-                            if (needToWrite)
-                            {
-                                epoll_ctl(epollFd, EPOLL_CTL_DEL, stdinPipe, NULL);
-                                close(stdinPipe);
-                            }
-                            throw CgiExecutionException();
-                        }
-                    }
-                }
-            }
-
-            if (events[i].events & (EPOLLERR | EPOLLHUP))
-            {
-                if (events[i].data.fd == stdoutPipe)
-                {
-                    epoll_ctl(epollFd, EPOLL_CTL_DEL, stdoutPipe, NULL);
-                    close(stdoutPipe);
-                    stdoutClosed = true;
-                }
-                if (events[i].data.fd == stdinPipe && needToWrite)
-                {
-                    epoll_ctl(epollFd, EPOLL_CTL_DEL, stdinPipe, NULL);
-                    close(stdinPipe);
-                    needToWrite = false;
-                }
-            }
-        }
-    }
-
-    if (needToWrite)
-    {
-        epoll_ctl(epollFd, EPOLL_CTL_DEL, stdinPipe, NULL);
-        close(stdinPipe);
+        directoryPath = ".";
     }
-
-    return output;
 }
 
-void CgiHandle::getInterpreterForScript(const std::map<std::string, std::string> &cgiPassMap, const std::string &scriptPath, std::string &interpreterPath)
+// Locates the blank line that ends the CGI header block (CRLF or bare LF line
+// endings). bodyStart receives the offset of the first body byte.
+static size_t findCgiHeaderEnd(const std::string &output, size_t &bodyStart)
 {
-    size_t dotPos = scriptPath.find_last_of('.');
-    if (dotPos != std::string::npos)
+    size_t lineStart = 0;
+    while (lineStart < output.size())
     {
-        std::string extension = scriptPath.substr(dotPos);
-        std::map<std::string, std::string>::const_iterator it = cgiPassMap.find(extension);
-        if (it != cgiPassMap.end())
+        size_t newline = output.find('\n', lineStart);
+        if (newline == std::string::npos)
+            return std::string::npos;
+        size_t lineEnd = newline;
+        if (lineEnd > lineStart && output[lineEnd - 1] == '\r')
+            --lineEnd;
+        if (lineEnd == lineStart)
         {
-            interpreterPath = it->second;
-            return;
+            bodyStart = newline + 1;
+            return lineStart;
         }
+        lineStart = newline + 1;
     }
-    interpreterPath = "";
+    return std::string::npos;
 }
 
-void CgiHandle::getDirectoryFromPath(const std::string &path, std::string &directoryPath)
+static bool headerNameIs(const std::string &name, const char *expected)
 {
-    size_t pos = path.find_last_of('/');
-    if (pos != std::string::npos)
+    size_t length = std::strlen(expected);
+    if (name.size() != length)
+        return false;
+    for (size_t i = 0; i < length; ++i)
     {
-        directoryPath = path.substr(0, pos);
-    }
-    else
-    {
-        directoryPath = ".";
+        if (std::tolower(static_cast<unsigned char>(name[i])) != expected[i])
+            return false;
     }
+    return true;
 }
 
-void CgiHandle::parseCgiResponse(const std::string &cgiOutput, HttpResponse &res)
+// Parses a CGI response per RFC 3875 section 6. The header block is scanned
+// once; the body is never copied: cgiOutput's storage is handed to res and
+// only the body range is exposed. A Location header with a local path and no
+// body is a local redirect, reported through localRedirect for the caller to
+// re-dispatch. Output that did not fit the CGI buffers continues in spill;
+// the header block must fit in memory, the body may run on into the file.
+void CgiHandle::parseCgiResponse(std::string &cgiOutput, HttpResponse &res, std::string &localRedirect,
+                                 const SharedPtr<FileGuard> &spill, size_t spilled)
 {
+    localRedirect.clear();
     if (cgiOutput.empty())
     {
         throw CgiInvalidResponseException();
     }
 
-    std::istringstream responseStream(cgiOutput);
-    std::string line;
-
-    std::getline(responseStream, line);
-
-    if (!line.empty() && line[line.length() - 1] == '\r')
-        line = line.substr(0, line.length() - 1);
-
-    if (line.find("HTTP/") == 0)
+    size_t bodyStart = 0;
+    size_t headerEnd = findCgiHeaderEnd(cgiOutput, bodyStart);
+    if (headerEnd == std::string::npos)
     {
-        std::istringstream statusLineStream(line);
-        std::string httpVersion;
-        int statusCode;
-        std::string statusMessage;
-        statusLineStream >> httpVersion >> statusCode;
-        std::getline(statusLineStream, statusMessage);
-        res.setStatus(statusCode, statusMessage);
+        throw CgiInvalidResponseException();
     }
-    else
+
+    int statusCode = 0;
+    std::string statusMessage;
+    std::string location;
+    bool hasContentLength = false;
+    size_t contentLength = 0;
+
+    res.setStatus(200, "OK");
+    size_t lineStart = 0;
+    while (lineStart < headerEnd)
     {
-        res.setStatus(200, "OK");
-        if (!line.empty())
+        size_t newline = cgiOutput.find('\n', lineStart);
+        size_t lineEnd = newline;
+        if (lineEnd > lineStart && cgiOutput[lineEnd - 1] == '\r')
+            --lineEnd;
+        std::string line = cgiOutput.substr(lineStart, lineEnd - lineStart);
+        lineStart = newline + 1;
+
+        // Non-parsed-header scripts send a full status line first
+        if (statusCode == 0 && line.compare(0, 5, "HTTP/") == 0)
         {
-            size_t colonPos = line.find(':');
-            if (colonPos != std::string::npos)
-            {
-                std::string headerName = line.substr(0, colonPos);
-                std::string headerValue = line.substr(colonPos + 1);
-
-                size_t start = headerValue.find_first_not_of(" \t\r\n");
-                if (start != std::string::npos)
-                {
-                    headerValue = headerValue.substr(start);
-                }
-                size_t end = headerValue.find_last_not_of(" \t\r\n");
-                if (end != std::string::npos)
-                {
-                    headerValue = headerValue.substr(0, end + 1);
-                }
-
-                if (headerName == "Set-Cookie")
-                {
-                    res.addSetCookieHeader(headerValue);
-                }
-                else
-                {
-                    res.setHeader(headerName, headerValue);
-                }
-            }
+            std::istringstream statusLineStream(line);
+            std::string httpVersion;
+            statusLineStream >> httpVersion >> statusCode;
+            if (statusLineStream.fail() || statusCode < 100 || statusCode > 599)
+                throw CgiInvalidResponseException();
+            std::getline(statusLineStream, statusMessage);
+            statusMessage = trim(statusMessage);
+            continue;
         }
-    }
-
-    while (std::getline(responseStream, line))
-    {
-        if (!line.empty() && line[line.length() - 1] == '\r')
-            line = line.substr(0, line.length() - 1);
-
-        if (line.empty())
-            break;
 
         size_t colonPos = line.find(':');
-        if (colonPos != std::string::npos)
+        if (colonPos == std::string::npos || colonPos == 0)
+        {
+            throw CgiInvalidResponseException();
+        }
+        std::string headerName = line.substr(0, colonPos);
+        std::string headerValue = trim(line.substr(colonPos + 1));
+
+        if (headerNameIs(headerName, "status"))
+        {
+            std::istringstream statusStream(headerValue);
+            statusStream >> statusCode;
+            if (statusStream.fail() || statusCode < 100 || statusCode > 599)
+                throw CgiInvalidResponseException();
+            std::getline(statusStream, statusMessage);
+            statusMessage = trim(statusMessage);
+        }
+        else if (headerNameIs(headerName, "content-length"))
         {
-            std::string headerName = line.substr(0, colonPos);
-            std::string headerValue = line.substr(colonPos + 1);
-
-            size_t start = headerValue.find_first_not_of(" \t\r\n");
-            if (start != std::string::npos)
-            {
-                headerValue = headerValue.substr(start);
-            }
-            size_t end = headerValue.find_last_not_of(" \t\r\n");
-            if (end != std::string::npos)
-            {
-                headerValue = headerValue.substr(0, end + 1);
-            }
-
-            if (headerName == "Set-Cookie")
-            {
-                res.addSetCookieHeader(headerValue);
-            }
-            else
-            {
-                res.setHeader(headerName, headerValue);
-            }
+            if (headerValue.empty() || headerValue.find_first_not_of("0123456789") != std::string::npos)
+                throw CgiInvalidResponseException();
+            hasContentLength = true;
+            contentLength = safeAtoi(headerValue);
+        }
+        else if (headerNameIs(headerName, "location"))
+        {
+            location = headerValue;
+            res.setHeader("Location", headerValue);
+        }
+        else if (headerNameIs(headerName, "set-cookie"))
+        {
+            res.addSetCookieHeader(headerValue);
+        }
+        else
+        {
+            res.setHeader(headerName, headerValue);
         }
     }
 
-    std::string body;
-    while (std::getline(responseStream, line))
+    size_t bodyLength = cgiOutput.size() - bodyStart + spilled;
+    if (hasContentLength)
     {
-        body += line + "\n";
+        // A script may not promise more than it wrote
+        if (contentLength > bodyLength)
+            throw CgiInvalidResponseException();
+        bodyLength = contentLength;
     }
-    res.setBody(body);
-}
 
-void CgiHandle::sendCgiOutputToClient(const std::string &cgiOutput, HttpResponse &res)
-{
-    parseCgiResponse(cgiOutput, res);
-    res.build();
+    if (!location.empty() && location[0] == '/' && statusCode == 0 && bodyLength == 0)
+    {
+        localRedirect = location;
+        return;
+    }
+    if (!location.empty() && statusCode == 0)
+        statusCode = 302; // client redirect response
+
+    if (statusCode != 0)
+    {
+        if (statusMessage.empty())
+            statusMessage = HttpResponse::reasonPhrase(statusCode);
+        res.setStatus(statusCode, statusMessage);
+    }
+
+    res.setHeader("Content-Length", itoa_custom(bodyLength));
+    size_t inMemory = cgiOutput.size() - bodyStart;
+    if (inMemory > bodyLength)
+        inMemory = bodyLength;
+    res.setBodySlice(cgiOutput, bodyStart, inMemory);
+    if (bodyLength > inMemory)
+        res.setBodyFile(spill, 0, bodyLength - inMemory);
 }
 
-std::string CgiHandle::executeCgiScript(const std::string &scriptPath, const std::map<std::string, std::string> &envVars, const std::string &inputData,
-                                        const std::map<std::string, std::string> &cgiPassMap, int epollFd)
+// interpreterPath: the cgi_pass for the script's extension, "" to run the
+// script itself
+CgiJob *CgiHandle::executeCgiScript(const std::string &scriptPath, const std::map<std::string, std::string> &envVars,
+                                    const std::string &interpreterPath, const RequestContext &ctx, int epollFd)
 {
 
     int stdinPipe[2];
     int stdoutPipe[2];
-    std::string interpreterPath;
 
-    if (pipe(stdinPipe) == -1 || pipe(stdoutPipe) == -1)
+    if (pipe(stdinPipe) == -1)
+    {
+        throw CgiExecutionException();
+    }
+    if (pipe(stdoutPipe) == -1)
     {
+        close(stdinPipe[0]);
+        close(stdinPipe[1]);
         throw CgiExecutionException();
     }
 
@@ -489,6 +366,12 @@ std::string CgiHandle::executeCgiScript(const std::string &scriptPath, const std
             close(fd);
         }
 
+        // The server reads its signals from a signalfd with them blocked;
+        // the script gets the default mask back
+        sigset_t noSignals;
+        sigemptyset(&noSignals);
+        sigprocmask(SIG_SETMASK, &noSignals, NULL);
+
         std::string scriptDir;
         getDirectoryFromPath(scriptPath, scriptDir);
         if (chdir(scriptDir.c_str()) == -1)
@@ -505,7 +388,6 @@ std::string CgiHandle::executeCgiScript(const std::string &scriptPath, const std
         }
 
         char **envp = convertMapToCharArray(envVars);
-        getInterpreterForScript(cgiPassMap, scriptPath, interpreterPath);
         if (!interpreterPath.empty())
         {
             char *argv[3];
@@ -529,20 +411,14 @@ std::string CgiHandle::executeCgiScript(const std::string &scriptPath, const std
         close(stdinPipe[0]);
         close(stdoutPipe[1]);
 
-        std::string cgiOutput = readCgiResponse(inputData, stdinPipe[1], stdoutPipe[0], epollFd, pid);
-
-        int status;
-        pid_t result = waitpid(pid, &status, 0);
-
-        if (result == -1)
+        // The child keeps running; its output is collected by the event loop
+        CgiJob *job = new CgiJob(ctx, pid, stdinPipe[1], stdoutPipe[0], epollFd);
+        if (!job->watchOutput())
         {
+            delete job;
             throw CgiExecutionException();
         }
-        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
-        {
-            throw CgiExecutionException();
-        }
-        return cgiOutput;
+        return job;
     }
 }
 
@@ -557,30 +433,13 @@ void CgiHandle::buildCgiScript(const std::string &scriptPath, const RequestConte
 
     std::cerr << "[DEBUG CGI] scriptPath=" << scriptPath << std::endl;
     std::cerr << "[DEBUG CGI] location=" << (ctx.location ? "valid" : "NULL") << std::endl;
-    if (ctx.location)
-    {
-        std::map<std::string, std::string> cgiMap = ctx.location->getCgiPassMap();
-        std::cerr << "[DEBUG CGI] cgiPassMap size=" << cgiMap.size() << std::endl;
-        for (std::map<std::string, std::string>::iterator it = cgiMap.begin(); it != cgiMap.end(); ++it)
-        {
-            std::cerr << "[DEBUG CGI]   " << it->first << " -> " << it->second << std::endl;
-        }
-    }
+    const std::string *interpreter = ctx.getCgiInterpreter(scriptPath);
+    std::cerr << "[DEBUG CGI] interpreter=" << (interpreter ? *interpreter : "<none>") << std::endl;
 
     try
     {
-        std::string cgiOutput = executeCgiScript(scriptPath, envVars, request.getBody(), ctx.location->getCgiPassMap(), epollFd);
-        sendCgiOutputToClient(cgiOutput, res);
-    }
-    catch (const CgiTimeoutException &e)
-    {
-        std::cerr << "CGI Timeout: " << e.what() << '\n';
-        res.setErrorFromContext(504, ctx); // Gateway Timeout
-    }
-    catch (const CgiInvalidResponseException &e)
-    {
-        std::cerr << "Invalid CGI Response: " << e.what() << '\n';
-        res.setErrorFromContext(502, ctx); // Bad Gateway
+        // The response is completed by SocketManager once the job finishes
+        request.setCgiJob(executeCgiScript(scriptPath, envVars, interpreter ? *interpreter : "", ctx, epollFd));
     }
     catch (const CgiExecutionException &e)
     {
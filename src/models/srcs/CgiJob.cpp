@@ -0,0 +1,374 @@
+#include "CgiJob.hpp"
+#include "CgiHandle.hpp"
+#include "HttpResponse.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Upper bound for a single splice() call; the pipe itself caps what moves.
+#define CGI_SPLICE_CHUNK 65536
+
+CgiJob::CgiJob(const RequestContext &ctx, pid_t pid, int stdinFd, int stdoutFd, int epollFd)
+    : config(),
+      ctx(ctx),
+      pid(pid),
+      stdinFd(stdinFd),
+      stdoutFd(stdoutFd),
+      epollFd(epollFd),
+      clientFd(-1),
+      stdinArmed(false),
+      input(),
+      inputOffset(0),
+      socketBodyRemaining(0),
+      output(),
+      outputLimit(ctx.getCgiBufferLimit()),
+      spill(),
+      spilled(0),
+      startTime(time(NULL)),
+      failed(false),
+      timedOut(false)
+{
+}
+
+CgiJob::~CgiJob()
+{
+    if (pid != -1 || stdinFd != -1 || stdoutFd != -1)
+        abort(false);
+}
+
+bool CgiJob::watchOutput()
+{
+    int flags = fcntl(stdinFd, F_GETFL, 0);
+    fcntl(stdinFd, F_SETFL, flags | O_NONBLOCK);
+    flags = fcntl(stdoutFd, F_GETFL, 0);
+    fcntl(stdoutFd, F_SETFL, flags | O_NONBLOCK);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = stdoutFd;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, stdoutFd, &event) == 0;
+}
+
+// Hands the request body to the child. Whatever arrived together with the
+// headers is written from memory; the rest is moved straight from the client
+// socket into the stdin pipe with splice(), so it never touches user space.
+void CgiJob::startInput(int clientFd, const std::string &bufferedBody, size_t socketBody)
+{
+    this->clientFd = clientFd;
+    input = bufferedBody;
+    inputOffset = 0;
+    socketBodyRemaining = socketBody;
+
+    if (input.empty() && socketBodyRemaining == 0)
+    {
+        closeStdin();
+        return;
+    }
+    armStdin(true);
+}
+
+void CgiJob::armStdin(bool enable)
+{
+    if (stdinFd == -1 || enable == stdinArmed)
+        return;
+    if (enable)
+    {
+        struct epoll_event event;
+        event.events = EPOLLOUT;
+        event.data.fd = stdinFd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, stdinFd, &event) == -1)
+            return;
+    }
+    else
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, stdinFd, NULL);
+    stdinArmed = enable;
+}
+
+void CgiJob::closeStdin()
+{
+    if (stdinFd == -1)
+        return;
+    armStdin(false);
+    close(stdinFd);
+    stdinFd = -1;
+    socketBodyRemaining = 0;
+    std::string().swap(input);
+    inputOffset = 0;
+}
+
+void CgiJob::closeStdout()
+{
+    if (stdoutFd == -1)
+        return;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, stdoutFd, NULL);
+    close(stdoutFd);
+    stdoutFd = -1;
+}
+
+// A script may close stdout and keep running, so without force the wait
+// never blocks: the child stays unreaped, and the job unfinished, until a
+// later SIGCHLD or the timeout kills it.
+void CgiJob::reapChild(bool force)
+{
+    if (pid == -1)
+        return;
+    if (force)
+        kill(pid, SIGKILL);
+
+    int status = 0;
+    pid_t reaped = waitpid(pid, &status, force ? 0 : WNOHANG);
+    if (reaped == 0)
+        return;
+    if (reaped == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        failed = true;
+    pid = -1;
+}
+
+// Returns false once the body can no longer be delivered.
+bool CgiJob::spliceFromSocket()
+{
+    while (socketBodyRemaining > 0)
+    {
+        size_t chunk = socketBodyRemaining < CGI_SPLICE_CHUNK ? socketBodyRemaining : CGI_SPLICE_CHUNK;
+        ssize_t moved = splice(clientFd, NULL, stdinFd, NULL, chunk,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved > 0)
+        {
+            socketBodyRemaining -= moved;
+            continue;
+        }
+        if (moved == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // Either the socket is drained or the pipe is full. Only in the
+            // latter case is stdin worth waiting on; otherwise the next
+            // EPOLLIN on the client resumes the transfer.
+            int pending = 0;
+            armStdin(ioctl(clientFd, FIONREAD, &pending) == 0 && pending > 0);
+            return true;
+        }
+        // Client closed early or the script stopped reading stdin
+        closeStdin();
+        return false;
+    }
+    closeStdin();
+    return true;
+}
+
+void CgiJob::onStdinWritable()
+{
+    if (stdinFd == -1)
+        return;
+
+    if (inputOffset < input.size())
+    {
+        ssize_t written = write(stdinFd, input.data() + inputOffset, input.size() - inputOffset);
+        if (written == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                closeStdin();
+            return;
+        }
+        inputOffset += written;
+        if (inputOffset < input.size())
+            return;
+        std::string().swap(input);
+        inputOffset = 0;
+    }
+
+    if (socketBodyRemaining > 0)
+        spliceFromSocket();
+    else
+        closeStdin();
+}
+
+void CgiJob::onSocketReadable()
+{
+    // Buffered bytes go first so the body reaches the script in order
+    if (stdinFd == -1 || inputOffset < input.size())
+        return;
+    spliceFromSocket();
+}
+
+void CgiJob::onStdoutReadable()
+{
+    char buffer[65536];
+
+    while (stdoutFd != -1)
+    {
+        ssize_t bytesRead = read(stdoutFd, buffer, sizeof(buffer));
+        if (bytesRead > 0)
+        {
+            storeOutput(buffer, bytesRead);
+        }
+        else if (bytesRead == 0)
+        {
+            closeStdout();
+            closeStdin();
+            reapChild(false);
+        }
+        else
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            failed = true;
+            closeStdout();
+            closeStdin();
+            reapChild(true);
+        }
+    }
+}
+
+void CgiJob::storeOutput(const char *data, size_t length)
+{
+    if (!spill.isValid() && output.size() < outputLimit)
+    {
+        size_t inMemory = outputLimit - output.size();
+        if (inMemory > length)
+            inMemory = length;
+        output.append(data, inMemory);
+        data += inMemory;
+        length -= inMemory;
+    }
+    if (length > 0 && !spillOutput(data, length))
+    {
+        std::cerr << "CGI temp file error: " << strerror(errno) << std::endl;
+        failed = true;
+        closeStdout();
+        closeStdin();
+        reapChild(true);
+    }
+}
+
+// Appends to the temp file, creating it on first use. The file is unlinked
+// right away so nothing is left behind if the process dies.
+bool CgiJob::spillOutput(const char *data, size_t length)
+{
+    if (!spill.isValid())
+    {
+        char path[] = CGI_TEMP_PATH;
+        int fd = mkstemp(path);
+        if (fd == -1)
+            return false;
+        unlink(path);
+        spill.reset(new FileGuard(fd));
+    }
+    while (length > 0)
+    {
+        ssize_t written = write(spill->get(), data, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        length -= written;
+        spilled += written;
+    }
+    return true;
+}
+
+void CgiJob::onPipeHangup(int fd)
+{
+    if (fd == stdoutFd)
+        onStdoutReadable();
+    else if (fd == stdinFd)
+        closeStdin();
+}
+
+void CgiJob::onChildExit()
+{
+    if (stdoutFd == -1)
+        reapChild(false);
+}
+
+void CgiJob::abort(bool timeout)
+{
+    timedOut = timeout;
+    failed = true;
+    closeStdin();
+    closeStdout();
+    reapChild(true);
+    std::string().swap(output);
+    spill.reset();
+    spilled = 0;
+}
+
+int CgiJob::getStdinFd() const
+{
+    return stdinFd;
+}
+
+int CgiJob::getStdoutFd() const
+{
+    return stdoutFd;
+}
+
+bool CgiJob::wantsSocketBody() const
+{
+    return stdinFd != -1 && socketBodyRemaining > 0;
+}
+
+bool CgiJob::isFinished() const
+{
+    return stdoutFd == -1 && pid == -1;
+}
+
+bool CgiJob::hasTimedOut(time_t now) const
+{
+    return !isFinished() && now - startTime > TIMEOUT;
+}
+
+const RequestContext &CgiJob::getContext() const
+{
+    return ctx;
+}
+
+void CgiJob::holdConfig(const SharedPtr<ConfigSnapshot> &snapshot)
+{
+    config = snapshot;
+}
+
+const SharedPtr<ConfigSnapshot> &CgiJob::getConfig() const
+{
+    return config;
+}
+
+void CgiJob::buildResponse(HttpResponse &res, std::string &localRedirect)
+{
+    localRedirect.clear();
+    if (timedOut)
+    {
+        std::cerr << "CGI Timeout: " << CgiHandle::CgiTimeoutException().what() << '\n';
+        res.setErrorFromContext(504, ctx); // Gateway Timeout
+        return;
+    }
+    if (failed)
+    {
+        std::cerr << "CGI Execution Error: " << CgiHandle::CgiExecutionException().what() << '\n';
+        res.setErrorFromContext(500, ctx); // Internal Server Error
+        return;
+    }
+
+    try
+    {
+        CgiHandle cgiHandler;
+        cgiHandler.parseCgiResponse(output, res, localRedirect, spill, spilled);
+    }
+    catch (const CgiHandle::CgiInvalidResponseException &e)
+    {
+        std::cerr << "Invalid CGI Response: " << e.what() << '\n';
+        res.setErrorFromContext(502, ctx); // Bad Gateway
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Unknown error: " << e.what() << '\n';
+        res.setErrorFromContext(500, ctx);
+    }
+}
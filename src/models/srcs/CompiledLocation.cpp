@@ -0,0 +1,170 @@
+#include "CompiledLocation.hpp"
+#include <fstream>
+#include <iostream>
+#include "HttpResponse.hpp"
+#include "LocationConfig.hpp"
+#include "Server.hpp"
+
+// Reads an error page once per path; NULL (and a warning) if it can't be read
+static SharedPtr<std::string> loadPage(const std::string &path, std::map<std::string, SharedPtr<std::string> > &pages)
+{
+    std::map<std::string, SharedPtr<std::string> >::iterator cached = pages.find(path);
+    if (cached != pages.end())
+        return cached->second;
+
+    SharedPtr<std::string> page;
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (file.is_open())
+    {
+        page.reset(new std::string());
+        char buffer[4096];
+        while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+            page->append(buffer, file.gcount());
+        if (file.bad())
+            page.reset();
+    }
+    if (!page.isValid())
+        std::cerr << "Warning: error page " << path << " can't be read, the built-in one is used" << std::endl;
+    pages[path] = page;
+    return page;
+}
+
+CompiledLocation::CompiledLocation(const Server &server, const LocationConfig *location,
+                                   std::map<std::string, SharedPtr<std::string> > &pages)
+    : methods(0), autoIndex(false), cgiEnabled(false), cgiCollapsing(false), gzip(false), gzipStatic(false),
+      gzipCompLevel(0), gzipMinLength(0), mmapMaxFile(0), redirectCode(0), clientMaxBodySize(0),
+      cgiBufferLimit(0), root(server.getRoot()),
+      rootPrefix(), uploadDir(server.getRoot()), indexFiles(server.getIndexFiles()), cgiPass(), redirectHead(),
+      redirectBody(), errorPages(), gzipTypes(), rootPack(), successHeaders(), alwaysHeaders()
+{
+    const BaseBlock *block = location ? static_cast<const BaseBlock *>(location) : &server;
+
+    // Only use location's root if it's explicitly set (not the default)
+    if (location && !location->getRoot().empty() && location->getRoot() != DEFAULT_ROOT_PATH)
+        root = location->getRoot();
+    rootPrefix = root;
+    if (!rootPrefix.empty() && rootPrefix[rootPrefix.size() - 1] != '/')
+        rootPrefix += '/';
+
+    if (location)
+    {
+        const std::vector<std::string> &listed = location->getMethods();
+        for (size_t i = 0; i < listed.size(); ++i)
+            methods |= methodBit(listed[i]);
+        if (!location->getIndexFiles().empty())
+            indexFiles = location->getIndexFiles();
+        if (!location->getUploadDir().empty())
+            uploadDir = location->getUploadDir();
+        cgiEnabled = location->isCgiEnabled();
+    }
+    else
+    {
+        methods = METHOD_GET | METHOD_HEAD | METHOD_POST | METHOD_PUT | METHOD_DELETE | METHOD_PATCH;
+        cgiEnabled = server.isCgiEnabled();
+    }
+    autoIndex = block->getAutoIndex();
+    cgiCollapsing = block->isCgiCollapsingEnabled();
+    clientMaxBodySize = block->getClientMaxBodySize();
+    cgiBufferLimit = block->getCgiBufferLimit();
+    gzip = block->isGzipEnabled();
+    gzipStatic = block->isGzipStaticEnabled();
+    gzipCompLevel = block->getGzipCompLevel();
+    gzipMinLength = block->getGzipMinLength();
+    gzipTypes = block->getGzipTypes();
+    mmapMaxFile = block->getMmapMaxFile();
+    rootPack = block->getRootPack();
+    successHeaders = block->getResponseHeaders(200);
+    alwaysHeaders = block->getResponseHeaders(500);
+
+    const std::map<std::string, std::string> &cgiPassMap = block->getCgiPassMap();
+    for (std::map<std::string, std::string>::const_iterator it = cgiPassMap.begin(); it != cgiPassMap.end(); ++it)
+        cgiPass.insert(it->first, it->second);
+
+    const BaseBlock &returning = location && location->hasReturn() ? static_cast<const BaseBlock &>(*location) : server;
+    if (returning.hasReturn())
+    {
+        const std::pair<u_int16_t, std::string> &returnData = returning.getReturnData();
+        HttpResponse res;
+        res.setVersion("HTTP/1.0");
+        res.setRedirect(returnData.first, returnData.second);
+        res.setRenderedHeaders(block->getResponseHeaders(returnData.first));
+        redirectCode = returnData.first;
+        redirectHead.reset(new std::string(res.buildHead()));
+        redirectBody.reset(new std::string(res.build().substr(redirectHead->size())));
+    }
+
+    // The location's pages win; the server's fill in the other codes. Both
+    // are found under this block's root.
+    const BaseBlock *owners[2] = {location, &server};
+    for (size_t i = 0; i < 2; ++i)
+    {
+        if (!owners[i])
+            continue;
+        const std::map<u_int16_t, std::string> &configured = owners[i]->getErrorPages();
+        for (std::map<u_int16_t, std::string>::const_iterator it = configured.begin(); it != configured.end(); ++it)
+        {
+            if (errorPages.count(it->first) || it->second.empty())
+                continue;
+            SharedPtr<std::string> page = loadPage(getFullPath(it->second), pages);
+            if (page.isValid())
+                errorPages[it->first] = page;
+        }
+    }
+}
+
+unsigned CompiledLocation::methodBit(const std::string &method)
+{
+    static const char *const names[] = {"GET", "HEAD", "POST", "PUT", "DELETE", "PATCH", "OPTIONS"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    {
+        if (method == names[i])
+            return 1u << i;
+    }
+    return 0;
+}
+
+bool CompiledLocation::isMethodAllowed(const std::string &method) const
+{
+    return (methods & methodBit(method)) != 0;
+}
+
+// A request path, absolute or not, is always taken relative to the root
+std::string CompiledLocation::getFullPath(const std::string &requestPath) const
+{
+    if (requestPath.empty())
+        return root;
+    std::string fullPath = rootPrefix;
+    fullPath.append(requestPath, requestPath[0] == '/' ? 1 : 0, std::string::npos);
+    return fullPath;
+}
+
+const std::string *CompiledLocation::interpreterFor(const std::string &scriptPath) const
+{
+    size_t dot = scriptPath.find_last_of('.');
+    if (dot == std::string::npos)
+        return NULL;
+    return cgiPass.find(scriptPath.data() + dot, scriptPath.size() - dot);
+}
+
+const std::string *CompiledLocation::getErrorPage(u_int16_t code) const
+{
+    std::map<u_int16_t, SharedPtr<std::string> >::const_iterator it = errorPages.find(code);
+    return it == errorPages.end() ? NULL : it->second.get();
+}
+
+bool CompiledLocation::isGzipType(const std::string &mimeType) const
+{
+    if (mimeType == "text/html")
+        return true;
+    for (size_t i = 0; i < gzipTypes.size(); ++i)
+    {
+        if (gzipTypes[i] == "*" || gzipTypes[i] == mimeType)
+            return true;
+    }
+    return false;
+}
+
+const std::string &CompiledLocation::getResponseHeaders(int statusCode) const
+{
+    return BaseBlock::sendsAllHeaders(statusCode) ? successHeaders : alwaysHeaders;
+}
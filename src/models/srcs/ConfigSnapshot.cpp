@@ -0,0 +1,79 @@
+#include "ConfigSnapshot.hpp"
+#include <arpa/inet.h>
+#include <sstream>
+
+static std::string listenKey(const std::string &addr, int port)
+{
+    std::ostringstream key;
+    key << addr << ':' << port;
+    return key.str();
+}
+
+// Each listen address gets its servers' names compiled into a table; the
+// first server to listen on an address is its default
+ConfigSnapshot::ConfigSnapshot(const std::vector<Server> &servers)
+    : servers(servers), virtualHosts(), cgiCaches(), openFileCaches(), contentCaches()
+{
+    for (size_t i = 0; i < this->servers.size(); ++i)
+    {
+        const std::vector<ListenCtx> &listens = this->servers[i].getListens();
+        const std::vector<std::string> &names = this->servers[i].getServerNames();
+        for (size_t j = 0; j < listens.size(); ++j)
+        {
+            std::string key = listenKey(listens[j].addr, listens[j].port);
+            if (!virtualHosts.count(key))
+                virtualHosts.insert(std::make_pair(key, VirtualHosts(i)));
+            VirtualHosts &hosts = virtualHosts[key];
+            for (size_t k = 0; k < names.size(); ++k)
+                hosts.addName(names[k], i);
+        }
+    }
+}
+
+const VirtualHosts *ConfigSnapshot::hostsFor(const sockaddr_in &local) const
+{
+    int port = ntohs(local.sin_port);
+    std::map<std::string, VirtualHosts>::const_iterator hosts =
+        virtualHosts.find(listenKey(inet_ntoa(local.sin_addr), port));
+    if (hosts == virtualHosts.end())
+        hosts = virtualHosts.find(listenKey("0.0.0.0", port));
+    return hosts == virtualHosts.end() ? NULL : &hosts->second;
+}
+
+time_t ConfigSnapshot::drainTimeout() const
+{
+    time_t timeout = 0;
+    for (size_t i = 0; i < servers.size(); ++i)
+    {
+        if (servers[i].getDrainTimeout() > timeout)
+            timeout = servers[i].getDrainTimeout();
+    }
+    return timeout;
+}
+
+size_t ConfigSnapshot::workerProcesses() const
+{
+    size_t workers = 0;
+    for (size_t i = 0; i < servers.size(); ++i)
+    {
+        if (servers[i].getWorkerProcesses() > workers)
+            workers = servers[i].getWorkerProcesses();
+    }
+    return workers;
+}
+
+std::vector<std::string> ConfigSnapshot::docroots() const
+{
+    std::vector<std::string> roots;
+    for (size_t i = 0; i < servers.size(); ++i)
+    {
+        roots.push_back(servers[i].getRoot());
+        const std::vector<LocationConfig> &locations = servers[i].getLocations();
+        for (size_t j = 0; j < locations.size(); ++j)
+        {
+            if (!locations[j].getRoot().empty() && locations[j].getRoot() != DEFAULT_ROOT_PATH)
+                roots.push_back(locations[j].getRoot());
+        }
+    }
+    return roots;
+}
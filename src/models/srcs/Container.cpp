@@ -10,6 +10,21 @@ void Container::insertServer(const Server &server) {
     this->_servers.push_back(server);
 }
 
+Server &Container::addServer() {
+    this->_servers.push_back(Server());
+    return this->_servers.back();
+}
+
+void Container::reserveServers(size_t count) {
+    this->_servers.reserve(count);
+}
+
 const std::vector<Server> &Container::getServers() const {
     return this->_servers;
-}
\ No newline at end of file
+}
+
+// Runs after parser(): inheritance is final only once every block is read
+void Container::compile() {
+    for (size_t i = 0; i < this->_servers.size(); ++i)
+        this->_servers[i].compile();
+}
@@ -0,0 +1,92 @@
+#include "ContentCache.hpp"
+#include "Metrics.hpp"
+
+ContentCache::ContentCache() : entries(), lru(), budget(0), maxFile(0), used(0), metrics(NULL) {}
+
+ContentCache::~ContentCache() {}
+
+void ContentCache::configure(size_t budget, size_t maxFile, ServerMetrics *metrics)
+{
+    this->budget = budget;
+    this->maxFile = maxFile;
+    this->metrics = metrics;
+    while (used > this->budget && !lru.empty())
+        evict(entries.find(lru.back()));
+}
+
+bool ContentCache::fits(off_t size) const
+{
+    return size >= 0 && static_cast<size_t>(size) <= maxFile && static_cast<size_t>(size) <= budget;
+}
+
+const CachedContent *ContentCache::lookup(const std::string &path, const struct stat &st)
+{
+    std::map<std::string, Entry>::iterator it = entries.find(path);
+    if (it != entries.end())
+    {
+        const CachedContent &content = it->second.content;
+        if (content.dev == st.st_dev && content.ino == st.st_ino && content.size == st.st_size &&
+            content.mtime == st.st_mtime)
+        {
+            lru.splice(lru.begin(), lru, it->second.lruPos);
+            if (metrics)
+            {
+                metrics->contentCacheHits++;
+                metrics->contentBytesSaved += content.body->size();
+            }
+            return &content;
+        }
+        evict(it); // the file changed on disk
+    }
+    if (metrics)
+        metrics->contentCacheMisses++;
+    return NULL;
+}
+
+// Takes over body's storage; returns the new entry, or NULL if it does not
+// fit the cache
+const CachedContent *ContentCache::store(const std::string &path, const struct stat &st, const std::string &head,
+                                         std::string &body)
+{
+    invalidate(path);
+    size_t size = path.size() + head.size() + body.size();
+    if (!fits(body.size()) || size > budget)
+        return NULL;
+    while (used + size > budget && !lru.empty())
+        evict(entries.find(lru.back()));
+
+    lru.push_front(path);
+    Entry &entry = entries[path];
+    entry.content.head.reset(new std::string(head));
+    entry.content.body.reset(new std::string());
+    entry.content.body->swap(body);
+    entry.content.dev = st.st_dev;
+    entry.content.ino = st.st_ino;
+    entry.content.size = st.st_size;
+    entry.content.mtime = st.st_mtime;
+    entry.size = size;
+    entry.lruPos = lru.begin();
+    used += size;
+    return &entry.content;
+}
+
+void ContentCache::invalidate(const std::string &path)
+{
+    std::map<std::string, Entry>::iterator it = entries.find(path);
+    if (it != entries.end())
+        evict(it);
+}
+
+void ContentCache::invalidateAll()
+{
+    entries.clear();
+    lru.clear();
+    used = 0;
+}
+
+void ContentCache::evict(std::map<std::string, Entry>::iterator entry)
+{
+    used -= entry->second.size;
+    lru.erase(entry->second.lruPos);
+    entries.erase(entry);
+}
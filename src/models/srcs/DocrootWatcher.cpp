@@ -0,0 +1,206 @@
+#include "DocrootWatcher.hpp"
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <iostream>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "HttpUtils.hpp"
+
+// Everything that can make a cached stat(), descriptor or body wrong
+#define DOCROOT_WATCH_MASK                                                                   \
+    (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM |       \
+     IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+DocrootChanges::DocrootChanges() : paths(), all(false) {}
+
+DocrootWatcher::DocrootWatcher() : fd(-1), dirs(), roots() {}
+
+DocrootWatcher::~DocrootWatcher()
+{
+    if (fd != -1)
+        close(fd);
+}
+
+// Watches every root that exists. Returns false when inotify itself is not
+// available, in which case nothing is covered.
+bool DocrootWatcher::start(const std::vector<std::string> &rootDirs)
+{
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+    {
+        std::cerr << "Docroot watcher disabled: " << strerror(errno) << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < rootDirs.size(); ++i)
+    {
+        if (roots.find(rootDirs[i]) != roots.end())
+            continue;
+        Root root;
+        root.dir = collapsePath(rootDirs[i]);
+        while (root.dir.size() > 1 && root.dir[root.dir.size() - 1] == '/')
+            root.dir.erase(root.dir.size() - 1);
+        root.complete = watchTree(root.dir);
+        if (!root.complete)
+            std::cerr << "Docroot watcher: " << rootDirs[i]
+                      << " is not fully watched, its caches revalidate by timer" << std::endl;
+        roots[rootDirs[i]] = root;
+    }
+    return true;
+}
+
+void DocrootWatcher::stop()
+{
+    if (fd != -1)
+        close(fd);
+    fd = -1;
+    dirs.clear();
+    roots.clear();
+}
+
+int DocrootWatcher::getFd() const
+{
+    return fd;
+}
+
+bool DocrootWatcher::covers(const std::string &rootDir) const
+{
+    std::map<std::string, Root>::const_iterator it = roots.find(rootDir);
+    return it != roots.end() && it->second.complete;
+}
+
+// Adds dir and every directory below it. Symbolic links are not followed:
+// their targets change without events here, so they make the tree incomplete.
+bool DocrootWatcher::watchTree(const std::string &dir)
+{
+    int wd = inotify_add_watch(fd, dir.c_str(), DOCROOT_WATCH_MASK);
+    if (wd == -1)
+    {
+        if (errno == ENOSPC)
+            std::cerr << "Docroot watcher: inotify watch limit reached at " << dir << std::endl;
+        return false;
+    }
+    dirs[wd] = dir;
+
+    DIR *handle = opendir(dir.c_str());
+    if (!handle)
+        return false;
+    bool complete = true;
+    std::string base = dir == "/" ? dir : dir + "/";
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL)
+    {
+        if (std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0)
+            continue;
+        std::string path = base + entry->d_name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) == -1)
+            continue;
+        if (S_ISLNK(st.st_mode))
+            complete = false;
+        else if (S_ISDIR(st.st_mode) && !watchTree(path))
+            complete = false;
+    }
+    closedir(handle);
+    return complete;
+}
+
+// Drops the watches of a directory that moved away; its events would carry
+// the old path
+void DocrootWatcher::unwatchTree(const std::string &dir)
+{
+    std::string prefix = dir + "/";
+    std::map<int, std::string>::iterator it = dirs.begin();
+    while (it != dirs.end())
+    {
+        if (it->second == dir || it->second.compare(0, prefix.size(), prefix) == 0)
+        {
+            inotify_rm_watch(fd, it->first);
+            dirs.erase(it++);
+        }
+        else
+            ++it;
+    }
+}
+
+// The innermost root that path lies in
+DocrootWatcher::Root *DocrootWatcher::rootOf(const std::string &path)
+{
+    Root *best = NULL;
+    for (std::map<std::string, Root>::iterator it = roots.begin(); it != roots.end(); ++it)
+    {
+        const std::string &dir = it->second.dir;
+        bool inside = path == dir ||
+                      (path.compare(0, dir.size(), dir) == 0 && path.size() > dir.size() &&
+                       (path[dir.size()] == '/' || dir == "/"));
+        if (inside && (!best || dir.size() > best->dir.size()))
+            best = &it->second;
+    }
+    return best;
+}
+
+void DocrootWatcher::readEvents(DocrootChanges &changes)
+{
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (fd != -1)
+    {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0)
+        {
+            if (length == -1 && errno == EINTR)
+                continue;
+            return;
+        }
+        for (char *ptr = buffer; ptr < buffer + length;)
+        {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                changes.all = true;
+                continue;
+            }
+            std::map<int, std::string>::iterator dir = dirs.find(event->wd);
+            if (dir == dirs.end())
+                continue;
+            if (event->mask & IN_IGNORED)
+            {
+                dirs.erase(dir);
+                continue;
+            }
+            if (event->len == 0)
+            {
+                // The watched directory itself went away or was renamed
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+                {
+                    Root *root = rootOf(dir->second);
+                    if (root && root->dir == dir->second)
+                        root->complete = false;
+                    changes.all = true;
+                }
+                continue;
+            }
+
+            std::string path = (dir->second == "/" ? dir->second : dir->second + "/") + event->name;
+            if (!(event->mask & IN_ISDIR))
+            {
+                changes.paths.push_back(path);
+                continue;
+            }
+            // Directory renames and creations can hide any number of files
+            // from the events; everything cached is revalidated instead
+            changes.all = true;
+            if (event->mask & IN_MOVED_FROM)
+                unwatchTree(path);
+            if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && !watchTree(path))
+            {
+                Root *root = rootOf(path);
+                if (root)
+                    root->complete = false;
+            }
+        }
+    }
+}
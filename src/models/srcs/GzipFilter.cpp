@@ -0,0 +1,130 @@
+#include "GzipFilter.hpp"
+#include <cstring>
+#include "CompiledLocation.hpp"
+#include "HttpResponse.hpp"
+#include "HttpUtils.hpp"
+
+// Input is fed to deflate() in pieces of this size
+#define GZIP_CHUNK 65536
+
+GzipPool::GzipPool() {}
+
+GzipPool::~GzipPool()
+{
+    for (int level = 0; level < 10; ++level)
+    {
+        for (size_t i = 0; i < idle[level].size(); ++i)
+        {
+            deflateEnd(idle[level][i]);
+            delete idle[level][i];
+        }
+    }
+}
+
+z_stream *GzipPool::acquire(int level)
+{
+    if (!idle[level].empty())
+    {
+        z_stream *stream = idle[level].back();
+        idle[level].pop_back();
+        return stream;
+    }
+    z_stream *stream = new z_stream;
+    std::memset(stream, 0, sizeof(*stream));
+    // 15 window bits + 16: gzip header and trailer instead of zlib's
+    if (deflateInit2(stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        delete stream;
+        return NULL;
+    }
+    return stream;
+}
+
+void GzipPool::release(z_stream *stream, int level)
+{
+    if (idle[level].size() < MAX_IDLE_PER_LEVEL && deflateReset(stream) == Z_OK)
+    {
+        idle[level].push_back(stream);
+        return;
+    }
+    deflateEnd(stream);
+    delete stream;
+}
+
+bool GzipFilter::accepts(const std::string &acceptEncoding)
+{
+    return acceptQuality(acceptEncoding, "gzip") > 0;
+}
+
+// Types whose bodies are compressed already; gzip_types * never covers them
+bool GzipFilter::isPrecompressedType(const std::string &mimeType)
+{
+    return (mimeType.compare(0, 6, "image/") == 0 && mimeType != "image/svg+xml") ||
+           mimeType.compare(0, 6, "video/") == 0 || mimeType.compare(0, 6, "audio/") == 0 ||
+           mimeType == "application/zip" || mimeType == "application/gzip" ||
+           mimeType == "application/x-gzip" || mimeType == "application/x-bzip2" ||
+           mimeType == "application/x-xz" || mimeType == "application/x-7z-compressed" ||
+           mimeType == "application/pdf" || mimeType == "font/woff" || mimeType == "font/woff2";
+}
+
+bool GzipFilter::applies(const HttpResponse &res, const CompiledLocation &block)
+{
+    size_t size = res.getBodySize();
+    if (!block.gzip || size == 0 || size < block.gzipMinLength)
+        return false;
+    // A 206 carries byte offsets into the uncompressed representation
+    if (res.getStatusCode() == 206 || !res.getHeader("Content-Encoding").empty())
+        return false;
+    std::string type = res.getHeader("Content-Type");
+    type = toLowerStr(trim(type.substr(0, type.find(';'))));
+    return !isPrecompressedType(type) && block.isGzipType(type);
+}
+
+bool GzipFilter::compress(HttpResponse &res, const CompiledLocation &block, GzipPool &pool, size_t &bytesIn,
+                          size_t &bytesOut)
+{
+    if (!applies(res, block))
+        return false;
+    size_t size = res.getBodySize();
+
+    int level = block.gzipCompLevel;
+    z_stream *stream = pool.acquire(level);
+    if (!stream)
+        return false;
+
+    std::string out;
+    std::string chunk(GZIP_CHUNK, '\0');
+    char buffer[GZIP_CHUNK];
+    size_t pos = 0;
+    int status = Z_OK;
+    while (status == Z_OK)
+    {
+        size_t got = res.readBody(pos, &chunk[0], chunk.size());
+        pos += got;
+        int flush = (got == 0 || pos >= size) ? Z_FINISH : Z_NO_FLUSH;
+        stream->next_in = reinterpret_cast<Bytef *>(&chunk[0]);
+        stream->avail_in = got;
+        do
+        {
+            stream->next_out = reinterpret_cast<Bytef *>(buffer);
+            stream->avail_out = sizeof(buffer);
+            status = deflate(stream, flush);
+            out.append(buffer, sizeof(buffer) - stream->avail_out);
+        } while (stream->avail_out == 0 && status == Z_OK);
+        if (flush == Z_FINISH && status == Z_OK)
+            status = Z_BUF_ERROR; // should have ended; treat as failure
+        if (out.size() >= size)
+            break; // no gain; give up early
+    }
+    pool.release(stream, level);
+    if (status != Z_STREAM_END || pos != size || out.size() >= size)
+        return false;
+
+    bytesIn = size;
+    bytesOut = out.size();
+    res.setBody(out);
+    res.setHeader("Content-Length", itoa_custom(out.size()));
+    res.setHeader("Content-Encoding", "gzip");
+    res.setHeader("Vary", "Accept-Encoding");
+    return true;
+}
@@ -9,15 +9,21 @@
 #include <cstring>
 #include <ctime>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
 #include <sstream>
 
 #include "CgiHandle.hpp"
+#include "CgiJob.hpp"
 #include "HttpResponse.hpp"
+#include "ContentCache.hpp"
 #include "HttpUtils.hpp"
+#include "OpenFileCache.hpp"
+#include "PackArchive.hpp"
 
-HttpRequest::HttpRequest(const RequestContext &ctx) : _ctx(ctx) {}
+HttpRequest::HttpRequest(const RequestContext &ctx)
+    : _ctx(ctx), enabledCgi(false), cgiJob(NULL) {}
 
 // Copy assignment operator (private - not meant to be used)
 // Note: _ctx cannot be reassigned as it's a const reference
@@ -38,18 +44,23 @@ HttpRequest &HttpRequest::operator=(const HttpRequest &other)
   return *this;
 }
 
-HttpRequest::~HttpRequest() {}
+HttpRequest::~HttpRequest()
+{
+  // A job nobody picked up must not leave its child running
+  delete cgiJob;
+}
 
 bool HttpRequest::isCgiEnabledForRequest() const
 {
   // Location-level setting overrides server-level setting
   // If no location matches, use server-level setting
-  // Note: Locations inherit from server if not explicitly set during parsing
-  if (_ctx.location)
-  {
-    return _ctx.location->isCgiEnabled();
-  }
-  return _ctx.server.isCgiEnabled();
+  // Note: Locations inherit from server if not explicitly set, at compile()
+  return _ctx.isCgiEnabled();
+}
+
+const RequestContext &HttpRequest::getContext() const
+{
+  return _ctx;
 }
 
 const std::string &HttpRequest::getMethod() const
@@ -102,6 +113,19 @@ void HttpRequest::setEnabledCgi(bool enabled)
   enabledCgi = enabled;
 }
 
+void HttpRequest::setCgiJob(CgiJob *job)
+{
+  delete cgiJob;
+  cgiJob = job;
+}
+
+CgiJob *HttpRequest::releaseCgiJob()
+{
+  CgiJob *job = cgiJob;
+  cgiJob = NULL;
+  return job;
+}
+
 void HttpRequest::addHeader(const std::string &k, const std::string &v)
 {
   headers[k] = v;
@@ -231,6 +255,212 @@ void GetHeadRequest::handle(HttpResponse &res,
   handleGetOrHead(res, includeBody, clientAddr, epollFd);
 }
 
+// Appends exactly size bytes of fd, starting at offset, to out
+static bool readFileRange(int fd, off_t offset, off_t size, std::string &out)
+{
+  size_t start = out.size();
+  out.resize(start + size);
+  off_t done = 0;
+  while (done < size)
+  {
+    ssize_t got = pread(fd, &out[start + done], size - done, offset + done);
+    if (got <= 0)
+    {
+      if (got == -1 && errno == EINTR)
+        continue;
+      return false;
+    }
+    done += got;
+  }
+  return true;
+}
+
+// gzip_static: the encodings with a precompressed sibling ("gzip" -> .gz,
+// "br" -> .br) the client takes, best first
+std::vector<std::string> HttpRequest::acceptedPrecompressed() const
+{
+  std::vector<std::string> codings;
+  std::map<std::string, std::string>::const_iterator accept = headers.find("accept-encoding");
+  if (!_ctx.compiled.gzipStatic || accept == headers.end())
+    return codings;
+  double br = acceptQuality(accept->second, "br");
+  double gzip = acceptQuality(accept->second, "gzip");
+  if (br > 0 && br >= gzip)
+    codings.push_back("br");
+  if (gzip > 0)
+    codings.push_back("gzip");
+  if (br > 0 && br < gzip)
+    codings.push_back("br");
+  return codings;
+}
+
+// RFC 7232 6: If-None-Match decides when present, If-Modified-Since only
+// without it
+bool HttpRequest::isNotModified(const std::string &etag, time_t mtime) const
+{
+  std::map<std::string, std::string>::const_iterator header = headers.find("if-none-match");
+  if (header != headers.end())
+    return etagListMatches(header->second, etag);
+  header = headers.find("if-modified-since");
+  time_t since;
+  return header != headers.end() && parseHttpDate(header->second, since) && mtime <= since;
+}
+
+// Range only applies to GET, and If-Range only lets it through while the
+// representation is the one the client holds: a strong ETag match or the
+// exact Last-Modified date (RFC 7233 3.2)
+HttpRequest::RangeResult HttpRequest::selectRanges(const std::string &etag, time_t mtime, off_t size,
+                                                   std::vector<ByteRange> &ranges) const
+{
+  std::map<std::string, std::string>::const_iterator range = headers.find("range");
+  if (method != "GET" || range == headers.end())
+    return RANGE_NONE;
+  std::map<std::string, std::string>::const_iterator ifRange = headers.find("if-range");
+  if (ifRange != headers.end())
+  {
+    std::string validator = trim(ifRange->second);
+    time_t since;
+    if (validator.compare(0, 2, "W/") == 0 || (!validator.empty() && validator[0] == '"'))
+    {
+      if (etag.compare(0, 2, "W/") == 0 || validator != etag)
+        return RANGE_NONE;
+    }
+    else if (!parseHttpDate(validator, since) || since != mtime)
+      return RANGE_NONE;
+  }
+  if (!parseByteRanges(range->second, size, ranges))
+    return RANGE_NONE;
+  return ranges.empty() ? RANGE_UNSATISFIABLE : RANGE_PARTIAL;
+}
+
+static std::string contentRange(off_t first, off_t last, off_t size)
+{
+  std::ostringstream value;
+  value << "bytes " << first << "-" << last << "/" << size;
+  return value.str();
+}
+
+// A 206 for ranges of a representation of size bytes found at base in file.
+// Every range goes out zero-copy like a whole file would, from the mapping
+// when there is one; with several, only the multipart/byteranges part
+// headers and boundaries are held in memory.
+void HttpRequest::serveRanges(HttpResponse &res, const std::vector<ByteRange> &ranges, off_t size,
+                              const std::string &mimeType, const SharedPtr<FileGuard> &file,
+                              const SharedPtr<MappedFile> &mapping, off_t base)
+{
+  std::ostringstream lenStream;
+  if (ranges.size() == 1)
+  {
+    size_t length = ranges[0].last - ranges[0].first + 1;
+    lenStream << length;
+    res.setStatus(206, "Partial Content");
+    res.setHeader("Content-Range", contentRange(ranges[0].first, ranges[0].last, size));
+    res.setHeader("Content-Length", lenStream.str());
+    if (mapping.isValid())
+      res.setBodyMapping(mapping, base + ranges[0].first, length);
+    else
+      res.setBodyFile(file, base + ranges[0].first, length);
+    return;
+  }
+
+  static unsigned long sequence = 0;
+  std::ostringstream boundaryStream;
+  boundaryStream << std::hex << time(NULL) << std::setw(8) << std::setfill('0') << ++sequence;
+  std::string boundary = boundaryStream.str();
+
+  res.setBody("");
+  for (size_t i = 0; i < ranges.size(); ++i)
+  {
+    res.appendBodyText(std::string(i ? "\r\n" : "") + "--" + boundary + "\r\nContent-Type: " + mimeType +
+                       "\r\nContent-Range: " + contentRange(ranges[i].first, ranges[i].last, size) + "\r\n\r\n");
+    res.appendBodyRange(file, mapping, base + ranges[i].first, ranges[i].last - ranges[i].first + 1);
+  }
+  res.appendBodyText("\r\n--" + boundary + "--\r\n");
+
+  lenStream << res.getBodySize();
+  res.setStatus(206, "Partial Content");
+  res.setHeader("Content-Type", "multipart/byteranges; boundary=" + boundary);
+  res.setHeader("Content-Length", lenStream.str());
+}
+
+static const char *precompressedSuffix(const std::string &coding)
+{
+  return coding == "br" ? ".br" : ".gz";
+}
+
+// root_pack: everything comes from the archive's index and mapping, no
+// path ever reaches the filesystem
+void HttpRequest::servePacked(HttpResponse &res, bool includeBody)
+{
+  const PackArchive &pack = *_ctx.pack;
+  std::string key = collapsePath(path);
+  if (key.empty() || key[0] != '/')
+    key = "/" + key;
+
+  const PackRecord *record = key[key.size() - 1] == '/' ? NULL : pack.find(key);
+  if (!record)
+  {
+    // A directory: its first index file in the archive
+    std::string dir = key[key.size() - 1] == '/' ? key : key + "/";
+    const std::vector<std::string> &indexFiles = _ctx.getIndexFiles();
+    for (size_t i = 0; i < indexFiles.size() && !record; ++i)
+      record = pack.find(dir + indexFiles[i]);
+  }
+  if (!record)
+  {
+    res.setErrorFromContext(404, _ctx);
+    return;
+  }
+
+  int variant = PACK_IDENTITY;
+  std::vector<std::string> codings = acceptedPrecompressed();
+  for (size_t i = 0; i < codings.size() && variant == PACK_IDENTITY; ++i)
+  {
+    int candidate = codings[i] == "br" ? PACK_BROTLI : PACK_GZIP;
+    if (record->variants & (1u << candidate))
+      variant = candidate;
+  }
+
+  // Variants share the record's ETag, so it is made weak once they differ
+  std::string etag = pack.getString(record->etag);
+  if (variant != PACK_IDENTITY)
+    etag = "W/" + etag;
+  res.setHeader("ETag", etag);
+  res.setHeader("Last-Modified", formatHttpDate(record->mtime));
+  if (_ctx.compiled.gzipStatic)
+    res.setHeader("Vary", "Accept-Encoding");
+  if (isNotModified(etag, record->mtime))
+  {
+    res.setStatus(304, "Not Modified");
+    return;
+  }
+
+  size_t length = record->length[variant];
+  std::vector<ByteRange> ranges;
+  RangeResult range = selectRanges(etag, record->mtime, length, ranges);
+  if (range == RANGE_UNSATISFIABLE)
+  {
+    res.setErrorFromContext(416, _ctx);
+    res.setHeader("Content-Range", "bytes */" + itoa_custom(length));
+    return;
+  }
+
+  std::string mimeType = pack.getString(record->mimeType);
+  std::ostringstream lenStream;
+  lenStream << length;
+  res.setStatus(200, "OK");
+  res.setHeader("Content-Length", lenStream.str());
+  res.setHeader("Content-Type", mimeType);
+  res.setHeader("Accept-Ranges", "bytes");
+  if (variant != PACK_IDENTITY)
+    res.setHeader("Content-Encoding", variant == PACK_BROTLI ? "br" : "gzip");
+  if (range == RANGE_PARTIAL)
+    serveRanges(res, ranges, length, mimeType, pack.getMapping()->getFile(), pack.getMapping(),
+                record->offset[variant]);
+  else if (includeBody)
+    res.setBodyMapping(pack.getMapping(), record->offset[variant], length);
+}
+
 void HttpRequest::handleGetOrHead(HttpResponse &res,
                                   bool includeBody,
                                   sockaddr_in &clientAddr,
@@ -239,9 +469,7 @@ void HttpRequest::handleGetOrHead(HttpResponse &res,
   // Check for redirect first
   if (_ctx.hasReturn())
   {
-    const std::pair<u_int16_t, std::string> &returnData = _ctx.getReturnData();
-    res.setVersion("HTTP/1.0");
-    res.setRedirect(returnData.first, returnData.second);
+    _ctx.setReturnResponse(res, includeBody);
     return;
   }
 
@@ -251,63 +479,50 @@ void HttpRequest::handleGetOrHead(HttpResponse &res,
     return;
   }
 
-  std::string fullPath = _ctx.getFullPath(path);
+  if (_ctx.pack)
+  {
+    servePacked(res, includeBody);
+    return;
+  }
+
+  std::string fullPath = collapsePath(_ctx.getFullPath(path));
   std::cerr << "[DEBUG] GET path=" << path << " fullPath=" << fullPath << std::endl;
-  struct stat fileStat;
-  std::memset(&fileStat, 0, sizeof(fileStat));
 
-  if (stat(fullPath.c_str(), &fileStat) != 0)
+  // Lookups go through open_file_cache when it is on; otherwise a scratch
+  // cache that lives for this request only does the plain syscalls
+  OpenFileCache scratch;
+  OpenFileCache &files = _ctx.openFileCache ? *_ctx.openFileCache : scratch;
+  time_t now = time(NULL);
+  OpenFileInfo fileInfo = files.stat(fullPath, now);
+
+  if (!fileInfo.exists)
   {
-    std::cerr << "[DEBUG] File not found: " << fullPath << " errno=" << errno << std::endl;
+    std::cerr << "[DEBUG] File not found: " << fullPath << " errno=" << fileInfo.error << std::endl;
     res.setErrorFromContext(404, _ctx);
     return;
   }
 
   // Check if CGI is enabled (location overrides server setting) and file is not
   // a directory
-  if (isCgiEnabledForRequest() && !S_ISDIR(fileStat.st_mode))
+  if (isCgiEnabledForRequest() && !S_ISDIR(fileInfo.st.st_mode))
   {
     // Handle CGI requests
     CgiHandle cgiHandler;
-    std::string scriptPath = _ctx.getFullPath(path);
-    if (scriptPath.empty())
-    {
-      res.setErrorFromContext(500, _ctx);
-      return;
-    }
-    struct stat scriptStat;
-    std::memset(&scriptStat, 0, sizeof(scriptStat));
-    if (stat(scriptPath.c_str(), &scriptStat) != 0 ||
-        !(scriptStat.st_mode & S_IXUSR))
+    if (!(fileInfo.st.st_mode & S_IXUSR))
     {
       res.setErrorFromContext(403, _ctx);
       return;
     }
-    cgiHandler.buildCgiScript(scriptPath, _ctx, res, *this, clientAddr,
+    cgiHandler.buildCgiScript(fullPath, _ctx, res, *this, clientAddr,
                               epollFd);
     return;
   }
 
-  if (S_ISDIR(fileStat.st_mode))
+  if (S_ISDIR(fileInfo.st.st_mode))
   {
-    bool found = false;
-    const std::vector<std::string> &indexFiles = _ctx.getIndexFiles();
-    for (size_t i = 0; i < indexFiles.size(); i++)
-    {
-      std::string indexPath = fullPath;
-      if (fullPath.empty() || fullPath[fullPath.size() - 1] != '/')
-        indexPath += '/';
-      indexPath += indexFiles[i];
+    std::string indexPath = files.resolveIndex(fullPath, _ctx.getIndexFiles(), now);
 
-      if (stat(indexPath.c_str(), &fileStat) == 0)
-      {
-        fullPath = indexPath;
-        found = true;
-        break;
-      }
-    }
-
-    if (!found)
+    if (indexPath.empty())
     {
       std::cerr << "is enabled autoindex: " << _ctx.getAutoIndex() << "\n";
       if (_ctx.getAutoIndex())
@@ -325,27 +540,120 @@ void HttpRequest::handleGetOrHead(HttpResponse &res,
       res.setErrorFromContext(404, _ctx);
       return;
     }
+    fullPath = indexPath;
+    fileInfo = files.stat(fullPath, now);
   }
 
-  std::ifstream file(fullPath.c_str(), std::ios::binary);
-  if (!file.is_open())
+  // gzip_static: an accepted .gz/.br sibling at least as new as the file is
+  // sent in its place, typed like the original
+  std::string mimeType = fileInfo.mimeType;
+  std::string encoding;
+  std::vector<std::string> codings = acceptedPrecompressed();
+  for (size_t i = 0; i < codings.size() && encoding.empty(); ++i)
   {
-    res.setErrorFromContext(403, _ctx);
+    std::string siblingPath = fullPath + precompressedSuffix(codings[i]);
+    OpenFileInfo sibling = files.stat(siblingPath, now);
+    if (sibling.exists && S_ISREG(sibling.st.st_mode) && sibling.st.st_mtime >= fileInfo.st.st_mtime)
+    {
+      encoding = codings[i];
+      fullPath = siblingPath;
+      fileInfo = sibling;
+    }
+  }
+
+  // Validators come from stat() alone, so a revalidating client is answered
+  // before the file is opened or read
+  std::string etag = makeETag(fileInfo.st);
+  std::string lastModified = formatHttpDate(fileInfo.st.st_mtime);
+  if (isNotModified(etag, fileInfo.st.st_mtime))
+  {
+    res.setStatus(304, "Not Modified");
+    res.setHeader("ETag", etag);
+    res.setHeader("Last-Modified", lastModified);
+    if (_ctx.compiled.gzipStatic)
+      res.setHeader("Vary", "Accept-Encoding");
+    return;
+  }
+
+  std::vector<ByteRange> ranges;
+  RangeResult range = selectRanges(etag, fileInfo.st.st_mtime, fileInfo.st.st_size, ranges);
+  if (range == RANGE_UNSATISFIABLE)
+  {
+    res.setErrorFromContext(416, _ctx);
+    res.setHeader("Content-Range", "bytes */" + itoa_custom(fileInfo.st.st_size));
+    return;
+  }
+
+  // A content_cache hit needs neither the descriptor nor a read; it only
+  // holds whole responses, so ranges skip it
+  ContentCache *contents = _ctx.contentCache;
+  const CachedContent *cached =
+      contents && range == RANGE_NONE ? contents->lookup(fullPath, fileInfo.st) : NULL;
+  if (cached)
+  {
+    res.setStatus(200, "OK");
+    res.setSharedContent(cached->head, includeBody ? cached->body : SharedPtr<std::string>());
     return;
   }
 
-  std::ostringstream content;
-  if (includeBody)
-    content << file.rdbuf();
+  SharedPtr<FileGuard> file = files.open(fullPath, now);
+  if (!file.isValid())
+  {
+    res.setErrorFromContext(403, _ctx);
+    return;
+  }
 
   std::ostringstream lenStream;
-  lenStream << fileStat.st_size;
+  lenStream << fileInfo.st.st_size;
 
   res.setStatus(200, "OK");
   res.setHeader("Content-Length", lenStream.str());
-  res.setHeader("Content-Type", getMimeType(fullPath));
-  if (includeBody)
-    res.setBody(content.str());
+  res.setHeader("Content-Type", mimeType);
+  res.setHeader("ETag", etag);
+  res.setHeader("Last-Modified", lastModified);
+  if (!encoding.empty())
+    res.setHeader("Content-Encoding", encoding);
+  if (_ctx.compiled.gzipStatic)
+    res.setHeader("Vary", "Accept-Encoding");
+  res.setHeader("Accept-Ranges", "bytes");
+
+  bool mappable = static_cast<size_t>(fileInfo.st.st_size) <= _ctx.compiled.mmapMaxFile;
+  if (range == RANGE_PARTIAL)
+  {
+    SharedPtr<MappedFile> mapping;
+    if (mappable)
+      mapping = files.map(fullPath, now);
+    serveRanges(res, ranges, fileInfo.st.st_size, mimeType, file, mapping, 0);
+    return;
+  }
+
+  std::string content;
+  if (contents && contents->fits(fileInfo.st.st_size) && readFileRange(file->get(), 0, fileInfo.st.st_size, content))
+  {
+    res.setVersion("HTTP/1.0");
+    res.setRenderedHeaders(_ctx.compiled.getResponseHeaders(200));
+    cached = contents->store(fullPath, fileInfo.st, res.buildHead(), content);
+    if (cached)
+    {
+      res.setSharedContent(cached->head, includeBody ? cached->body : SharedPtr<std::string>());
+      return;
+    }
+  }
+
+  if (!includeBody)
+    return;
+  // Files within the mmap limit are written from a mapping shared by all
+  // responses; the rest straight from the descriptor with sendfile()
+  if (mappable)
+  {
+    SharedPtr<MappedFile> mapping = files.map(fullPath, now);
+    if (mapping.isValid())
+    {
+      res.setBodyMapping(mapping, 0, fileInfo.st.st_size);
+      return;
+    }
+  }
+  res.setBodyFile(file, 0, fileInfo.st.st_size);
 }
 
 //--------------------------POST--------------------------
@@ -407,15 +715,7 @@ void PostRequest::handle(HttpResponse &res,
                               epollFd);
     return;
   }
-  std::string uploadDir;
-  if (_ctx.location && !_ctx.location->getUploadDir().empty())
-  {
-    uploadDir = _ctx.location->getUploadDir();
-  }
-  else
-  {
-    uploadDir = _ctx.server.getRoot();
-  }
+  std::string uploadDir = _ctx.getUploadDir();
 
   if (!uploadDir.empty() && uploadDir[uploadDir.size() - 1] != '/')
     uploadDir += '/';
@@ -452,6 +752,7 @@ void PostRequest::handle(HttpResponse &res,
   }
   outFile << body;
   outFile.close();
+  _ctx.invalidateCachedPath(fullPath);
 
   if (createdNew)
   {
@@ -565,6 +866,7 @@ void DeleteRequest::handle(HttpResponse &res,
     }
     return;
   }
+  _ctx.invalidateCachedPath(fullPath);
   res.setStatus(204, "No Content");
   res.setHeader("Content-Length", "0");
 }
@@ -1,11 +1,17 @@
 #include "HttpResponse.hpp"
+#include <algorithm>
 #include <sstream>
 #include <string>
+#include <unistd.h>
 #include "HttpRequest.hpp"
+#include "HttpUtils.hpp"
+#include "SendQueue.hpp"
 #include "Server.hpp"
 #include "requestContext.hpp"
 
-HttpResponse::HttpResponse() : statusCode(200), statusMessage("OK") {}
+HttpResponse::HttpResponse()
+    : statusCode(200), bodyOffset(0), bodyFile(), bodyFileOffset(0), bodyFileLength(0), bodyMap(), sharedHead(), sharedBody(),
+      bodyParts(), statusMessage("OK") {}
 
 HttpResponse::~HttpResponse() {}
 
@@ -23,6 +29,90 @@ void HttpResponse::setHeader(const std::string &key, const std::string &value)
 void HttpResponse::setBody(const std::string &b)
 {
   body = b;
+  bodyOffset = 0;
+  bodyFile.reset();
+  bodyFileLength = 0;
+  bodyMap.reset();
+  sharedHead.reset();
+  sharedBody.reset();
+  bodyParts.clear();
+}
+
+// Takes over data's storage and exposes [offset, offset + length) as the body,
+// so a producer's buffer (e.g. raw CGI output) is never copied.
+void HttpResponse::setBodySlice(std::string &data, size_t offset, size_t length)
+{
+  body.swap(data);
+  std::string().swap(data);
+  if (offset > body.size())
+    offset = body.size();
+  if (length < body.size() - offset)
+    body.resize(offset + length);
+  bodyOffset = offset;
+}
+
+// Appends a file range to the body; it is sent with sendfile() and never
+// read into memory on the normal path.
+void HttpResponse::setBodyFile(const SharedPtr<FileGuard> &file, off_t offset, size_t length)
+{
+  bodyFile = file;
+  bodyFileOffset = offset;
+  bodyFileLength = file.isValid() ? length : 0;
+  bodyMap.reset();
+}
+
+// Like setBodyFile, but the range is written straight from the mapping;
+// sendfile() on the underlying file remains the fallback
+void HttpResponse::setBodyMapping(const SharedPtr<MappedFile> &map, off_t offset, size_t length)
+{
+  setBodyFile(map->getFile(), offset, length);
+  bodyMap = map;
+}
+
+// Serves cached bytes as they are: the head is sent verbatim (status line
+// and headers already rendered) and neither buffer is copied per client.
+void HttpResponse::setSharedContent(const SharedPtr<std::string> &head, const SharedPtr<std::string> &body)
+{
+  setBody("");
+  sharedHead = head;
+  sharedBody = body;
+}
+
+// Multipart bodies are built from these: the literal bytes between parts
+// and the ranges themselves, which stay in the file like a single range
+void HttpResponse::appendBodyText(const std::string &text)
+{
+  if (!bodyParts.empty() && !bodyParts.back().file.isValid())
+  {
+    bodyParts.back().data += text;
+    bodyParts.back().length += text.size();
+    return;
+  }
+  BodyPart part;
+  part.data = text;
+  part.offset = 0;
+  part.length = text.size();
+  bodyParts.push_back(part);
+}
+
+void HttpResponse::appendBodyRange(const SharedPtr<FileGuard> &file, const SharedPtr<MappedFile> &map,
+                                   off_t offset, size_t length)
+{
+  BodyPart part;
+  part.file = map.isValid() ? map->getFile() : file;
+  part.mapping = map;
+  part.offset = offset;
+  part.length = part.file.isValid() ? length : 0;
+  bodyParts.push_back(part);
+}
+
+size_t HttpResponse::getBodySize() const
+{
+  size_t shared = sharedBody.isValid() ? sharedBody->size() : 0;
+  size_t parts = 0;
+  for (size_t i = 0; i < bodyParts.size(); ++i)
+    parts += bodyParts[i].length;
+  return body.size() - bodyOffset + shared + bodyFileLength + parts;
 }
 
 void HttpResponse::setVersion(const std::string &v)
@@ -35,6 +125,13 @@ void HttpResponse::addSetCookieHeader(const std::string &value)
   setCookieHeaders.push_back(value);
 }
 
+// Lines pre-rendered at config load (expires, add_header), sent after the
+// other headers as they are
+void HttpResponse::setRenderedHeaders(const std::string &lines)
+{
+  renderedHeaders = lines;
+}
+
 std::vector<std::string> HttpResponse::getSetCookieHeaders() const
 {
   return setCookieHeaders;
@@ -42,6 +139,76 @@ std::vector<std::string> HttpResponse::getSetCookieHeaders() const
 
 std::string HttpResponse::build() const
 {
+  std::string response = buildHead();
+  response.append(body, bodyOffset, std::string::npos);
+  if (sharedBody.isValid())
+    response.append(*sharedBody);
+  if (bodyFileLength > 0)
+  {
+    std::string fileBody(bodyFileLength, '\0');
+    ssize_t got = pread(bodyFile->get(), &fileBody[0], bodyFileLength, bodyFileOffset);
+    fileBody.resize(got > 0 ? got : 0);
+    response.append(fileBody);
+  }
+  for (size_t i = 0; i < bodyParts.size(); ++i)
+  {
+    size_t start = response.size();
+    response.resize(start + bodyParts[i].length);
+    response.resize(start + readPart(bodyParts[i], 0, &response[start], bodyParts[i].length));
+  }
+  return response;
+}
+
+void HttpResponse::moveInto(SendQueue &queue)
+{
+  if (sharedHead.isValid())
+    queue.appendShared(sharedHead, 0, sharedHead->size());
+  else
+    queue.append(buildHead());
+  queue.adopt(body, bodyOffset, body.size());
+  bodyOffset = 0;
+  if (sharedBody.isValid())
+    queue.appendShared(sharedBody, 0, sharedBody->size());
+  queue.appendFile(bodyFile, bodyFileOffset, bodyFileLength, bodyMap);
+  bodyFile.reset();
+  bodyFileLength = 0;
+  bodyMap.reset();
+  for (size_t i = 0; i < bodyParts.size(); ++i)
+  {
+    if (bodyParts[i].file.isValid())
+      queue.appendFile(bodyParts[i].file, bodyParts[i].offset, bodyParts[i].length, bodyParts[i].mapping);
+    else
+      queue.adopt(bodyParts[i].data, 0, bodyParts[i].data.size());
+  }
+  bodyParts.clear();
+}
+
+// Queues a copy for another client; a file-backed body part is shared
+void HttpResponse::copyInto(SendQueue &queue) const
+{
+  if (sharedHead.isValid())
+    queue.appendShared(sharedHead, 0, sharedHead->size());
+  else
+    queue.append(buildHead());
+  if (bodyOffset < body.size())
+    queue.append(body.substr(bodyOffset));
+  if (sharedBody.isValid())
+    queue.appendShared(sharedBody, 0, sharedBody->size());
+  queue.appendFile(bodyFile, bodyFileOffset, bodyFileLength, bodyMap);
+  for (size_t i = 0; i < bodyParts.size(); ++i)
+  {
+    if (bodyParts[i].file.isValid())
+      queue.appendFile(bodyParts[i].file, bodyParts[i].offset, bodyParts[i].length, bodyParts[i].mapping);
+    else
+      queue.append(bodyParts[i].data);
+  }
+}
+
+std::string HttpResponse::buildHead() const
+{
+  if (sharedHead.isValid())
+    return *sharedHead;
+
   std::ostringstream response;
 
   // Start line: HTTP version + status code + message
@@ -59,10 +226,10 @@ std::string HttpResponse::build() const
   {
     response << "Set-Cookie: " << *scIt << "\r\n";
   }
+  response << renderedHeaders;
 
   // Blank line separating headers and body
   response << "\r\n";
-  response << body;
   return response.str();
 }
 
@@ -70,6 +237,15 @@ static std::string getStatusMessage(int code)
 {
   switch (code)
   {
+  // Success codes
+  case 200:
+    return "OK";
+  case 201:
+    return "Created";
+  case 204:
+    return "No Content";
+  case 206:
+    return "Partial Content";
   // Redirect codes
   case 301:
     return "Moved Permanently";
@@ -81,6 +257,8 @@ static std::string getStatusMessage(int code)
     return "Temporary Redirect";
   case 308:
     return "Permanent Redirect";
+  case 304:
+    return "Not Modified";
   // Client error codes
   case 400:
     return "Bad Request";
@@ -96,6 +274,8 @@ static std::string getStatusMessage(int code)
     return "Method Not Allowed";
   case 413:
     return "Payload Too Large";
+  case 416:
+    return "Range Not Satisfiable";
   case 431:
     return "Request Header Fields Too Large";
   // Server error codes
@@ -114,6 +294,11 @@ static std::string getStatusMessage(int code)
   }
 }
 
+std::string HttpResponse::reasonPhrase(int code)
+{
+  return getStatusMessage(code);
+}
+
 void HttpResponse::setError(int code, const std::string &reason)
 {
   setStatus(code, reason);
@@ -123,7 +308,7 @@ void HttpResponse::setError(int code, const std::string &reason)
   setBody(content.str());
 
   std::ostringstream lenStream;
-  lenStream << body.size();
+  lenStream << getBodySize();
   setHeader("Content-Length", lenStream.str());
   setHeader("Content-Type", "text/html");
 }
@@ -131,14 +316,12 @@ void HttpResponse::setError(int code, const std::string &reason)
 void HttpResponse::setErrorFromContext(int code, const RequestContext &ctx)
 {
   std::string content;
+  const std::string *page = ctx.getErrorPage(code);
 
-  try
+  if (page)
+    content = *page;
+  else
   {
-    content = ctx.getErrorPageContent(code);
-  }
-  catch (const std::exception &e)
-  {
-    std::cerr << "Error loading page: " << e.what() << '\n';
     std::ostringstream fallback;
     fallback << "<html><body><h1>Error " << code << "</h1></body></html>";
     content = fallback.str();
@@ -162,6 +345,100 @@ std::string HttpResponse::getHostHeader() const
   return "";
 }
 
+// Header names are matched case-insensitively; "" if absent
+std::string HttpResponse::getHeader(const std::string &key) const
+{
+  std::string wanted = toLowerStr(key);
+  std::map<std::string, std::string>::const_iterator it = headers.begin();
+  for (; it != headers.end(); ++it)
+  {
+    if (toLowerStr(it->first) == wanted)
+      return it->second;
+  }
+  return "";
+}
+
+bool HttpResponse::hasBodyFile() const
+{
+  for (size_t i = 0; i < bodyParts.size(); ++i)
+  {
+    if (bodyParts[i].file.isValid() && bodyParts[i].length > 0)
+      return true;
+  }
+  return bodyFileLength > 0;
+}
+
+bool HttpResponse::hasSharedContent() const
+{
+  return sharedHead.isValid() || sharedBody.isValid();
+}
+
+// Copies up to length body bytes starting at pos, across the in-memory,
+// shared and file parts in that order; returns how many were copied
+size_t HttpResponse::readBody(size_t pos, char *buffer, size_t length) const
+{
+  size_t copied = 0;
+  size_t memory = body.size() - bodyOffset;
+  if (pos < memory)
+  {
+    size_t n = std::min(length, memory - pos);
+    body.copy(buffer, n, bodyOffset + pos);
+    copied += n;
+  }
+  pos = pos > memory ? pos - memory : 0;
+
+  size_t shared = sharedBody.isValid() ? sharedBody->size() : 0;
+  if (copied < length && pos < shared)
+  {
+    size_t n = std::min(length - copied, shared - pos);
+    sharedBody->copy(buffer + copied, n, pos);
+    copied += n;
+  }
+  pos = pos > shared ? pos - shared : 0;
+
+  while (copied < length && pos < bodyFileLength)
+  {
+    size_t n = std::min(length - copied, bodyFileLength - pos);
+    ssize_t got = pread(bodyFile->get(), buffer + copied, n, bodyFileOffset + pos);
+    if (got <= 0)
+      return copied;
+    copied += got;
+    pos += got;
+  }
+  pos = pos > bodyFileLength ? pos - bodyFileLength : 0;
+
+  for (size_t i = 0; i < bodyParts.size() && copied < length; ++i)
+  {
+    if (pos >= bodyParts[i].length)
+    {
+      pos -= bodyParts[i].length;
+      continue;
+    }
+    size_t got = readPart(bodyParts[i], pos, buffer + copied, length - copied);
+    if (got < std::min(length - copied, bodyParts[i].length - pos))
+      return copied + got;
+    copied += got;
+    pos = 0;
+  }
+  return copied;
+}
+
+size_t HttpResponse::readPart(const BodyPart &part, size_t pos, char *buffer, size_t length)
+{
+  size_t n = std::min(length, part.length - pos);
+  if (!part.file.isValid())
+    return part.data.copy(buffer, n, pos);
+  size_t copied = 0;
+  while (copied < n)
+  {
+    ssize_t got = pread(part.file->get(), buffer + copied, n - copied, part.offset + pos + copied);
+    if (got <= 0)
+      break;
+    copied += got;
+  }
+  return copied;
+}
+
 int HttpResponse::getStatusCode() const
 {
   return statusCode;
@@ -181,7 +458,7 @@ void HttpResponse::setRedirect(int code, const std::string &location)
           << "\">here</a>.</p></body></html>";
   setBody(content.str());
   std::ostringstream lenStream;
-  lenStream << body.size();
+  lenStream << getBodySize();
   setHeader("Content-Length", lenStream.str());
   setHeader("Content-Type", "text/html");
 }
@@ -1,6 +1,9 @@
 #include "HttpUtils.hpp"
 #include <algorithm>
 #include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -8,6 +11,7 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include "utils.hpp"
 
 std::string ltrim(const std::string& s) {
     size_t start = 0;
@@ -124,6 +128,158 @@ std::string extractFileName(const std::string& path) {
     return path.substr(pos + 1);
 }
 
+// Folds "//" and "/./" so one file has one spelling; caches key on this
+std::string collapsePath(const std::string& path) {
+    std::string result;
+    result.reserve(path.size());
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (path[i] == '/' && !result.empty() && result[result.size() - 1] == '/')
+            continue;
+        if (path[i] == '.' && !result.empty() && result[result.size() - 1] == '/' &&
+            (i + 1 == path.size() || path[i + 1] == '/')) {
+            ++i;
+            continue;
+        }
+        result.push_back(path[i]);
+    }
+    return result;
+}
+
+// IMF-fixdate, the only form servers may generate (RFC 7231 7.1.1.1)
+std::string formatHttpDate(time_t when) {
+    char buffer[64];
+    struct tm tm;
+    gmtime_r(&when, &tm);
+    strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buffer;
+}
+
+bool parseHttpDate(const std::string& date, time_t& when) {
+    struct tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    if (!strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm))
+        return false;
+    when = timegm(&tm);
+    return true;
+}
+
+// Strong validator from what stat() already says: inode, size and mtime
+std::string makeETag(const struct stat& st) {
+    std::ostringstream etag;
+    etag << std::hex << '"' << st.st_ino << '-' << st.st_size << '-' << st.st_mtime << '"';
+    return etag.str();
+}
+
+// If-None-Match: "*" or a comma-separated list, compared weakly (RFC 7232 2.3.2)
+bool etagListMatches(const std::string& list, const std::string& etag) {
+    std::string opaque = etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag;
+    std::stringstream items(list);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        item = trim(item);
+        if (item == "*")
+            return true;
+        if (item.compare(0, 2, "W/") == 0)
+            item = item.substr(2);
+        if (item == opaque)
+            return true;
+    }
+    return false;
+}
+
+// Reads a run of digits at pos into value; false when there is none or it
+// does not fit in an off_t
+static bool parseRangeNumber(const std::string& spec, size_t& pos, off_t& value) {
+    size_t start = pos;
+    value = 0;
+    while (pos < spec.size() && std::isdigit(static_cast<unsigned char>(spec[pos]))) {
+        if (pos - start >= 18)
+            return false;
+        value = value * 10 + (spec[pos] - '0');
+        ++pos;
+    }
+    return pos > start;
+}
+
+// Range: bytes=... against a representation of size bytes (RFC 7233 2.1).
+// Fills ranges with the satisfiable ranges, clamped to size; an empty result
+// means none is (416). Returns false when the header is to be ignored and the
+// whole representation sent: not a byte range set, malformed, more than
+// MAX_BYTE_RANGES ranges, or ranges adding up to more than the file itself.
+bool parseByteRanges(const std::string& header, off_t size, std::vector<ByteRange>& ranges) {
+    ranges.clear();
+    std::string value = trim(header);
+    size_t eq = value.find('=');
+    if (eq == std::string::npos || toLowerStr(trim(value.substr(0, eq))) != "bytes")
+        return false;
+
+    std::stringstream list(value.substr(eq + 1));
+    std::string spec;
+    size_t count = 0;
+    off_t total = 0;
+    while (std::getline(list, spec, ',')) {
+        spec = trim(spec);
+        if (spec.empty())
+            continue;
+        if (++count > MAX_BYTE_RANGES)
+            return false;
+        size_t pos = 0;
+        ByteRange range;
+        if (spec[0] == '-') {
+            off_t suffix;
+            pos = 1;
+            if (!parseRangeNumber(spec, pos, suffix) || pos != spec.size())
+                return false;
+            if (suffix == 0 || size == 0)
+                continue;
+            range.first = suffix < size ? size - suffix : 0;
+            range.last = size - 1;
+        } else {
+            if (!parseRangeNumber(spec, pos, range.first) || pos >= spec.size() || spec[pos++] != '-')
+                return false;
+            range.last = size - 1;
+            if (pos < spec.size()) {
+                off_t last;
+                if (!parseRangeNumber(spec, pos, last) || pos != spec.size() || last < range.first)
+                    return false;
+                if (last < range.last)
+                    range.last = last;
+            }
+            if (range.first >= size)
+                continue;
+        }
+        total += range.last - range.first + 1;
+        if (total > size)
+            return false;
+        ranges.push_back(range);
+    }
+    return count > 0;
+}
+
+// The q-value Accept-Encoding gives coding, directly or through "*"; 0 when
+// the client does not take it
+double acceptQuality(const std::string& acceptEncoding, const std::string& coding) {
+    double wildcard = 0.0;
+    std::stringstream list(acceptEncoding);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        std::string name = item;
+        double q = 1.0;
+        size_t semi = item.find(';');
+        if (semi != std::string::npos) {
+            name = item.substr(0, semi);
+            std::string param = trim(item.substr(semi + 1));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                q = std::strtod(param.c_str() + 2, NULL);
+        }
+        name = toLowerStr(trim(name));
+        if (name == coding)
+            return q;
+        if (name == "*")
+            wildcard = q;
+    }
+    return wildcard;
+}
 
 std::string formatFileSize(off_t size) {
     const char* suffixes[] = { "B", "KB", "MB", "GB", "TB" };
@@ -0,0 +1,234 @@
+#include "LocationMatcher.hpp"
+#include <algorithm>
+#include <cctype>
+#include "CommonExceptions.hpp"
+
+LocationMatcher::Regex::Regex(const std::string &pattern, bool ignoreCase)
+{
+    int flags = REG_EXTENDED | REG_NOSUB | (ignoreCase ? REG_ICASE : 0);
+    if (regcomp(&compiled, pattern.c_str(), flags) != 0)
+        throw CommonExceptions::InvalidValue();
+}
+
+LocationMatcher::Regex::~Regex()
+{
+    regfree(&compiled);
+}
+
+// The longest run of literal bytes every match of an extended regex must
+// contain, "" when none is certain. Conservative: anything inside a group,
+// a bracket expression or an alternation gives up that part, and a
+// quantifier that allows zero takes its atom off the run.
+static std::string requiredLiteral(const std::string &pattern)
+{
+    std::string best;
+    std::string run;
+    int depth = 0;
+    for (size_t i = 0; i < pattern.size(); ++i)
+    {
+        char c = pattern[i];
+        bool literal = false;
+        if (c == '\\' && i + 1 < pattern.size())
+        {
+            c = pattern[++i];
+            literal = !std::isalnum(static_cast<unsigned char>(c)); // \w, \1...: not literal
+        }
+        else if (c == '|')
+            return "";
+        else if (c == '[')
+        {
+            size_t end = i + 1;
+            if (end < pattern.size() && pattern[end] == '^')
+                ++end;
+            if (end < pattern.size() && pattern[end] == ']')
+                ++end;
+            end = pattern.find(']', end);
+            i = end == std::string::npos ? pattern.size() : end;
+        }
+        else if (c == '(')
+            ++depth;
+        else if (c == ')')
+            --depth;
+        else if (c == '*' || c == '?' || c == '{')
+        {
+            if (!run.empty())
+                run.erase(run.size() - 1);
+            if (c == '{')
+            {
+                size_t end = pattern.find('}', i);
+                i = end == std::string::npos ? pattern.size() : end;
+            }
+        }
+        else if (c != '+' && c != '.' && c != '^' && c != '$')
+            literal = true;
+
+        if (literal && depth == 0)
+        {
+            run += c;
+            continue;
+        }
+        if (run.size() > best.size())
+            best = run;
+        run.clear();
+    }
+    return run.size() > best.size() ? run : best;
+}
+
+LocationMatcher::Node::Node() : label(), children(), location(-1), priority(false) {}
+
+LocationMatcher::LocationMatcher()
+    : exact(), nodes(1), regexes(), literals(), literalOwner(), unfiltered() {}
+
+LocationMatcher::~LocationMatcher() {}
+
+// The child whose edge starts with first; 0 (the root, never a child) when
+// there is none
+size_t LocationMatcher::findChild(size_t node, char first) const
+{
+    const std::vector<size_t> &children = nodes[node].children;
+    for (size_t i = 0; i < children.size(); ++i)
+    {
+        if (nodes[children[i]].label[0] == first)
+            return children[i];
+    }
+    return 0;
+}
+
+// The node path ends at, created and splitting an edge where needed
+size_t LocationMatcher::insertPrefix(const std::string &path)
+{
+    size_t node = 0;
+    size_t pos = 0;
+    while (pos < path.size())
+    {
+        size_t child = findChild(node, path[pos]);
+        if (child == 0)
+        {
+            Node leaf;
+            leaf.label = path.substr(pos);
+            nodes.push_back(leaf);
+            nodes[node].children.push_back(nodes.size() - 1);
+            return nodes.size() - 1;
+        }
+
+        size_t common = 0;
+        size_t labelSize = nodes[child].label.size();
+        while (common < labelSize && pos + common < path.size() &&
+               nodes[child].label[common] == path[pos + common])
+            ++common;
+        if (common < labelSize)
+        {
+            // path leaves the edge part way: the shared bytes become a node
+            Node middle;
+            middle.label = nodes[child].label.substr(0, common);
+            middle.children.push_back(child);
+            nodes.push_back(middle);
+            size_t split = nodes.size() - 1;
+            nodes[child].label.erase(0, common);
+            std::vector<size_t> &siblings = nodes[node].children;
+            for (size_t i = 0; i < siblings.size(); ++i)
+            {
+                if (siblings[i] == child)
+                    siblings[i] = split;
+            }
+            child = split;
+        }
+        node = child;
+        pos += common;
+    }
+    return node;
+}
+
+bool LocationMatcher::add(const std::string &path, MatchType type, size_t index)
+{
+    if (type == EXACT)
+        return exact.insert(path, index);
+    if (type == REGEX_CASE || type == REGEX_ICASE)
+    {
+        RegexLocation entry;
+        entry.regex.reset(new Regex(path, type == REGEX_ICASE));
+        entry.location = index;
+        std::string literal = requiredLiteral(path);
+        if (literal.empty())
+            unfiltered.push_back(regexes.size());
+        else
+        {
+            literals.add(literal);
+            literalOwner.push_back(regexes.size());
+        }
+        regexes.push_back(entry);
+        return true;
+    }
+    if (type != PREFIX && type != PRIORITY_PREFIX)
+        return false;
+
+    size_t node = insertPrefix(path);
+    if (nodes[node].location != -1)
+        return false;
+    nodes[node].location = index;
+    nodes[node].priority = type == PRIORITY_PREFIX;
+    return true;
+}
+
+void LocationMatcher::build()
+{
+    literals.build();
+}
+
+long LocationMatcher::longestPrefix(const std::string &path, bool &priority) const
+{
+    long longest = nodes[0].location;
+    priority = nodes[0].priority;
+    size_t node = 0;
+    size_t pos = 0;
+    while (pos < path.size())
+    {
+        size_t child = findChild(node, path[pos]);
+        if (child == 0 || path.compare(pos, nodes[child].label.size(), nodes[child].label) != 0)
+            break;
+        pos += nodes[child].label.size();
+        node = child;
+        if (nodes[node].location != -1)
+        {
+            longest = nodes[node].location;
+            priority = nodes[node].priority;
+        }
+    }
+    return longest;
+}
+
+// Only the regexes whose literal occurs in path, or that have none, can
+// match; they are tried in declaration order
+long LocationMatcher::firstRegex(const std::string &path) const
+{
+    if (regexes.empty())
+        return -1;
+    std::vector<size_t> candidates;
+    literals.scan(path, candidates);
+    for (size_t i = 0; i < candidates.size(); ++i)
+        candidates[i] = literalOwner[candidates[i]];
+    candidates.insert(candidates.end(), unfiltered.begin(), unfiltered.end());
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        const RegexLocation &entry = regexes[candidates[i]];
+        if (regexec(&entry.regex->compiled, path.c_str(), 0, NULL, 0) == 0)
+            return entry.location;
+    }
+    return -1;
+}
+
+long LocationMatcher::match(const std::string &path) const
+{
+    const size_t *exactMatch = exact.find(path);
+    if (exactMatch)
+        return *exactMatch;
+
+    bool priority;
+    long prefix = longestPrefix(path, priority);
+    if (prefix != -1 && priority)
+        return prefix;
+    long regex = firstRegex(path);
+    return regex != -1 ? regex : prefix;
+}
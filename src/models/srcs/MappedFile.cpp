@@ -0,0 +1,49 @@
+#include "MappedFile.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile(const SharedPtr<FileGuard> &file, size_t length)
+    : file(file), data(MAP_FAILED), length(length)
+{
+    if (!file.isValid() || length == 0)
+        return;
+    data = mmap(NULL, length, PROT_READ, MAP_SHARED, file->get(), 0);
+    if (data == MAP_FAILED)
+        return;
+    // Responses read front to back; start paging in before the first send
+    madvise(data, length, MADV_SEQUENTIAL);
+    madvise(data, length, MADV_WILLNEED);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data != MAP_FAILED)
+        munmap(data, length);
+}
+
+bool MappedFile::isValid() const
+{
+    return data != MAP_FAILED;
+}
+
+const char *MappedFile::bytes() const
+{
+    return static_cast<const char *>(data);
+}
+
+size_t MappedFile::size() const
+{
+    return length;
+}
+
+const SharedPtr<FileGuard> &MappedFile::getFile() const
+{
+    return file;
+}
+
+bool MappedFile::covers(size_t end) const
+{
+    struct stat st;
+    return isValid() && end <= length && fstat(file->get(), &st) == 0 &&
+           static_cast<off_t>(end) <= st.st_size;
+}
@@ -0,0 +1,220 @@
+#include "MasterProcess.hpp"
+#include "SocketManager.hpp"
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+MasterProcess::MasterProcess(SocketManager &manager)
+    : manager(manager), signalFd(-1), epfd(-1), generation(0), workers(), respawns(), stopping(false)
+{
+}
+
+MasterProcess::~MasterProcess()
+{
+    if (signalFd != -1)
+        close(signalFd);
+    if (epfd != -1)
+        close(epfd);
+}
+
+size_t MasterProcess::workerCount() const
+{
+    size_t count = manager.getConfig().workerProcesses();
+    return count ? count : 1;
+}
+
+void MasterProcess::spawnWorker()
+{
+    pid_t master = getpid();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        std::cerr << "Master: fork failed: " << strerror(errno) << std::endl;
+        respawns.push_back(time(NULL) + RESPAWN_DELAY);
+        return;
+    }
+    if (pid == 0)
+    {
+        // The signals stay blocked: handleClients() reads the same ones
+        // through its own signalfd, including any sent before it exists.
+        // A worker must not outlive its master.
+        close(signalFd);
+        close(epfd);
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != master)
+            _exit(1);
+        int status = 0;
+        try
+        {
+            manager.handleClients();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Worker " << getpid() << ": " << e.what() << std::endl;
+            status = 1;
+        }
+        std::exit(status);
+    }
+
+    Worker worker;
+    worker.started = time(NULL);
+    worker.generation = generation;
+    workers[pid] = worker;
+}
+
+// A full set of workers on the current config
+void MasterProcess::startGeneration()
+{
+    generation++;
+    respawns.clear();
+    size_t count = workerCount();
+    for (size_t i = 0; i < count; ++i)
+        spawnWorker();
+    std::cout << "Master " << getpid() << ": " << count << " worker(s) started" << std::endl;
+}
+
+void MasterProcess::signalWorkers(int signo, bool oldOnly)
+{
+    for (std::map<pid_t, Worker>::iterator it = workers.begin(); it != workers.end(); ++it)
+    {
+        if (!oldOnly || it->second.generation != generation)
+            kill(it->first, signo);
+    }
+}
+
+// A worker of the current generation that exits on its own is replaced;
+// one that died right after starting only after a delay, so a worker that
+// can't start does not turn into a fork loop
+void MasterProcess::reapWorkers()
+{
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        std::map<pid_t, Worker>::iterator worker = workers.find(pid);
+        if (worker == workers.end())
+            continue; // a new master binary that did not make it
+        bool replace = !stopping && worker->second.generation == generation;
+        time_t now = time(NULL);
+        bool early = now - worker->second.started < RESPAWN_DELAY;
+        workers.erase(worker);
+
+        std::ostream &out = replace ? std::cerr : std::cout;
+        out << "Master: worker " << pid;
+        if (WIFSIGNALED(status))
+            out << " killed by signal " << WTERMSIG(status);
+        else
+            out << " exited with status " << WEXITSTATUS(status);
+        out << (replace ? ", respawning" : "") << std::endl;
+        if (replace)
+            respawns.push_back(early ? now + RESPAWN_DELAY : now);
+    }
+}
+
+void MasterProcess::runRespawns()
+{
+    time_t now = time(NULL);
+    std::vector<time_t> later;
+    for (size_t i = 0; i < respawns.size(); ++i)
+    {
+        if (respawns[i] > now)
+            later.push_back(respawns[i]);
+    }
+    size_t due = respawns.size() - later.size();
+    respawns = later;
+    for (size_t i = 0; i < due && !stopping; ++i)
+        spawnWorker();
+}
+
+void MasterProcess::handleSignals()
+{
+    struct signalfd_siginfo info;
+    while (read(signalFd, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info)))
+    {
+        if (info.ssi_signo == SIGCHLD)
+            reapWorkers();
+        else if (info.ssi_signo == SIGHUP && !stopping)
+        {
+            // Workers keep the config they were forked with, so a reload
+            // is a new generation; the old one finishes what it has
+            if (!manager.reloadConfig(-1))
+                continue;
+            startGeneration();
+            signalWorkers(SIGQUIT, true);
+        }
+        else if (info.ssi_signo == SIGQUIT)
+            stop(SIGQUIT);
+        else if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT)
+            stop(SIGTERM);
+        else if (info.ssi_signo == SIGUSR2 && !stopping)
+            manager.startUpgrade(epfd);
+    }
+}
+
+// Passes a shutdown on; the master itself exits after its last worker
+void MasterProcess::stop(int signo)
+{
+    stopping = true;
+    respawns.clear();
+    manager.closeSocket();
+    signalWorkers(signo, false);
+    std::cout << "Master " << getpid() << ": " << (signo == SIGQUIT ? "draining " : "stopping ")
+              << workers.size() << " worker(s)" << std::endl;
+}
+
+void MasterProcess::run()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGQUIT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR2);
+    if (sigprocmask(SIG_BLOCK, &signals, NULL) == -1)
+        throw std::runtime_error("Failed to block signals");
+    signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    epfd = epoll_create1(EPOLL_DEFAULT);
+    if (signalFd == -1 || epfd == -1)
+        throw std::runtime_error("Failed to set up the master's event loop");
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = signalFd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, signalFd, &event) == -1)
+        throw std::runtime_error("Failed to add signalfd to epoll");
+
+    // A master started by an upgrade reports in before forking, so its
+    // workers never hold the old binary's pipe
+    manager.notifyUpgradeReady();
+    startGeneration();
+
+    struct epoll_event events[8];
+    while (!stopping || !workers.empty())
+    {
+        int n = epoll_wait(epfd, events, 8, 1000);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("epoll_wait failed");
+        }
+        for (int i = 0; i < n; ++i)
+        {
+            if (events[i].data.fd == signalFd)
+                handleSignals();
+            else if (events[i].data.fd == manager.getUpgradeFd() && manager.finishUpgrade(epfd))
+                stop(SIGQUIT);
+        }
+        runRespawns();
+    }
+    std::cout << "Master " << getpid() << ": all workers exited" << std::endl;
+}
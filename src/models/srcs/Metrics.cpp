@@ -0,0 +1,46 @@
+#include "Metrics.hpp"
+
+ServerMetrics::ServerMetrics()
+    : connectionsAccepted(0),
+      requestsHandled(0),
+      cgiStarted(0),
+      cgiCollapsed(0),
+      cgiCacheHits(0),
+      cgiCacheMisses(0),
+      cgiCacheStale(0),
+      contentCacheHits(0),
+      contentCacheMisses(0),
+      contentBytesSaved(0),
+      gzipResponses(0),
+      gzipBytesIn(0),
+      gzipBytesOut(0),
+      abortedRequests(0),
+      abortedCgi(0),
+      configReloads(0)
+{
+}
+
+double ServerMetrics::contentHitRatio() const
+{
+    unsigned long lookups = contentCacheHits + contentCacheMisses;
+    return lookups ? static_cast<double>(contentCacheHits) / lookups : 0.0;
+}
+
+void ServerMetrics::print(std::ostream &out) const
+{
+    out << "connections=" << connectionsAccepted
+        << " requests=" << requestsHandled
+        << " cgi=" << cgiStarted
+        << " cgi_collapsed=" << cgiCollapsed
+        << " cache_hit=" << cgiCacheHits
+        << " cache_miss=" << cgiCacheMisses
+        << " cache_stale=" << cgiCacheStale
+        << " content_hit_ratio=" << contentHitRatio()
+        << " content_bytes_saved=" << contentBytesSaved
+        << " gzip=" << gzipResponses
+        << " gzip_in=" << gzipBytesIn
+        << " gzip_out=" << gzipBytesOut
+        << " aborted=" << abortedRequests
+        << " aborted_cgi=" << abortedCgi
+        << " reloads=" << configReloads;
+}
@@ -0,0 +1,174 @@
+#include "OpenFileCache.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "utils.hpp"
+
+OpenFileInfo::OpenFileInfo() : exists(false), error(0), st(), mimeType() {}
+
+OpenFileCache::OpenFileCache() : entries(), lru(), max(0), inactive(0), valid(0), watched(false) {}
+
+OpenFileCache::~OpenFileCache() {}
+
+void OpenFileCache::configure(size_t max, time_t inactive, time_t valid)
+{
+    this->max = max;
+    this->inactive = inactive;
+    this->valid = valid;
+    while (this->max > 0 && entries.size() > this->max)
+        evict(entries.find(lru.back()));
+}
+
+void OpenFileCache::setWatched(bool watched)
+{
+    this->watched = watched;
+}
+
+// Returns the entry for path, (re)validating it with stat() when it is new
+// or older than `valid` and not watched. A changed file loses its descriptor and index.
+OpenFileCache::Entry &OpenFileCache::fetch(const std::string &path, time_t now)
+{
+    std::map<std::string, Entry>::iterator it = entries.find(path);
+    if (it == entries.end())
+    {
+        if (max > 0 && entries.size() >= max)
+            evict(entries.find(lru.back()));
+        lru.push_front(path);
+        it = entries.insert(std::make_pair(path, Entry())).first;
+        it->second.indexResolved = false;
+        it->second.validated = 0;
+        it->second.lruPos = lru.begin();
+    }
+    else
+        lru.splice(lru.begin(), lru, it->second.lruPos);
+
+    Entry &entry = it->second;
+    entry.lastUsed = now;
+    if (entry.validated != 0 && (watched || now - entry.validated < valid))
+        return entry;
+
+    struct stat st;
+    std::memset(&st, 0, sizeof(st));
+    bool exists = ::stat(path.c_str(), &st) == 0;
+    bool changed = exists != entry.info.exists || st.st_ino != entry.info.st.st_ino ||
+                   st.st_dev != entry.info.st.st_dev || st.st_size != entry.info.st.st_size ||
+                   st.st_mtime != entry.info.st.st_mtime;
+    if (changed)
+    {
+        entry.file.reset();
+        entry.mapping.reset();
+        entry.indexResolved = false;
+        entry.indexPath.clear();
+    }
+    entry.info.exists = exists;
+    entry.info.error = exists ? 0 : errno;
+    entry.info.st = st;
+    if (entry.info.mimeType.empty())
+        entry.info.mimeType = getMimeType(path);
+    entry.validated = now;
+    return entry;
+}
+
+OpenFileInfo OpenFileCache::stat(const std::string &path, time_t now)
+{
+    return fetch(path, now).info;
+}
+
+std::string OpenFileCache::resolveIndex(const std::string &dirPath, const std::vector<std::string> &indexFiles,
+                                        time_t now)
+{
+    Entry &dir = fetch(dirPath, now);
+    if (dir.indexResolved)
+        return dir.indexPath;
+
+    std::string base = dirPath;
+    if (base.empty() || base[base.size() - 1] != '/')
+        base += '/';
+    std::string found;
+    for (size_t i = 0; i < indexFiles.size() && found.empty(); ++i)
+    {
+        if (fetch(base + indexFiles[i], now).info.exists)
+            found = base + indexFiles[i];
+    }
+
+    // Looking up the candidates may have evicted the directory entry
+    std::map<std::string, Entry>::iterator it = entries.find(dirPath);
+    if (it != entries.end())
+    {
+        it->second.indexResolved = true;
+        it->second.indexPath = found;
+    }
+    return found;
+}
+
+SharedPtr<FileGuard> OpenFileCache::open(const std::string &path, time_t now)
+{
+    Entry &entry = fetch(path, now);
+    if (!entry.file.isValid() && entry.info.exists && S_ISREG(entry.info.st.st_mode))
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd != -1)
+            entry.file.reset(new FileGuard(fd));
+    }
+    return entry.file;
+}
+
+SharedPtr<MappedFile> OpenFileCache::map(const std::string &path, time_t now)
+{
+    SharedPtr<FileGuard> file = open(path, now);
+    Entry &entry = fetch(path, now);
+    if (!entry.mapping.isValid() && file.isValid())
+    {
+        SharedPtr<MappedFile> mapping(new MappedFile(file, entry.info.st.st_size));
+        if (mapping->isValid())
+            entry.mapping = mapping;
+    }
+    return entry.mapping;
+}
+
+// Drops entries nobody asked for during the last `inactive` seconds
+void OpenFileCache::expire(time_t now)
+{
+    while (!lru.empty())
+    {
+        std::map<std::string, Entry>::iterator oldest = entries.find(lru.back());
+        if (now - oldest->second.lastUsed < inactive)
+            break;
+        evict(oldest);
+    }
+}
+
+void OpenFileCache::invalidate(const std::string &path)
+{
+    std::map<std::string, Entry>::iterator it = entries.find(path);
+    if (it != entries.end())
+        evict(it);
+
+    // The parent directory's resolved index may name this file
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos)
+    {
+        it = entries.find(path.substr(0, slash + 1));
+        if (it == entries.end())
+            it = entries.find(path.substr(0, slash));
+        if (it != entries.end())
+            evict(it);
+    }
+    // A directory is looked up with and without its trailing slash
+    it = entries.find(path + "/");
+    if (it != entries.end())
+        evict(it);
+}
+
+void OpenFileCache::invalidateAll()
+{
+    entries.clear();
+    lru.clear();
+}
+
+void OpenFileCache::evict(std::map<std::string, Entry>::iterator entry)
+{
+    lru.erase(entry->second.lruPos);
+    entries.erase(entry);
+}
@@ -0,0 +1,131 @@
+#include "PackArchive.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// FNV-1a; shared with the packer, so it must never change for a format
+uint32_t packHash(const char *data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+const char *PackArchive::InvalidPack::what() const throw()
+{
+    return "Invalid or unreadable root_pack archive";
+}
+
+PackArchive::PackArchive(const std::string &path)
+    : mapping(), path(path), dev(0), ino(0), mtime(0), header(NULL), records(NULL), buckets(NULL),
+      strings(NULL)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw InvalidPack();
+    SharedPtr<FileGuard> file(new FileGuard(fd));
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+        static_cast<size_t>(st.st_size) < sizeof(PackHeader))
+        throw InvalidPack();
+    dev = st.st_dev;
+    ino = st.st_ino;
+    mtime = st.st_mtime;
+
+    mapping.reset(new MappedFile(file, st.st_size));
+    if (!mapping->isValid())
+        throw InvalidPack();
+    header = reinterpret_cast<const PackHeader *>(mapping->bytes());
+    records = reinterpret_cast<const PackRecord *>(mapping->bytes() + sizeof(PackHeader));
+    buckets = reinterpret_cast<const uint32_t *>(records + header->entryCount);
+    strings = mapping->bytes() + header->stringsOffset;
+    if (!validate())
+        throw InvalidPack();
+}
+
+PackArchive::~PackArchive() {}
+
+bool PackArchive::validString(const PackString &s) const
+{
+    return s.offset <= header->stringsSize && s.length <= header->stringsSize - s.offset;
+}
+
+// Every offset is checked once here so lookups can trust the archive
+bool PackArchive::validate() const
+{
+    uint64_t size = mapping->size();
+    if (std::memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) != 0)
+        return false;
+    if (header->bucketCount == 0 || (header->bucketCount & (header->bucketCount - 1)) != 0 ||
+        header->bucketCount <= header->entryCount)
+        return false;
+    uint64_t tables = sizeof(PackHeader) + static_cast<uint64_t>(header->entryCount) * sizeof(PackRecord) +
+                      static_cast<uint64_t>(header->bucketCount) * sizeof(uint32_t);
+    if (tables > size || header->stringsOffset < tables || header->stringsOffset > size ||
+        header->stringsSize > size - header->stringsOffset)
+        return false;
+    for (uint32_t i = 0; i < header->bucketCount; ++i)
+    {
+        if (buckets[i] > header->entryCount)
+            return false;
+    }
+    for (uint32_t i = 0; i < header->entryCount; ++i)
+    {
+        const PackRecord &record = records[i];
+        if (!validString(record.path) || !validString(record.mimeType) || !validString(record.etag))
+            return false;
+        if (!(record.variants & (1u << PACK_IDENTITY)))
+            return false;
+        for (int v = 0; v < PACK_VARIANTS; ++v)
+        {
+            if ((record.variants & (1u << v)) &&
+                (record.offset[v] > size || record.length[v] > size - record.offset[v]))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool PackArchive::isReplaced() const
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1)
+        return false; // mid-swap or removed: keep serving what is mapped
+    return st.st_dev != dev || st.st_ino != ino || st.st_mtime != mtime;
+}
+
+const std::string &PackArchive::getPath() const
+{
+    return path;
+}
+
+const SharedPtr<MappedFile> &PackArchive::getMapping() const
+{
+    return mapping;
+}
+
+const PackRecord *PackArchive::find(const std::string &requestPath) const
+{
+    uint32_t mask = header->bucketCount - 1;
+    uint32_t slot = packHash(requestPath.data(), requestPath.size()) & mask;
+    for (uint32_t probes = 0; probes < header->bucketCount; ++probes, slot = (slot + 1) & mask)
+    {
+        if (buckets[slot] == 0)
+            return NULL;
+        const PackRecord &record = records[buckets[slot] - 1];
+        if (record.path.length == requestPath.size() &&
+            std::memcmp(strings + record.path.offset, requestPath.data(), requestPath.size()) == 0)
+            return &record;
+    }
+    return NULL;
+}
+
+std::string PackArchive::getString(const PackString &s) const
+{
+    return std::string(strings + s.offset, s.length);
+}
@@ -109,3 +109,37 @@ int EpollGuard::release() {
 bool EpollGuard::isValid() const {
   return fd >= 0;
 }
+
+// FileGuard implementation
+FileGuard::FileGuard(int file_fd) : fd(file_fd) {}
+
+// Copy assignment operator (private - not meant to be used)
+FileGuard& FileGuard::operator=(const FileGuard& other) {
+  if (this != &other) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    fd = other.fd;
+  }
+  return *this;
+}
+
+FileGuard::~FileGuard() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+int FileGuard::get() const {
+  return fd;
+}
+
+int FileGuard::release() {
+  int temp = fd;
+  fd = -1;
+  return temp;
+}
+
+bool FileGuard::isValid() const {
+  return fd >= 0;
+}
@@ -0,0 +1,170 @@
+#include "SendQueue.hpp"
+#include <cerrno>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Enough for headers plus a body; writev() beyond this is diminishing returns
+#define SEND_QUEUE_IOV 16
+
+SendQueue::SendQueue() : segments() {}
+
+SendQueue::~SendQueue() {}
+
+void SendQueue::clear()
+{
+  segments.clear();
+}
+
+bool SendQueue::empty() const
+{
+  return segments.empty();
+}
+
+size_t SendQueue::size() const
+{
+  size_t total = 0;
+  for (std::deque<Segment>::const_iterator it = segments.begin(); it != segments.end(); ++it)
+    total += it->end - it->offset;
+  return total;
+}
+
+void SendQueue::append(const std::string &data)
+{
+  if (data.empty())
+    return;
+  segments.push_back(Segment());
+  Segment &segment = segments.back();
+  segment.data = data;
+  segment.offset = 0;
+  segment.end = data.size();
+}
+
+void SendQueue::adopt(std::string &data, size_t offset, size_t end)
+{
+  if (end > data.size())
+    end = data.size();
+  if (offset >= end)
+  {
+    std::string().swap(data);
+    return;
+  }
+  segments.push_back(Segment());
+  Segment &segment = segments.back();
+  segment.data.swap(data);
+  segment.offset = offset;
+  segment.end = end;
+}
+
+void SendQueue::appendShared(const SharedPtr<std::string> &buffer, size_t offset, size_t length)
+{
+  if (!buffer.isValid() || offset >= buffer->size() || length == 0)
+    return;
+  if (length > buffer->size() - offset)
+    length = buffer->size() - offset;
+  segments.push_back(Segment());
+  Segment &segment = segments.back();
+  segment.shared = buffer;
+  segment.offset = offset;
+  segment.end = offset + length;
+}
+
+void SendQueue::appendFile(const SharedPtr<FileGuard> &file, off_t offset, size_t length,
+                           const SharedPtr<MappedFile> &mapping)
+{
+  if (!file.isValid() || length == 0)
+    return;
+  segments.push_back(Segment());
+  Segment &segment = segments.back();
+  segment.file = file;
+  if (mapping.isValid() && mapping->isValid())
+    segment.mapping = mapping;
+  segment.offset = offset;
+  segment.end = offset + length;
+}
+
+ssize_t SendQueue::flush(int fd)
+{
+  if (segments.empty())
+    return 0;
+  if (!sendsFromMemory(segments.front()))
+    return flushFile(fd);
+  return flushMemory(fd);
+}
+
+// File segments only go out from their mapping while the file still holds
+// the range: copying from pages past a truncated end would fault. Once it
+// has shrunk the segment falls back to sendfile(), which reports it cleanly.
+bool SendQueue::sendsFromMemory(Segment &segment)
+{
+  if (!segment.file.isValid())
+    return true;
+  if (!segment.mapping.isValid())
+    return false;
+  if (segment.mapping->covers(segment.end))
+    return true;
+  segment.mapping.reset();
+  return false;
+}
+
+// sendfile() cannot be combined with the memory segments in one call, so a
+// file segment is flushed on its own once everything before it is out.
+ssize_t SendQueue::flushFile(int fd)
+{
+  Segment &front = segments.front();
+  off_t offset = front.offset;
+  ssize_t sent = sendfile(fd, front.file->get(), &offset, front.end - front.offset);
+  if (sent == -1)
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  if (sent == 0)
+    return -1; // file shrank underneath us; the promised length can't be met
+  front.offset += sent;
+  if (front.offset >= front.end)
+    segments.pop_front();
+  return sent;
+}
+
+ssize_t SendQueue::flushMemory(int fd)
+{
+  struct iovec iov[SEND_QUEUE_IOV];
+  struct msghdr msg;
+  size_t count = 0;
+  for (std::deque<Segment>::iterator it = segments.begin();
+       it != segments.end() && count < SEND_QUEUE_IOV && sendsFromMemory(*it); ++it, ++count)
+  {
+    const char *bytes;
+    if (it->mapping.isValid())
+      bytes = it->mapping->bytes();
+    else
+      bytes = it->shared.isValid() ? it->shared->data() : it->data.data();
+    iov[count].iov_base = const_cast<char *>(bytes) + it->offset;
+    iov[count].iov_len = it->end - it->offset;
+  }
+
+  msg.msg_name = NULL;
+  msg.msg_namelen = 0;
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+  msg.msg_control = NULL;
+  msg.msg_controllen = 0;
+  msg.msg_flags = 0;
+
+  ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (sent == -1)
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+  size_t remaining = sent;
+  while (remaining > 0 && !segments.empty())
+  {
+    Segment &front = segments.front();
+    size_t available = front.end - front.offset;
+    if (remaining < available)
+    {
+      front.offset += remaining;
+      break;
+    }
+    remaining -= available;
+    segments.pop_front();
+  }
+  return sent;
+}
@@ -95,6 +95,8 @@ const std::vector<std::string>& Server::getIndexFiles() const {
 }
 
 void Server::addLocation(const LocationConfig& location) {
+  this->_locationMatcher.add(location.getPath(), location.getMatchType(),
+                             this->_locations.size());
   this->_locations.push_back(location);
 }
 
@@ -128,20 +130,33 @@ const std::string& Server::getMatchingServerName(const std::string &hostHeader)
 }
 
 const LocationConfig* Server::findLocation(const std::string& path) const {
-  // Find the most specific location that matches the path
-  const LocationConfig* bestMatch = NULL;
-  size_t longestMatch = 0;
-
-  for (std::vector<LocationConfig>::const_iterator it = _locations.begin();
-       it != _locations.end(); ++it) {
-    const std::string& locationPath = it->getPath();
-    if (path.find(locationPath) == 0 && locationPath.length() > longestMatch) {
-      bestMatch = &(*it);
-      longestMatch = locationPath.length();
-    }
+  long index = this->_locationMatcher.match(path);
+  return index < 0 ? NULL : &this->_locations[index];
+}
+
+// Locations take what they did not set from their server here rather than
+// when their block closes, so server directives after a location still apply
+void Server::compile() {
+  std::map<std::string, SharedPtr<std::string> > pages;
+  for (size_t i = 0; i < this->_locations.size(); ++i) {
+    this->_locations[i].inheritCgiFromParent(this->isCgiEnabled());
+    this->_locations[i].inheritCgiPassFromParent(this->getCgiPassMap());
+    this->_locations[i].inheritTuningFromParent(*this);
   }
-
-  return bestMatch;
+  this->_locationMatcher.build();
+  this->_compiled.clear();
+  this->_compiled.reserve(this->_locations.size() + 1);
+  for (size_t i = 0; i < this->_locations.size(); ++i)
+    this->_compiled.push_back(CompiledLocation(*this, &this->_locations[i], pages));
+  this->_compiled.push_back(CompiledLocation(*this, NULL, pages));
+}
+
+const CompiledLocation& Server::getCompiled(const LocationConfig* location) const {
+  if (this->_compiled.size() != this->_locations.size() + 1)
+    throw std::logic_error("Server used before compile()");
+  if (!location)
+    return this->_compiled.back();
+  return this->_compiled[location - &this->_locations[0]];
 }
 
 u_int16_t Server::getServerPort(std::string server) const {
@@ -5,23 +5,34 @@
 #include "HttpRequest.hpp"
 #include "requestContext.hpp"
 #include "ResourceGuards.hpp"
+#include "CgiJob.hpp"
+#include "Container.hpp"
+#include "parser.hpp"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <cstring>
+#include <strings.h>
 #include <cerrno>
 #include <iostream>
 #include <vector>
 #include <sstream>
 #include <string>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <csignal>
 #include <fcntl.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <cstdlib>
 #include <map>
 #include <ctime>
 #include <iomanip>
+#include <climits>
 
 // Helper function to get formatted timestamp
 static std::string getTimestamp()
@@ -44,27 +55,61 @@ static std::string getTimestamp()
 #define COLOR_BOLD "\033[1m"
 #define COLOR_DIM "\033[2m"
 
+static void logResponse(int fd, int statusCode)
+{
+    std::string statusColor = COLOR_GREEN;
+    if (statusCode >= 400)
+        statusColor = COLOR_RED;
+    else if (statusCode >= 300)
+        statusColor = COLOR_YELLOW;
+
+    std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
+              << COLOR_YELLOW << " ← " << COLOR_RESET
+              << "Response To Socket " << COLOR_CYAN << fd << COLOR_RESET
+              << ", Status=" << statusColor << "<" << statusCode << ">" << COLOR_RESET << std::endl;
+}
+
 // the parentheses () mean default construction.
 SocketManager::SocketManager()
     : listeningSockets(),
       requestBuffers(),
       lastActivity(),
       sendBuffers(),
-      serverList(),
+      clientAddresses(),
+      cgiJobs(),
+      cgiPipes(),
+      nextRefreshId(-1),
+      lastPackCheck(0),
+      config(),
+      configFile(),
+      signalFd(-1),
+      draining(false),
+      stopped(false),
+      drainDeadline(0),
+      drainPending(0),
+      commandLine(),
+      upgradePid(-1),
+      upgradeFd(-1),
+      readyFd(-1),
+      metrics(),
       httpParser(new HttpParser()),
       responseBuilder(new HttpResponse())
 {
 }
 
 // Add this setter to initialize the server list
-void SocketManager::setServers(const std::vector<Server> &servers)
-{
-    serverList = servers;
-}
-
 SocketManager::~SocketManager()
 {
+    for (std::map<int, CgiJob *>::iterator it = cgiJobs.begin(); it != cgiJobs.end(); ++it)
+        delete it->second;
+    cgiJobs.clear();
     closeSocket();
+    if (signalFd != -1)
+        close(signalFd);
+    if (upgradeFd != -1)
+        close(upgradeFd);
+    if (readyFd != -1)
+        close(readyFd);
     // httpParser and responseBuilder auto-deleted by std::auto_ptr
 }
 
@@ -75,6 +120,23 @@ std::string initToString(int n)
     return ss.str();
 }
 
+void SocketManager::setServers(const std::vector<Server> &servers)
+{
+    config.reset(new ConfigSnapshot(servers));
+}
+
+void SocketManager::setConfigFile(const std::string &path)
+{
+    configFile = path;
+}
+
+void SocketManager::setCommandLine(char **argv)
+{
+    commandLine.clear();
+    for (size_t i = 0; argv[i]; ++i)
+        commandLine.push_back(argv[i]);
+}
+
 std::vector<ServerSocketInfo> convertServersToSocketInfo(const std::vector<Server> &servers)
 {
     std::vector<ServerSocketInfo> socketInfos;
@@ -100,82 +162,190 @@ std::vector<ServerSocketInfo> convertServersToSocketInfo(const std::vector<Serve
     return socketInfos;
 }
 
+// The listening sockets an upgrade handed over, by "host:port". Anything
+// in the variable that is not a listening socket is ignored.
+static std::map<std::string, int> inheritedSockets()
+{
+    std::map<std::string, int> inherited;
+    const char *listenFds = getenv(LISTEN_FDS_ENV);
+    if (!listenFds)
+        return inherited;
+    std::vector<std::string> entries = split(listenFds, ';');
+    unsetenv(LISTEN_FDS_ENV);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        size_t equals = entries[i].rfind('=');
+        if (equals == std::string::npos)
+            continue;
+        int fd = atoi(entries[i].c_str() + equals + 1);
+        int listening = 0;
+        socklen_t length = sizeof(listening);
+        if (fd > 2 && getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &length) == 0 && listening)
+            inherited[entries[i].substr(0, equals)] = fd;
+    }
+    return inherited;
+}
+
+// Binds every listen address, or adopts the socket a previous binary passed
+// down for it so the address never stops accepting
 bool SocketManager::initSockets(const std::vector<ServerSocketInfo> &servers)
 {
-    std::map<std::string, int> existingSockets;
+    std::map<std::string, int> inherited = inheritedSockets();
+    const char *ready = getenv(UPGRADE_READY_ENV);
+    if (ready)
+    {
+        readyFd = atoi(ready);
+        fcntl(readyFd, F_SETFD, FD_CLOEXEC);
+        unsetenv(UPGRADE_READY_ENV);
+    }
 
     for (size_t i = 0; i < servers.size(); ++i)
     {
         const ServerSocketInfo &server = servers[i];
         std::string key = server.host + ":" + server.port;
 
-        if (existingSockets.count(key))
+        if (listenAddresses.count(key))
         {
             std::cout << "Reusing existing socket for " << key
-                      << " (fd=" << existingSockets[key] << ")" << std::endl;
+                      << " (fd=" << listenAddresses[key] << ")" << std::endl;
             continue;
         }
 
-        struct addrinfo hints;
-        struct addrinfo *res = NULL;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_STREAM;
-        hints.ai_flags = AI_PASSIVE;
-
-        const char *bindHost;
-        if (server.host.empty())
-            bindHost = "0.0.0.0";
+        int listen_fd;
+        std::map<std::string, int>::iterator adopted = inherited.find(key);
+        if (adopted != inherited.end())
+        {
+            listen_fd = adopted->second;
+            inherited.erase(adopted);
+            std::cout << "Adopting inherited socket for " << key << " (fd=" << listen_fd << ")" << std::endl;
+        }
         else
-            bindHost = server.host.c_str();
-
-        if (getaddrinfo(bindHost, server.port.c_str(), &hints, &res) != 0)
+            listen_fd = openListener(server.host, server.port);
+        if (listen_fd == -1)
         {
-            std::cerr << "getaddrinfo failed for " << key << std::endl;
-            closeSocket();
+            // An upgrade that cannot cover every address fails before it
+            // reports ready, so the old binary keeps serving all of them;
+            // otherwise only this address is skipped
+            if (readyFd != -1)
+                return false;
             continue;
         }
 
-        int listen_fd = -1;
-        struct addrinfo *p;
-        for (p = res; p != NULL; p = p->ai_next)
-        {
-            SocketGuard socketGuard(socket(p->ai_family, p->ai_socktype, p->ai_protocol));
-            if (!socketGuard.isValid())
-                continue;
+        listeningSockets.push_back(listen_fd);
+        listenAddresses[key] = listen_fd;
+    }
+    // Addresses the new config no longer listens on
+    for (std::map<std::string, int>::iterator it = inherited.begin(); it != inherited.end(); ++it)
+        close(it->second);
+    if (listeningSockets.empty())
+        return false;
+    return true;
+}
 
-            int opt = 1;
-            setsockopt(socketGuard.get(), SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// A bound, listening socket for host:port, or -1
+int SocketManager::openListener(const std::string &host, const std::string &port)
+{
+    std::string key = host + ":" + port;
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    const char *bindHost;
+    if (host.empty())
+        bindHost = "0.0.0.0";
+    else
+        bindHost = host.c_str();
+
+    if (getaddrinfo(bindHost, port.c_str(), &hints, &res) != 0)
+    {
+        std::cerr << "getaddrinfo failed for " << key << std::endl;
+        return -1;
+    }
+
+    int listen_fd = -1;
+    struct addrinfo *p;
+    for (p = res; p != NULL; p = p->ai_next)
+    {
+        SocketGuard socketGuard(socket(p->ai_family, p->ai_socktype, p->ai_protocol));
+        if (!socketGuard.isValid())
+            continue;
+
+        int opt = 1;
+        setsockopt(socketGuard.get(), SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 
-            if (bind(socketGuard.get(), p->ai_addr, p->ai_addrlen) == 0)
+        if (bind(socketGuard.get(), p->ai_addr, p->ai_addrlen) == 0)
+        {
+            if (listen(socketGuard.get(), 10) == -1)
             {
-                if (listen(socketGuard.get(), 10) == -1)
-                {
-                    std::cerr << "listen failed for " << key << std::endl;
-                    // SocketGuard auto-closes on continue
-                }
-                else
-                {
-                    listen_fd = socketGuard.release(); // Success - transfer ownership
-                    break;
-                }
+                std::cerr << "listen failed for " << key << std::endl;
+                // SocketGuard auto-closes on continue
+            }
+            else
+            {
+                listen_fd = socketGuard.release(); // Success - transfer ownership
+                break;
             }
-            // SocketGuard auto-closes on loop iteration if bind failed
         }
-        freeaddrinfo(res);
+        // SocketGuard auto-closes on loop iteration if bind failed
+    }
+    freeaddrinfo(res);
 
-        if (listen_fd == -1)
+    if (listen_fd == -1)
+        std::cerr << "Failed to bind any address for " << key << std::endl;
+    return listen_fd;
+}
+
+// Moves the listening set to what a reloaded config asks for. Addresses in
+// both keep their socket, so connections waiting in its backlog are not
+// lost; new ones are bound before anything is closed, and if one of them
+// can't be, nothing changes.
+bool SocketManager::updateListeners(const std::vector<ServerSocketInfo> &servers, int epfd)
+{
+    std::map<std::string, int> wanted;
+    std::vector<int> opened;
+    for (size_t i = 0; i < servers.size(); ++i)
+    {
+        std::string key = servers[i].host + ":" + servers[i].port;
+        if (wanted.count(key))
+            continue;
+        std::map<std::string, int>::const_iterator current = listenAddresses.find(key);
+        if (current != listenAddresses.end())
         {
-            std::cerr << "Failed to bind any address for " << key << std::endl;
-            closeSocket();
+            wanted[key] = current->second;
             continue;
         }
 
-        listeningSockets.push_back(listen_fd);
-        existingSockets[key] = listen_fd;
+        SocketGuard listener(openListener(servers[i].host, servers[i].port));
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = listener.get();
+        if (!listener.isValid() || (epfd != -1 && epoll_ctl(epfd, EPOLL_CTL_ADD, listener.get(), &event) == -1))
+        {
+            for (size_t j = 0; j < opened.size(); ++j)
+                close(opened[j]); // also leaves the epoll set
+            return false;
+        }
+        opened.push_back(listener.get());
+        wanted[key] = listener.release();
+        std::cout << "Listening on " << key << std::endl;
     }
-    if (listeningSockets.empty())
-        return false;
+
+    for (std::map<std::string, int>::iterator it = listenAddresses.begin(); it != listenAddresses.end(); ++it)
+    {
+        if (wanted.count(it->first))
+            continue;
+        if (epfd != -1)
+            epoll_ctl(epfd, EPOLL_CTL_DEL, it->second, 0);
+        close(it->second);
+        std::cout << "No longer listening on " << it->first << std::endl;
+    }
+    listenAddresses = wanted;
+    listeningSockets.clear();
+    for (std::map<std::string, int>::iterator it = listenAddresses.begin(); it != listenAddresses.end(); ++it)
+        listeningSockets.push_back(it->second);
     return true;
 }
 
@@ -194,6 +364,7 @@ void SocketManager::closeSocket()
         }
     }
     listeningSockets.clear();
+    listenAddresses.clear();
 }
 
 bool SocketManager::isServerSocket(int fd) const
@@ -224,8 +395,22 @@ void SocketManager::acceptNewClient(int readyServerFd, int epfd)
     // Store the client address for this specific connection
     clientAddresses[connectionGuard.get()] = tempClientAddr;
 
+    // The address the client reached decides which servers can answer it;
+    // it is kept so a reload can look the table up again
+    sockaddr_in localAddr;
+    socklen_t localLen = sizeof(localAddr);
+    clientHosts.erase(connectionGuard.get());
+    localAddresses.erase(connectionGuard.get());
+    if (getsockname(connectionGuard.get(), (sockaddr *)&localAddr, &localLen) == 0)
+    {
+        localAddresses[connectionGuard.get()] = localAddr;
+        const VirtualHosts *hosts = config->hostsFor(localAddr);
+        if (hosts)
+            clientHosts[connectionGuard.get()] = hosts;
+    }
+
     struct epoll_event ev;
-    ev.events = EPOLLIN | EPOLLOUT;
+    ev.events = CLIENT_EPOLL_EVENTS;
     ev.data.fd = connectionGuard.get();
 
     if (epoll_ctl(epfd, EPOLL_CTL_ADD, connectionGuard.get(), &ev) == -1)
@@ -237,6 +422,7 @@ void SocketManager::acceptNewClient(int readyServerFd, int epfd)
               << "New Connection: Socket " << COLOR_CYAN << connectionGuard.get() << COLOR_RESET
               << " connected." << std::endl;
     connectionGuard.release(); // Success - epoll now manages the FD
+    metrics.connectionsAccepted++;
 }
 
 // Checks
@@ -330,7 +516,7 @@ bool SocketManager::isBodyTooLarge(int fd)
         iss >> content_length;
     }
 
-    if (content_length > MAX_BODY_SIZE)
+    if (content_length > bodyLimitForRequest(fd, headers))
         return true;
 
     // Check if body already received exceeds content_length or MAX_BODY_SIZE
@@ -341,6 +527,46 @@ bool SocketManager::isBodyTooLarge(int fd)
     return false;
 }
 
+// The Host header of a raw request, "" when it has none
+static std::string requestHost(const std::string &rawRequest)
+{
+    size_t pos = rawRequest.find("\r\n");
+    while (pos != std::string::npos && pos + 2 < rawRequest.size())
+    {
+        size_t start = pos + 2;
+        pos = rawRequest.find("\r\n", start);
+        if (pos == start)
+            break;
+        if (rawRequest.size() - start > 5 && strncasecmp(rawRequest.c_str() + start, "host:", 5) == 0)
+            return trim(rawRequest.substr(start + 5, pos == std::string::npos ? std::string::npos : pos - start - 5));
+    }
+    return "";
+}
+
+// Bodies bound for CGI are streamed into the script rather than buffered, so
+// they are only limited by client_max_body_size. Everything else still has to
+// fit in the request buffer.
+size_t SocketManager::bodyLimitForRequest(int fd, const std::string &headers)
+{
+    std::istringstream lineStream(headers.substr(0, headers.find("\r\n")));
+    std::string method, target;
+    lineStream >> method >> target;
+
+    std::string cleanPath;
+    std::map<std::string, std::string> query;
+    HttpRequest::parseQuery(target, cleanPath, query);
+
+    Server &server = selectServerForClient(fd, requestHost(headers));
+    const LocationConfig *location = server.findLocation(cleanPath);
+    if (!location || !location->isCgiEnabled())
+        return MAX_BODY_SIZE;
+
+    size_t limit = RequestContext(server, location).getClientMaxBodySize();
+    if (limit == 0)
+        return static_cast<size_t>(-1);
+    return limit;
+}
+
 bool SocketManager::hasInvalidPercentEncoding(int fd)
 {
     size_t line_end = requestBuffers[fd].find("\r\n");
@@ -375,15 +601,12 @@ void SocketManager::sendHttpError(int fd, const std::string &status, int epfd)
     RequestContext ctx(server, NULL);
 
     std::string body;
+    const std::string *page = ctx.getErrorPage(code);
 
-    try
+    if (page)
+        body = *page;
+    else
     {
-        body = ctx.getErrorPageContent(code);
-    }
-    catch (const std::exception &e)
-    {
-        std::cerr << "Error while loading error page: " << e.what() << std::endl;
-
         std::ostringstream fallback;
         fallback << "<html><body><h1>Error " << code << "</h1></body></html>";
         body = fallback.str();
@@ -396,39 +619,23 @@ void SocketManager::sendHttpError(int fd, const std::string &status, int epfd)
         << "Connection: close\r\n\r\n"
         << body;
 
-    sendBuffers[fd] = res.str();
+    sendBuffers[fd].clear();
+    sendBuffers[fd].append(res.str());
 
     struct epoll_event ev;
-    ev.events = EPOLLIN | EPOLLOUT;
+    ev.events = RESPONSE_EPOLL_EVENTS;
     ev.data.fd = fd;
     epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
 }
 
-Server &SocketManager::selectServerForClient(int clientFd)
+// The server for host on the address the client connected to, resolved
+// through the table picked at accept; without a host, that address's default
+Server &SocketManager::selectServerForClient(int clientFd, const std::string &host)
 {
-
-    struct sockaddr_in serverAddr;
-    socklen_t addrlen = sizeof(serverAddr);
-    if (getsockname(clientFd, (struct sockaddr *)&serverAddr, &addrlen) == -1)
-    {
-        return serverList[0];
-    }
-    std::string serverIP = inet_ntoa(serverAddr.sin_addr);
-    u_int16_t serverPort = ntohs(serverAddr.sin_port);
-
-    for (size_t i = 0; i < serverList.size(); ++i)
-    {
-        const std::vector<ListenCtx> &listens = serverList[i].getListens();
-        for (size_t j = 0; j < listens.size(); ++j)
-        {
-            if (listens[j].port == serverPort &&
-                (listens[j].addr == "0.0.0.0" || listens[j].addr == serverIP))
-            {
-                return serverList[i];
-            }
-        }
-    }
-    return serverList[0];
+    std::map<int, const VirtualHosts *>::const_iterator hosts = clientHosts.find(clientFd);
+    if (hosts == clientHosts.end())
+        return config->servers[0];
+    return config->servers[hosts->second->find(host)];
 }
 
 // dummy full until omran finishes the parsing
@@ -463,6 +670,10 @@ HttpRequest *SocketManager::fillRequest(const std::string &rawRequest, Server &s
 
     // Create RequestContext with server and location
     RequestContext ctx(server, location);
+    ctx.openFileCache = openFileCacheFor(ctx.getBlock(), ctx.rootDir);
+    ctx.contentCache = contentCacheFor(ctx.getBlock());
+    if (!ctx.compiled.rootPack.empty())
+        ctx.pack = packs[ctx.compiled.rootPack].get();
 
     // Create appropriate HttpRequest subclass
     HttpRequest *request = makeRequestByMethod(method, ctx);
@@ -488,15 +699,11 @@ HttpRequest *SocketManager::fillRequest(const std::string &rawRequest, Server &s
             request->addHeader(key, value);
     }
 
-    // Parse the body (if present)
-    std::string body, chunk;
-    while (std::getline(stream, chunk))
-    {
-        if (!chunk.empty() && chunk[chunk.size() - 1] == '\r')
-            chunk.erase(chunk.size() - 1);
-        body += chunk;
-        body += "\n";
-    }
+    // The body is whatever follows the blank line, byte for byte
+    std::string body;
+    size_t headerEnd = rawRequest.find("\r\n\r\n");
+    if (headerEnd != std::string::npos)
+        body = rawRequest.substr(headerEnd + 4);
 
     if (!body.empty())
     {
@@ -539,7 +746,9 @@ HttpRequest *SocketManager::fillRequest(const std::string &rawRequest, Server &s
                     unchunkedBody.append(body.substr(pos, chunkSize));
                     pos += chunkSize;
 
-                    // Skip trailing newline after chunk data
+                    // Skip the CRLF that terminates the chunk data
+                    if (pos < body.length() && body[pos] == '\r')
+                        pos++;
                     if (pos < body.length() && body[pos] == '\n')
                         pos++;
                 }
@@ -560,9 +769,132 @@ HttpRequest *SocketManager::fillRequest(const std::string &rawRequest, Server &s
     return request;
 }
 
+// The block's open_file_cache, or NULL when the directive is off for it
+OpenFileCache *SocketManager::openFileCacheFor(const BaseBlock &block, const std::string &rootDir)
+{
+    if (block.getOpenFileCacheMax() == 0)
+        return NULL;
+    OpenFileCache &cache = config->openFileCaches[&block];
+    cache.configure(block.getOpenFileCacheMax(), block.getOpenFileCacheInactive(),
+                    block.getOpenFileCacheValid());
+    cache.setWatched(docrootWatcher.covers(rootDir));
+    return &cache;
+}
+
+// Watches the root of every server and location that sets one
+void SocketManager::watchDocroots(int epfd)
+{
+    if (!docrootWatcher.start(config->docroots()))
+        return;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = docrootWatcher.getFd();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, docrootWatcher.getFd(), &event) == -1)
+        std::cerr << "Docroot watcher: " << strerror(errno) << std::endl;
+}
+
+// Maps every root_pack archive the servers use into loaded, sharing the
+// ones already open; a missing or broken one throws
+void SocketManager::loadPacks(const std::vector<Server> &servers,
+                              std::map<std::string, SharedPtr<PackArchive> > &loaded) const
+{
+    for (size_t i = 0; i < servers.size(); ++i)
+    {
+        std::vector<const BaseBlock *> blocks(1, &servers[i]);
+        const std::vector<LocationConfig> &locations = servers[i].getLocations();
+        for (size_t j = 0; j < locations.size(); ++j)
+            blocks.push_back(&locations[j]);
+        for (size_t j = 0; j < blocks.size(); ++j)
+        {
+            const std::string &archive = blocks[j]->getRootPack();
+            if (archive.empty() || loaded.count(archive))
+                continue;
+            std::map<std::string, SharedPtr<PackArchive> >::const_iterator open = packs.find(archive);
+            if (open != packs.end())
+            {
+                loaded[archive] = open->second;
+                continue;
+            }
+            try
+            {
+                loaded[archive].reset(new PackArchive(archive));
+            }
+            catch (const PackArchive::InvalidPack &e)
+            {
+                throw std::runtime_error(std::string(e.what()) + ": " + archive);
+            }
+        }
+    }
+}
+
+// Picks up archives swapped in by a deploy, checking at most once per
+// PACK_CHECK_INTERVAL. Responses still being sent keep the old mapping; a
+// broken replacement is ignored until its mtime changes again.
+void SocketManager::refreshPacks(time_t now)
+{
+    if (now - lastPackCheck < PACK_CHECK_INTERVAL)
+        return;
+    lastPackCheck = now;
+    for (std::map<std::string, SharedPtr<PackArchive> >::iterator it = packs.begin(); it != packs.end(); ++it)
+    {
+        struct stat st;
+        if (!it->second->isReplaced() || stat(it->first.c_str(), &st) == -1)
+            continue;
+        std::map<std::string, time_t>::iterator rejected = rejectedPacks.find(it->first);
+        if (rejected != rejectedPacks.end() && rejected->second == st.st_mtime)
+            continue;
+        try
+        {
+            it->second.reset(new PackArchive(it->first));
+            rejectedPacks.erase(it->first);
+        }
+        catch (const PackArchive::InvalidPack &e)
+        {
+            std::cerr << e.what() << ": " << it->first << std::endl;
+            rejectedPacks[it->first] = st.st_mtime;
+        }
+    }
+}
+
+// Hands what changed on disk to every file cache
+void SocketManager::applyDocrootChanges()
+{
+    DocrootChanges changes;
+    docrootWatcher.readEvents(changes);
+
+    for (std::map<const BaseBlock *, OpenFileCache>::iterator it = config->openFileCaches.begin();
+         it != config->openFileCaches.end(); ++it)
+    {
+        if (changes.all)
+            it->second.invalidateAll();
+        for (size_t i = 0; !changes.all && i < changes.paths.size(); ++i)
+            it->second.invalidate(changes.paths[i]);
+    }
+    for (std::map<const BaseBlock *, ContentCache>::iterator it = config->contentCaches.begin();
+         it != config->contentCaches.end(); ++it)
+    {
+        if (changes.all)
+            it->second.invalidateAll();
+        for (size_t i = 0; !changes.all && i < changes.paths.size(); ++i)
+            it->second.invalidate(changes.paths[i]);
+    }
+}
+
+// The block's content_cache, or NULL when the directive is off for it
+ContentCache *SocketManager::contentCacheFor(const BaseBlock &block)
+{
+    if (block.getContentCacheSize() == 0)
+        return NULL;
+    ContentCache &cache = config->contentCaches[&block];
+    cache.configure(block.getContentCacheSize(), block.getContentCacheMaxFile(), &metrics);
+    return &cache;
+}
+
 void SocketManager::processFullRequest(int readyServerFd, int epfd, const std::string &rawRequest, sockaddr_in &clientAddr)
 {
-    Server &myServer = selectServerForClient(readyServerFd);
+    requestHosts[readyServerFd] = requestHost(rawRequest);
+    Server &myServer = selectServerForClient(readyServerFd, requestHosts[readyServerFd]);
 
     RequestGuard request(fillRequest(rawRequest, myServer));
     if (!request.isValid())
@@ -572,10 +904,7 @@ void SocketManager::processFullRequest(int readyServerFd, int epfd, const std::s
                   << "Request From Socket " << COLOR_CYAN << readyServerFd << COLOR_RESET
                   << ", Method=" << COLOR_RED << "<INVALID>" << COLOR_RESET
                   << "  URI=" << COLOR_RED << "<MALFORMED>" << COLOR_RESET << std::endl;
-        std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
-                  << COLOR_YELLOW << " ← " << COLOR_RESET
-                  << "Response To Socket " << COLOR_CYAN << readyServerFd << COLOR_RESET
-                  << ", Status=" << COLOR_RED << "<400>" << COLOR_RESET << std::endl;
+        logResponse(readyServerFd, 400);
         sendHttpError(readyServerFd, "400 Bad Request", epfd);
         requestBuffers[readyServerFd].clear();
         return;
@@ -589,32 +918,200 @@ void SocketManager::processFullRequest(int readyServerFd, int epfd, const std::s
               << "  URI=" << COLOR_BOLD << "<" << request->getPath() << ">" << COLOR_RESET << std::endl;
 
     HttpResponse res;
-    request->handle(res, clientAddr, epfd);
-    res.setVersion("HTTP/1.0");
+    metrics.requestsHandled++;
+    noteGzipClient(readyServerFd, *request.get());
 
-    // Log the response with color based on status code
-    int statusCode = res.getStatusCode();
-    std::string statusColor = COLOR_GREEN;
-    if (statusCode >= 400)
-        statusColor = COLOR_RED;
-    else if (statusCode >= 300)
-        statusColor = COLOR_YELLOW;
+    std::string cacheKey;
+    const BaseBlock *cacheBlock = NULL;
+    if (serveFromCache(readyServerFd, epfd, *request.get(), clientAddr, cacheKey, cacheBlock))
+    {
+        requestBuffers[readyServerFd].clear();
+        return;
+    }
 
-    std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
-              << COLOR_YELLOW << " ← " << COLOR_RESET
-              << "Response To Socket " << COLOR_CYAN << readyServerFd << COLOR_RESET
-              << ", Status=" << statusColor << "<" << statusCode << ">" << COLOR_RESET << std::endl;
+    // An identical CGI request is already running: wait for its response
+    // instead of starting the script again
+    std::string collapseKey;
+    bool collapsible = CgiCollapser::makeKey(*request.get(), collapseKey);
+    if (collapsible)
+    {
+        int owner = cgiCollapser.findOwner(collapseKey);
+        if (owner != -1)
+        {
+            metrics.cgiCollapsed++;
+            cgiCollapser.addWaiter(owner, readyServerFd);
+            requestBuffers[readyServerFd].clear();
+            return;
+        }
+    }
 
-    sendBuffers[readyServerFd] = res.build();
+    request->handle(res, clientAddr, epfd);
 
-    struct epoll_event ev;
-    ev.events = EPOLLIN | EPOLLOUT;
-    ev.data.fd = readyServerFd;
-    epoll_ctl(epfd, EPOLL_CTL_MOD, readyServerFd, &ev);
+    CgiJob *job = request->releaseCgiJob();
+    if (job)
+    {
+        metrics.cgiStarted++;
+        if (collapsible)
+            cgiCollapser.addOwner(readyServerFd, collapseKey);
+        if (cacheBlock)
+            cacheFills[readyServerFd] = std::make_pair(cacheBlock, cacheKey);
+        // The response is sent once the script finishes
+        startCgiJob(readyServerFd, job, *request.get());
+        requestBuffers[readyServerFd].clear();
+        return;
+    }
 
+    // A content_cache head has them already
+    res.setRenderedHeaders(request->getContext().compiled.getResponseHeaders(res.getStatusCode()));
+    // Generated bodies only; static files are left to gzip_static
+    if (!res.hasBodyFile() && !res.hasSharedContent())
+        compressResponse(readyServerFd, res);
+    queueResponse(readyServerFd, epfd, res, false);
     requestBuffers[readyServerFd].clear();
 }
 
+// Remembers whether gzip applies to this client's response: the block has it
+// on and the request's Accept-Encoding takes it
+void SocketManager::noteGzipClient(int clientFd, const HttpRequest &request)
+{
+    const CompiledLocation &block = request.getContext().compiled;
+    const std::map<std::string, std::string> &headers = request.getHeaders();
+    std::map<std::string, std::string>::const_iterator accept = headers.find("accept-encoding");
+    if (block.gzip && accept != headers.end() && GzipFilter::accepts(accept->second))
+        gzipClients[clientFd] = &block;
+    else
+        gzipClients.erase(clientFd);
+}
+
+bool SocketManager::compressResponse(int clientFd, HttpResponse &res)
+{
+    std::map<int, const CompiledLocation *>::iterator client = gzipClients.find(clientFd);
+    size_t bytesIn = 0;
+    size_t bytesOut = 0;
+    if (client == gzipClients.end() || !GzipFilter::compress(res, *client->second, gzipPool, bytesIn, bytesOut))
+        return false;
+    metrics.gzipResponses++;
+    metrics.gzipBytesIn += bytesIn;
+    metrics.gzipBytesOut += bytesOut;
+    return true;
+}
+
+// Answers a cacheable CGI request from its block's cgi_cache when possible.
+// A stale entry is still served, and one background run refreshes it. On a
+// miss, cacheBlock and cacheKey tell the caller where the new response
+// belongs.
+bool SocketManager::serveFromCache(int clientFd, int epfd, HttpRequest &request, sockaddr_in &clientAddr,
+                                   std::string &cacheKey, const BaseBlock *&cacheBlock)
+{
+    cacheBlock = NULL;
+    if (!CgiCache::makeKey(request, cacheKey))
+        return false;
+
+    cacheBlock = &request.getContext().getBlock();
+    CgiCache *cache = &config->cgiCaches[cacheBlock];
+    cache->setLimit(cacheBlock->getCgiCacheSize());
+
+    CgiCache::Status status;
+    HttpResponse *cached = cache->lookup(cacheKey, time(NULL), status);
+    if (!cached)
+    {
+        metrics.cgiCacheMisses++;
+        return false;
+    }
+
+    if (status == CgiCache::HIT)
+        metrics.cgiCacheHits++;
+    else
+        metrics.cgiCacheStale++;
+    cached->setHeader("X-Cache-Status", status == CgiCache::HIT ? "HIT" : "STALE");
+    // The cache holds the identity body; each client gets its own encoding,
+    // so the entry is only copied when gzip is actually going to run on it
+    std::map<int, const CompiledLocation *>::iterator gzipClient = gzipClients.find(clientFd);
+    bool queued = false;
+    if (gzipClient != gzipClients.end() && GzipFilter::applies(*cached, *gzipClient->second))
+    {
+        HttpResponse encoded(*cached);
+        queued = compressResponse(clientFd, encoded);
+        if (queued)
+            queueResponse(clientFd, epfd, encoded, false);
+    }
+    if (!queued)
+        queueResponse(clientFd, epfd, *cached, true);
+
+    if (status == CgiCache::STALE && cache->beginRefresh(cacheKey))
+        startCacheRefresh(request, clientAddr, epfd, cacheBlock, cacheKey);
+    return true;
+}
+
+// Runs the script for nobody in particular; its response only updates the
+// cache entry. The job is filed under a negative id so that it goes through
+// the same pipe and timeout handling as client jobs.
+void SocketManager::startCacheRefresh(HttpRequest &request, sockaddr_in &clientAddr, int epfd,
+                                      const BaseBlock *cacheBlock, const std::string &key)
+{
+    HttpResponse ignored;
+    request.handle(ignored, clientAddr, epfd);
+    CgiJob *job = request.releaseCgiJob();
+    if (!job)
+    {
+        config->cgiCaches[cacheBlock].endRefresh(key);
+        return;
+    }
+
+    int refreshId = nextRefreshId;
+    nextRefreshId = nextRefreshId == INT_MIN ? -1 : nextRefreshId - 1;
+    metrics.cgiStarted++;
+    cacheFills[refreshId] = std::make_pair(cacheBlock, key);
+    startCgiJob(refreshId, job, request);
+}
+
+// Stores a finished CGI response if its request was waiting to fill the
+// cache. A failed refresh leaves the stale entry in place; a response the
+// script marks as uncacheable drops it. snapshot is the one the job ran
+// under, which the cache block belongs to.
+void SocketManager::fillCache(int clientFd, ConfigSnapshot &snapshot, HttpResponse &res,
+                              const std::string &redirect)
+{
+    std::map<int, std::pair<const BaseBlock *, std::string> >::iterator fill = cacheFills.find(clientFd);
+    if (fill == cacheFills.end())
+        return;
+    const BaseBlock *block = fill->second.first;
+    std::string key = fill->second.second;
+    cacheFills.erase(fill);
+    CgiCache &cache = snapshot.cgiCaches[block];
+    cache.endRefresh(key);
+
+    if (!redirect.empty() || res.getStatusCode() >= 500)
+        return;
+    res.setHeader("X-Cache-Status", "MISS");
+
+    time_t now = time(NULL);
+    time_t ttl = 0;
+    if (CgiCache::freshnessOf(res, block->getCgiCacheValid(), now, ttl))
+        cache.store(key, res, ttl, now);
+    else
+        cache.remove(key);
+}
+
+// Hands a finished response to the connection's send queue. A shared
+// response is copied so it can be delivered to several clients.
+void SocketManager::queueResponse(int clientFd, int epfd, HttpResponse &res, bool shared)
+{
+    res.setVersion("HTTP/1.0");
+    logResponse(clientFd, res.getStatusCode());
+
+    sendBuffers[clientFd].clear();
+    if (shared)
+        res.copyInto(sendBuffers[clientFd]);
+    else
+        res.moveInto(sendBuffers[clientFd]);
+
+    struct epoll_event ev;
+    ev.events = RESPONSE_EPOLL_EVENTS;
+    ev.data.fd = clientFd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, clientFd, &ev);
+}
+
 bool SocketManager::isRequestMalformed(int fd)
 {
     return isRequestLineMalformed(fd) || hasNonPrintableCharacters(fd) || hasInvalidPercentEncoding(fd);
@@ -647,21 +1144,29 @@ void SocketManager::handleRequest(int readyServerFd, int epfd)
 {
     char buf[4096];
 
+    std::map<int, CgiJob *>::iterator job = cgiJobs.find(readyServerFd);
+    if (job != cgiJobs.end() && job->second->wantsSocketBody())
+    {
+        // The rest of the body goes straight from the socket to the script
+        lastActivity[readyServerFd] = time(NULL);
+        job->second->onSocketReadable();
+        untrackCgiPipes(readyServerFd);
+        trackCgiPipes(readyServerFd);
+        return;
+    }
+
     ssize_t n = recv(readyServerFd, buf, sizeof(buf), 0);
     if (n <= 0)
     {
-        close(readyServerFd);
-        epoll_ctl(epfd, EPOLL_CTL_DEL, readyServerFd, 0);
-        requestBuffers.erase(readyServerFd);
-        lastActivity.erase(readyServerFd);
-        clientAddresses.erase(readyServerFd);
-        std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
-                  << COLOR_RED << " ✗ " << COLOR_RESET
-                  << "Client " << COLOR_CYAN << readyServerFd << COLOR_RESET
-                  << ": Connection Closed." << std::endl;
+        abortConnection(readyServerFd, epfd);
         return;
     }
 
+    // Anything sent past the body of a request already being served is dropped
+    if (job != cgiJobs.end() || sendBuffers.count(readyServerFd) ||
+        cgiCollapser.isWaiting(readyServerFd))
+        return;
+
     lastActivity[readyServerFd] = time(NULL);
     requestBuffers[readyServerFd].append(buf, n);
 
@@ -691,6 +1196,22 @@ void SocketManager::handleRequest(int readyServerFd, int epfd)
 void SocketManager::handleTimeouts(int epfd)
 {
     time_t now = time(NULL);
+
+    std::vector<int> expiredJobs;
+    for (std::map<int, CgiJob *>::iterator jt = cgiJobs.begin(); jt != cgiJobs.end(); ++jt)
+    {
+        if (jt->second->hasTimedOut(now))
+            expiredJobs.push_back(jt->first);
+    }
+    for (size_t i = 0; i < expiredJobs.size(); ++i)
+    {
+        cgiJobs[expiredJobs[i]]->abort(true);
+        completeCgiJob(expiredJobs[i], epfd);
+    }
+    for (std::map<const BaseBlock *, OpenFileCache>::iterator ft = config->openFileCaches.begin();
+         ft != config->openFileCaches.end(); ++ft)
+        ft->second.expire(now);
+    refreshPacks(now);
     std::map<int, time_t>::iterator it = lastActivity.begin();
 
     while (it != lastActivity.end())
@@ -703,11 +1224,6 @@ void SocketManager::handleTimeouts(int epfd)
         if (!headersComplete && now - it->second > CLIENT_TIMEOUT)
         {
             sendHttpError(fd, "408 Request Timeout", epfd);
-            struct epoll_event ev;
-            ev.events = EPOLLIN | EPOLLOUT;
-            ev.data.fd = fd;
-            epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
-
             ++it;
         }
         else
@@ -717,28 +1233,234 @@ void SocketManager::handleTimeouts(int epfd)
 
 void SocketManager::sendBuffer(int fd, int epfd)
 {
-    std::map<int, std::string>::iterator it = sendBuffers.find(fd);
+    std::map<int, SendQueue>::iterator it = sendBuffers.find(fd);
     if (it == sendBuffers.end())
         return;
 
-    ssize_t sent = send(fd, it->second.c_str(), it->second.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    ssize_t sent = it->second.flush(fd);
+
+    if (sent < 0 && (errno == EPIPE || errno == ECONNRESET))
+        abortConnection(fd, epfd);
+    else if (it->second.empty() || sent < 0)
+        closeConnection(fd, epfd);
+}
 
-    if (sent > 0)
+void SocketManager::closeConnection(int fd, int epfd)
+{
+    close(fd);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, 0);
+    requestBuffers.erase(fd);
+    lastActivity.erase(fd);
+    sendBuffers.erase(fd);
+    clientAddresses.erase(fd);
+    clientHosts.erase(fd);
+    localAddresses.erase(fd);
+    localRedirects.erase(fd);
+    requestHosts.erase(fd);
+    gzipClients.erase(fd);
+    cgiCollapser.removeWaiter(fd);
+
+    std::map<int, CgiJob *>::iterator job = cgiJobs.find(fd);
+    if (job != cgiJobs.end())
     {
-        it->second.erase(0, sent);
+        untrackCgiPipes(fd);
+        // Requests collapsed onto this one still want the output: the next
+        // in line inherits the running job
+        int heir = cgiCollapser.promote(fd);
+        std::map<int, std::pair<const BaseBlock *, std::string> >::iterator fill = cacheFills.find(fd);
+        if (heir != -1)
+        {
+            if (fill != cacheFills.end())
+            {
+                cacheFills[heir] = fill->second;
+                cacheFills.erase(fill);
+            }
+            cgiJobs[heir] = job->second;
+            cgiJobs.erase(job);
+            trackCgiPipes(heir);
+            return;
+        }
+        if (fill != cacheFills.end())
+        {
+            job->second->getConfig()->cgiCaches[fill->second.first].endRefresh(fill->second.second);
+            cacheFills.erase(fill);
+        }
+        delete job->second; // kills the child and closes its pipes
+        cgiJobs.erase(job);
     }
+}
 
-    if (it->second.empty() || sent <= 0)
+bool SocketManager::hasWorkInFlight(int fd) const
+{
+    if (cgiJobs.find(fd) != cgiJobs.end() || cgiCollapser.isWaiting(fd))
+        return true;
+    std::map<int, SendQueue>::const_iterator pending = sendBuffers.find(fd);
+    return pending != sendBuffers.end() && !pending->second.empty();
+}
+
+// The client went away: kill whatever is still being produced for it and
+// release its buffers instead of finishing a response nobody will read.
+void SocketManager::abortConnection(int fd, int epfd)
+{
+    bool inFlight = hasWorkInFlight(fd);
+    if (inFlight)
     {
-        close(fd);
-        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, 0);
-        requestBuffers.erase(fd);
-        lastActivity.erase(fd);
-        sendBuffers.erase(fd);
-        clientAddresses.erase(fd);
+        metrics.abortedRequests++;
+        if (cgiJobs.find(fd) != cgiJobs.end() && !cgiCollapser.hasWaiters(fd))
+            metrics.abortedCgi++;
+    }
+    closeConnection(fd, epfd);
+
+    std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
+              << COLOR_RED << " ✗ " << COLOR_RESET
+              << "Client " << COLOR_CYAN << fd << COLOR_RESET
+              << ": Connection Closed" << (inFlight ? ", request aborted" : "") << "." << std::endl;
+    if (inFlight)
+    {
+        std::cout << COLOR_DIM << "[" << getTimestamp() << "] " << COLOR_RESET;
+        metrics.print(std::cout);
+        std::cout << std::endl;
     }
 }
 
+const ServerMetrics &SocketManager::getMetrics() const
+{
+    return metrics;
+}
+
+const ConfigSnapshot &SocketManager::getConfig() const
+{
+    return *config;
+}
+
+int SocketManager::getUpgradeFd() const
+{
+    return upgradeFd;
+}
+
+bool SocketManager::isCgiPipe(int fd) const
+{
+    return cgiPipes.find(fd) != cgiPipes.end();
+}
+
+void SocketManager::startCgiJob(int clientFd, CgiJob *job, const HttpRequest &request)
+{
+    // Body bytes that have not arrived yet are spliced in as they do;
+    // chunked bodies have to be decoded first and are only taken from memory
+    const std::string &body = request.getBody();
+    size_t socketBody = 0;
+    if (!request.isChunked() && request.contentLength() > body.size())
+        socketBody = request.contentLength() - body.size();
+
+    cgiJobs[clientFd] = job;
+    job->holdConfig(config);
+    job->startInput(clientFd, body, socketBody);
+    trackCgiPipes(clientFd);
+}
+
+void SocketManager::trackCgiPipes(int clientFd)
+{
+    CgiJob *job = cgiJobs[clientFd];
+    if (job->getStdinFd() != -1)
+        cgiPipes[job->getStdinFd()] = clientFd;
+    if (job->getStdoutFd() != -1)
+        cgiPipes[job->getStdoutFd()] = clientFd;
+}
+
+void SocketManager::untrackCgiPipes(int clientFd)
+{
+    std::map<int, int>::iterator it = cgiPipes.begin();
+    while (it != cgiPipes.end())
+    {
+        if (it->second == clientFd)
+            cgiPipes.erase(it++);
+        else
+            ++it;
+    }
+}
+
+void SocketManager::handleCgiEvent(int pipeFd, uint32_t events, int epfd)
+{
+    int clientFd = cgiPipes[pipeFd];
+    CgiJob *job = cgiJobs[clientFd];
+
+    if (pipeFd == job->getStdoutFd())
+    {
+        if (events & EPOLLIN)
+            job->onStdoutReadable();
+        else if (events & (EPOLLHUP | EPOLLERR))
+            job->onPipeHangup(pipeFd);
+    }
+    else if (pipeFd == job->getStdinFd())
+    {
+        if (events & (EPOLLHUP | EPOLLERR))
+            job->onPipeHangup(pipeFd);
+        else if (events & EPOLLOUT)
+            job->onStdinWritable();
+    }
+
+    untrackCgiPipes(clientFd);
+    if (job->isFinished())
+        completeCgiJob(clientFd, epfd);
+    else
+        trackCgiPipes(clientFd);
+}
+
+void SocketManager::completeCgiJob(int clientFd, int epfd)
+{
+    CgiJob *job = cgiJobs[clientFd];
+    untrackCgiPipes(clientFd);
+    cgiJobs.erase(clientFd);
+
+    // The job's config has to outlive it: the gzip and cache blocks below
+    // may belong to a snapshot that a reload has already replaced
+    SharedPtr<ConfigSnapshot> jobConfig = job->getConfig();
+    HttpResponse res;
+    std::string redirect;
+    job->buildResponse(res, redirect);
+    delete job;
+
+    fillCache(clientFd, *jobConfig, res, redirect);
+    if (clientFd < 0)
+        return; // a background cache refresh has nobody to answer
+
+    // Collapsed requests share the outcome; the owner goes last so the
+    // response can be moved rather than copied into its queue
+    std::vector<int> clients = cgiCollapser.complete(clientFd);
+    clients.push_back(clientFd);
+
+    // RFC 3875 local redirect: serve the new path as if the client asked
+    // for it, with a bound on chained redirects. The client's Host goes
+    // along so the same name-based server answers it
+    if (!redirect.empty())
+    {
+        for (size_t i = 0; i < clients.size(); ++i)
+        {
+            int fd = clients[i];
+            const std::string &host = requestHosts[fd];
+            if (++localRedirects[fd] <= MAX_LOCAL_REDIRECTS)
+            {
+                std::string internal = "GET " + redirect + " HTTP/1.0\r\n";
+                if (!host.empty())
+                    internal += "Host: " + host + "\r\n";
+                processFullRequest(fd, epfd, internal + "\r\n", clientAddresses[fd]);
+                continue;
+            }
+            HttpResponse error;
+            RequestContext ctx(selectServerForClient(fd, host), NULL);
+            error.setErrorFromContext(500, ctx);
+            queueResponse(fd, epfd, error, false);
+        }
+        return;
+    }
+
+    // Collapsed requests share their Accept-Encoding, so one encoding
+    // serves them all; the cache above kept the identity body
+    compressResponse(clientFd, res);
+    for (size_t i = 0; i < clients.size(); ++i)
+        queueResponse(clients[i], epfd, res, i + 1 < clients.size());
+}
+
 void SocketManager::handleClients()
 {
     EpollGuard epollGuard(epoll_create1(EPOLL_DEFAULT));
@@ -757,8 +1479,12 @@ void SocketManager::handleClients()
         if (epoll_ctl(epfd, EPOLL_CTL_ADD, listening_fd, &event) == -1)
             throw std::runtime_error("Failed to add server socket to epoll");
     }
+    loadPacks(config->servers, packs);
+    watchDocroots(epfd);
+    watchSignals(epfd);
+    notifyUpgradeReady();
     std::vector<struct epoll_event> events(1024);
-    while (true)
+    while (!stopped)
     {
         int n = epoll_wait(epfd, &events[0], events.size(), 1000);
         if (n == -1)
@@ -772,16 +1498,40 @@ void SocketManager::handleClients()
         {
             int readyServerFd = events[i].data.fd;
 
+            if (isCgiPipe(readyServerFd))
+            {
+                handleCgiEvent(readyServerFd, events[i].events, epfd);
+                continue;
+            }
+            if (readyServerFd == docrootWatcher.getFd())
+            {
+                applyDocrootChanges();
+                continue;
+            }
+            if (readyServerFd == upgradeFd)
+            {
+                if (finishUpgrade(epfd))
+                    beginDrain(epfd);
+                continue;
+            }
+            if (readyServerFd == signalFd)
+            {
+                handleSignals(epfd);
+                if (stopped)
+                    break;
+                continue;
+            }
             if (events[i].events & (EPOLLHUP | EPOLLERR))
             {
-                std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
-                          << COLOR_RED << " ✗ " << COLOR_RESET
-                          << "Client " << COLOR_CYAN << readyServerFd << COLOR_RESET
-                          << ": Connection Closed (EPOLLHUP/EPOLLERR)." << std::endl;
-                close(readyServerFd);
-                epoll_ctl(epfd, EPOLL_CTL_DEL, readyServerFd, 0);
-                requestBuffers.erase(readyServerFd);
-                lastActivity.erase(readyServerFd);
+                abortConnection(readyServerFd, epfd);
+                continue;
+            }
+            // Gone before its response was queued: whatever is being
+            // produced for it, a CGI child included, is dropped. Before
+            // any work starts the request bytes still have to be read.
+            if ((events[i].events & EPOLLRDHUP) && hasWorkInFlight(readyServerFd))
+            {
+                abortConnection(readyServerFd, epfd);
                 continue;
             }
             if (isServerSocket(readyServerFd))
@@ -791,6 +1541,330 @@ void SocketManager::handleClients()
             if (events[i].events & EPOLLOUT)
                 sendBuffer(readyServerFd, epfd);
         }
+        if (stopped)
+            break;
         handleTimeouts(epfd);
+        if (draining)
+            checkDrain(epfd);
+    }
+}
+
+// The signals the server acts on are blocked and read through a signalfd
+// in the epoll set, so they are handled between events like any other input
+void SocketManager::watchSignals(int epfd)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGQUIT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &signals, NULL) == -1)
+        throw std::runtime_error("Failed to block signals");
+    signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd == -1)
+        throw std::runtime_error("Failed to create signalfd");
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = signalFd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, signalFd, &event) == -1)
+        throw std::runtime_error("Failed to add signalfd to epoll");
+}
+
+// SIGHUP reloads, SIGQUIT drains, SIGTERM and SIGINT stop at once, SIGUSR2
+// upgrades the binary, SIGCHLD completes CGI jobs waiting on their child.
+// Once draining there are no listeners left to reload or hand over.
+void SocketManager::handleSignals(int epfd)
+{
+    struct signalfd_siginfo info;
+    while (!stopped && read(signalFd, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info)))
+    {
+        if (info.ssi_signo == SIGHUP && !draining)
+            reloadConfig(epfd);
+        else if (info.ssi_signo == SIGQUIT && !draining)
+            beginDrain(epfd);
+        else if (info.ssi_signo == SIGUSR2 && !draining)
+            startUpgrade(epfd);
+        else if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT)
+            stopNow(epfd);
+        else if (info.ssi_signo == SIGCHLD)
+            reapCgiJobs(epfd);
+    }
+}
+
+// Jobs whose output is complete but whose child had not exited yet when it
+// ended; SIGCHLDs merge, so every such job is checked
+void SocketManager::reapCgiJobs(int epfd)
+{
+    std::vector<int> finished;
+    for (std::map<int, CgiJob *>::iterator it = cgiJobs.begin(); it != cgiJobs.end(); ++it)
+    {
+        if (it->second->getStdoutFd() != -1)
+            continue;
+        it->second->onChildExit();
+        if (it->second->isFinished())
+            finished.push_back(it->first);
+    }
+    for (size_t i = 0; i < finished.size(); ++i)
+        completeCgiJob(finished[i], epfd);
+}
+
+// SIGHUP: reads the config file again and serves new requests with it.
+// Connections already open stay; a CGI job finishes under the config it
+// started with, which lives as long as the job does. If the new file does
+// not load, or one of its addresses can't be bound, the running config
+// stays as it was. A master process passes no event set: it only keeps the
+// sockets for its workers.
+bool SocketManager::reloadConfig(int epfd)
+{
+    std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
+              << " Reloading " << configFile << std::endl;
+
+    SharedPtr<ConfigSnapshot> next;
+    std::map<std::string, SharedPtr<PackArchive> > nextPacks;
+    try
+    {
+        Container container = loadConfig(configFile);
+        next.reset(new ConfigSnapshot(container.getServers()));
+        loadPacks(next->servers, nextPacks);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Reload failed, keeping the running configuration: " << e.what() << std::endl;
+        return false;
+    }
+    if (!updateListeners(convertServersToSocketInfo(next->servers), epfd))
+    {
+        std::cerr << "Reload failed, keeping the running configuration: "
+                  << "a new listen address could not be bound" << std::endl;
+        return false;
+    }
+
+    config = next;
+    packs = nextPacks;
+    for (std::map<int, sockaddr_in>::iterator it = localAddresses.begin(); it != localAddresses.end(); ++it)
+    {
+        const VirtualHosts *hosts = config->hostsFor(it->second);
+        if (hosts)
+            clientHosts[it->first] = hosts;
+        else
+            clientHosts.erase(it->first);
+    }
+    // The new caches start empty; the watcher follows the new roots
+    docrootWatcher.stop();
+    if (epfd != -1)
+        watchDocroots(epfd);
+    metrics.configReloads++;
+    std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
+              << COLOR_GREEN << " ✓ " << COLOR_RESET << "Configuration reloaded: "
+              << config->servers.size() << " server(s) on " << listenAddresses.size()
+              << " address(es)" << std::endl;
+    return true;
+}
+
+// SIGQUIT: stops accepting and closes the connections that are not in the
+// middle of a request. Whatever is left, CGI included, gets drain_timeout
+// to finish; checkDrain() ends the loop once it has.
+void SocketManager::beginDrain(int epfd)
+{
+    draining = true;
+    drainDeadline = time(NULL) + config->drainTimeout();
+    for (size_t i = 0; i < listeningSockets.size(); ++i)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, listeningSockets[i], 0);
+    closeSocket();
+
+    std::vector<int> idle;
+    for (std::map<int, sockaddr_in>::iterator it = clientAddresses.begin(); it != clientAddresses.end(); ++it)
+    {
+        std::map<int, std::string>::const_iterator buffered = requestBuffers.find(it->first);
+        if (!hasWorkInFlight(it->first) && (buffered == requestBuffers.end() || buffered->second.empty()))
+            idle.push_back(it->first);
+    }
+    for (size_t i = 0; i < idle.size(); ++i)
+        closeConnection(idle[i], epfd);
+    drainPending = clientAddresses.size();
+
+    std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
+              << COLOR_YELLOW << " Graceful shutdown: " << COLOR_RESET << idle.size()
+              << " idle connection(s) closed, waiting up to " << config->drainTimeout()
+              << "s for " << drainPending << " request(s)" << std::endl;
+    checkDrain(epfd);
+}
+
+// Ends a drain once every connection and background CGI run is done, or
+// aborts what is left at the deadline
+void SocketManager::checkDrain(int epfd)
+{
+    if (clientAddresses.empty() && cgiJobs.empty())
+    {
+        stopped = true;
+        reportShutdown("Graceful shutdown", drainPending, 0);
+        return;
+    }
+    if (time(NULL) < drainDeadline)
+        return;
+    size_t aborted = abortAll(epfd);
+    stopped = true;
+    reportShutdown("Graceful shutdown", drainPending > aborted ? drainPending - aborted : 0, aborted);
+}
+
+// SIGTERM: nothing in flight is waited for
+void SocketManager::stopNow(int epfd)
+{
+    for (size_t i = 0; i < listeningSockets.size(); ++i)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, listeningSockets[i], 0);
+    closeSocket();
+    size_t aborted = abortAll(epfd);
+    stopped = true;
+    reportShutdown("Fast shutdown", 0, aborted);
+}
+
+// Closes every client connection and kills every CGI child. Returns how
+// many of those connections still had a request in flight.
+size_t SocketManager::abortAll(int epfd)
+{
+    std::vector<int> clients;
+    for (std::map<int, sockaddr_in>::iterator it = clientAddresses.begin(); it != clientAddresses.end(); ++it)
+        clients.push_back(it->first);
+
+    size_t aborted = 0;
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        if (hasWorkInFlight(clients[i]) || !requestBuffers[clients[i]].empty())
+            aborted++;
+        abortConnection(clients[i], epfd);
+    }
+    // Background cache refreshes have no connection to close
+    for (std::map<int, CgiJob *>::iterator it = cgiJobs.begin(); it != cgiJobs.end(); ++it)
+    {
+        untrackCgiPipes(it->first);
+        delete it->second;
+    }
+    cgiJobs.clear();
+    cacheFills.clear();
+    return aborted;
+}
+
+void SocketManager::reportShutdown(const char *how, size_t drained, size_t aborted)
+{
+    std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
+              << COLOR_BOLD << " " << how << ": " << COLOR_RESET << drained << " request(s) drained, "
+              << aborted << " aborted" << std::endl;
+    std::cout << COLOR_DIM << "[" << getTimestamp() << "] " << COLOR_RESET;
+    metrics.print(std::cout);
+    std::cout << std::endl;
+}
+
+// SIGUSR2: runs the binary found where this one was started from, with the
+// same arguments, and hands it the listening sockets. Both accept until the
+// new one reports on the pipe that its loop is running; only then does this
+// process drain. If it dies first, the pipe closes empty and nothing here
+// changes. finishUpgrade() reads the pipe and says whether the new one made
+// it.
+void SocketManager::startUpgrade(int epfd)
+{
+    if (upgradePid != -1 || commandLine.empty())
+        return;
+    int ready[2];
+    if (pipe(ready) == -1)
+    {
+        std::cerr << "Upgrade failed: " << strerror(errno) << std::endl;
+        return;
+    }
+    fcntl(ready[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ready[0], F_SETFL, O_NONBLOCK);
+
+    std::ostringstream listenFds;
+    for (std::map<std::string, int>::iterator it = listenAddresses.begin(); it != listenAddresses.end(); ++it)
+        listenFds << (it == listenAddresses.begin() ? "" : ";") << it->first << '=' << it->second;
+    std::string readyEnv = initToString(ready[1]);
+    std::vector<char *> argv;
+    for (size_t i = 0; i < commandLine.size(); ++i)
+        argv.push_back(const_cast<char *>(commandLine[i].c_str()));
+    argv.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        std::cerr << "Upgrade failed: " << strerror(errno) << std::endl;
+        close(ready[0]);
+        close(ready[1]);
+        return;
     }
+    if (pid == 0)
+    {
+        // Only the listeners and the pipe go across; client sockets, CGI
+        // pipes and cached files stay with this process
+        std::vector<int> open;
+        DIR *fds = opendir("/proc/self/fd");
+        for (struct dirent *entry = fds ? readdir(fds) : NULL; entry; entry = readdir(fds))
+        {
+            int fd = atoi(entry->d_name);
+            if (fd > 2 && fd != dirfd(fds) && fd != ready[1] && !isServerSocket(fd))
+                open.push_back(fd);
+        }
+        if (fds)
+            closedir(fds);
+        for (size_t i = 0; i < open.size(); ++i)
+            close(open[i]);
+
+        sigset_t noSignals;
+        sigemptyset(&noSignals);
+        sigprocmask(SIG_SETMASK, &noSignals, NULL);
+        setenv(LISTEN_FDS_ENV, listenFds.str().c_str(), 1);
+        setenv(UPGRADE_READY_ENV, readyEnv.c_str(), 1);
+        execvp(argv[0], &argv[0]);
+        _exit(1);
+    }
+
+    close(ready[1]);
+    upgradePid = pid;
+    upgradeFd = ready[0];
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = upgradeFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, upgradeFd, &event);
+    std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
+              << COLOR_YELLOW << " Upgrade: " << COLOR_RESET << "started " << commandLine[0]
+              << " as pid " << pid << std::endl;
+}
+
+bool SocketManager::finishUpgrade(int epfd)
+{
+    char byte;
+    ssize_t n = read(upgradeFd, &byte, 1);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        return false;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, upgradeFd, 0);
+    close(upgradeFd);
+    upgradeFd = -1;
+    pid_t pid = upgradePid;
+    upgradePid = -1;
+
+    if (n == 1)
+    {
+        std::cout << COLOR_DIM << "[" << getTimestamp() << "]" << COLOR_RESET
+                  << COLOR_YELLOW << " Upgrade: " << COLOR_RESET << "pid " << pid
+                  << " is serving, draining this process" << std::endl;
+        return true;
+    }
+    // EOF on the pipe means the new binary is exiting; WNOHANG could
+    // run before it has and leave a zombie
+    waitpid(pid, NULL, 0);
+    std::cerr << "Upgrade failed: pid " << pid << " exited before serving, keeping this process" << std::endl;
+    return false;
+}
+
+// In a binary started by an upgrade: tells the old one it can drain
+void SocketManager::notifyUpgradeReady()
+{
+    if (readyFd == -1)
+        return;
+    if (write(readyFd, "1", 1) != 1)
+        std::cerr << "Upgrade: could not notify the previous process" << std::endl;
+    close(readyFd);
+    readyFd = -1;
 }
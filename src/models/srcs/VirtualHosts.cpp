@@ -0,0 +1,81 @@
+#include "VirtualHosts.hpp"
+#include "HttpUtils.hpp"
+
+VirtualHosts::Node::Node() : children(), server(-1) {}
+
+VirtualHosts::VirtualHosts(size_t defaultServer) : defaultServer(defaultServer), exact(), nodes(1) {}
+
+VirtualHosts::~VirtualHosts() {}
+
+void VirtualHosts::addWildcard(const std::string &suffix, size_t server)
+{
+    size_t node = 0;
+    size_t end = suffix.size();
+    while (end > 0)
+    {
+        size_t dot = suffix.rfind('.', end - 1);
+        size_t start = dot == std::string::npos ? 0 : dot + 1;
+        std::string label = suffix.substr(start, end - start);
+        const size_t *child = nodes[node].children.find(label);
+        if (child)
+            node = *child;
+        else
+        {
+            nodes.push_back(Node());
+            nodes[node].children.insert(label, nodes.size() - 1);
+            node = nodes.size() - 1;
+        }
+        end = dot == std::string::npos ? 0 : dot;
+    }
+    if (nodes[node].server == -1)
+        nodes[node].server = server;
+}
+
+void VirtualHosts::addName(const std::string &serverName, size_t server)
+{
+    std::string name = toLowerStr(serverName);
+    if (name.compare(0, 2, "*.") == 0 && name.size() > 2)
+        addWildcard(name.substr(2), server);
+    else if (name.size() > 1 && name[0] == '.')
+    {
+        exact.insert(name.substr(1), server);
+        addWildcard(name.substr(1), server);
+    }
+    else if (!name.empty())
+        exact.insert(name, server);
+}
+
+size_t VirtualHosts::find(const std::string &hostHeader) const
+{
+    // "[::1]:8080" -> "[::1]", "Example.com.:80" -> "example.com"
+    std::string host = toLowerStr(trim(hostHeader));
+    size_t colon = host.find(':', host.empty() || host[0] != '[' ? 0 : host.find(']'));
+    if (colon != std::string::npos)
+        host.erase(colon);
+    if (!host.empty() && host[host.size() - 1] == '.')
+        host.erase(host.size() - 1);
+    if (host.empty())
+        return defaultServer;
+
+    const size_t *match = exact.find(host);
+    if (match)
+        return *match;
+
+    // A wildcard needs at least one more label to its left
+    long best = -1;
+    size_t node = 0;
+    size_t end = host.size();
+    while (end > 0)
+    {
+        if (nodes[node].server != -1)
+            best = nodes[node].server;
+        size_t dot = host.rfind('.', end - 1);
+        size_t start = dot == std::string::npos ? 0 : dot + 1;
+        const size_t *child = nodes[node].children.find(host.data() + start, end - start);
+        if (!child)
+            break;
+        node = *child;
+        end = dot == std::string::npos ? 0 : dot;
+    }
+    return best == -1 ? defaultServer : best;
+}
@@ -1,20 +1,35 @@
 #include <stdio.h>
+#include <cstring>
 #include <iostream>
 #include <parser.hpp>
 #include <string>
 #include <vector>
 #include "utils.hpp"
 
-bool isLevel(const std::string& s) {
-  return s == "server" || s == "http" || s == "location";
+// What each byte can start or continue; everything else is part of a word
+enum CharClass { CHAR_WORD, CHAR_SPACE, CHAR_SYMBOL, CHAR_QUOTE, CHAR_COMMENT };
+
+static const unsigned char* charClasses() {
+  static unsigned char table[256];
+  static bool built = false;
+  if (!built) {
+    for (int c = 0; c < 256; ++c)
+      table[c] = isspace(c) ? CHAR_SPACE : CHAR_WORD;
+    for (const char* s = DEF_SYMBOL; *s; ++s)
+      table[static_cast<unsigned char>(*s)] = CHAR_SYMBOL;
+    table[static_cast<unsigned char>('"')] = CHAR_QUOTE;
+    table[static_cast<unsigned char>('\'')] = CHAR_QUOTE;
+    table[static_cast<unsigned char>('#')] = CHAR_COMMENT;
+    built = true;
+  }
+  return table;
 }
-bool isAttribute(const std::string& s) {
-  return s == "root" || s == "client_max_body_size" || s == "listen" ||
-    s == "index" || s == "error_page" || s == "server_name" ||
-    s == "autoindex" || s == "redirect" || s == "return" || s == "cgi" ||
-    s == "allow_methods" || s == "upload_dir" || s == "cgi_enabled" ||
-    s == "transfer_encoding" || s == "cgi_pass";
+
+static bool isLevel(const char* s, size_t length) {
+  TokenText text = {s, length};
+  return text == "server" || text == "http" || text == "location";
 }
+
 bool isAllDigits(const std::string& s) {
   for (size_t i = 0; i < s.size(); ++i)
     if (!isdigit(s[i]))
@@ -22,89 +37,75 @@ bool isAllDigits(const std::string& s) {
   return !s.empty();
 }
 
-static Token handleQuoted(std::string::const_iterator& it,
-  const std::string& content) {
-  char quoteChar = *it;
-  ++it;
-  std::string buffer;
-
-  while (it != content.end() && *it != quoteChar) {
-    buffer += *it;
-    ++it;
-  }
-  if (it == content.end()) {
-    throw std::runtime_error("Unclosed quote");
-  }
-  ++it;
-
-  Token token;
-  token.type = STRING;
-  token.value = buffer;
-  token.quoted = 1;
-  return token;
-}
-
-static Token handleSymbol(std::string::const_iterator& it) {
-  Token token;
-  token.type = SYMBOL;
-  token.value = std::string(1, *it);
-  token.quoted = 0;
-  ++it;
-  return token;
-}
-
-static Token handleWord(std::string::const_iterator& it,
-  const std::string& content) {
-  std::string buffer;
-  while (it != content.end() && !isspace(*it) &&
-    std::string(DEF_SYMBOL).find(*it) == std::string::npos) {
-    buffer += *it;
-    ++it;
-  }
-
-  Token token;
-  token.quoted = 0;
-  if (isAllDigits(buffer))
-    token.type = NUMBER;
-  else if (isAttribute(buffer))
-    token.type = ATTRIBUTE;
-  else if (isLevel(buffer))
-    token.type = LEVEL;
-  else
-    token.type = STRING;
-
-  token.value = buffer;
-  token.quoted = 0;
-  return token;
+static TokenType wordType(const char* s, size_t length) {
+  size_t digits = 0;
+  while (digits < length && isdigit(static_cast<unsigned char>(s[digits])))
+    ++digits;
+  if (length > 0 && digits == length)
+    return NUMBER;
+  if (isDirective(s, length))
+    return ATTRIBUTE;
+  if (isLevel(s, length))
+    return LEVEL;
+  return STRING;
 }
 
 std::vector<Token> lexer(const std::string& content) {
+  const unsigned char* classes = charClasses();
+  const char* text = content.data();
+  size_t size = content.size();
   std::vector<Token> tokens;
-  std::string::const_iterator it = content.begin();
+  // A token every few bytes is typical; saves regrowing on large configs
+  tokens.reserve(size / 6 + 1);
 
-  while (it != content.end()) {
-    if (isspace(*it)) {
-      ++it;
-      continue;
-    }
-
-    // Handle comments - skip everything after # until end of line
-    if (*it == '#') {
-      while (it != content.end() && *it != '\n') {
-        ++it;
+  size_t i = 0;
+  while (i < size) {
+    Token token;
+    token.quoted = 0;
+    switch (classes[static_cast<unsigned char>(text[i])]) {
+      case CHAR_SPACE:
+        ++i;
+        continue;
+      case CHAR_COMMENT: {
+        // Skip everything after # until end of line
+        const void* newline = std::memchr(text + i, '\n', size - i);
+        i = newline ? static_cast<const char*>(newline) - text : size;
+        continue;
+      }
+      case CHAR_QUOTE: {
+        const void* close = std::memchr(text + i + 1, text[i], size - i - 1);
+        if (!close)
+          throw std::runtime_error("Unclosed quote");
+        size_t end = static_cast<const char*>(close) - text;
+        token.type = STRING;
+        token.value.data = text + i + 1;
+        token.value.length = end - i - 1;
+        token.quoted = 1;
+        i = end + 1;
+        break;
+      }
+      case CHAR_SYMBOL:
+        token.type = SYMBOL;
+        token.value.data = text + i;
+        token.value.length = 1;
+        ++i;
+        break;
+      default: {
+        // Quotes and '#' inside a word are part of it
+        size_t start = i;
+        while (i < size) {
+          unsigned char c = classes[static_cast<unsigned char>(text[i])];
+          if (c == CHAR_SPACE || c == CHAR_SYMBOL)
+            break;
+          ++i;
+        }
+        token.value.data = text + start;
+        token.value.length = i - start;
+        token.type = wordType(token.value.data, token.value.length);
+        break;
       }
-      continue;
-    }
-
-    if (*it == '"' || *it == '\'') {
-      tokens.push_back(handleQuoted(it, content));
-    }
-    else if (std::string(DEF_SYMBOL).find(*it) != std::string::npos) {
-      tokens.push_back(handleSymbol(it));
-    }
-    else {
-      tokens.push_back(handleWord(it, content));
     }
+    tokens.push_back(token);
   }
   return tokens;
 }
@@ -112,17 +113,17 @@ std::vector<Token> lexer(const std::string& content) {
 int isAllowedTokens(const std::vector<Token>& tokens) {
   for (std::vector<Token>::const_iterator it = tokens.begin();
     it != tokens.end(); ++it) {
-    const std::string& val = it->value;
+    const TokenText& val = it->value;
 
     if (it->type == SYMBOL) {
       if (std::string(DEF_SYMBOL).find(val[0]) == std::string::npos) {
-        throw std::runtime_error("Invalid symbol: " + val);
+        throw std::runtime_error("Invalid symbol: " + val.str());
       }
     }
     else if (it->type == NUMBER) {
       for (size_t i = 0; i < val.size(); i++) {
         if (!isdigit(val[i])) {
-          throw std::runtime_error("Invalid number: " + val);
+          throw std::runtime_error("Invalid number: " + val.str());
         }
       }
     }
@@ -134,7 +135,7 @@ int isAllowedTokens(const std::vector<Token>& tokens) {
           c != '=' && c != ':' && c != '?' && c != '&' && c != '%' &&
           c != '@' && c != '!' && c != '*' && c != '+' && c != '~' &&
           c != '^' && c != '$' && c != '\\' && it->quoted == 0) {
-          throw std::runtime_error("Invalid identifier: " + val);
+          throw std::runtime_error("Invalid identifier: " + val.str());
         }
       }
     }
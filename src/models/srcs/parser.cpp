@@ -2,175 +2,331 @@
 #include <cstdlib>
 #include <parser.hpp>
 #include <utils.hpp>
+#include "HashTable.hpp"
 
 bool expect(std::string expected, Token token) {
   return token.value == expected;
 }
 
-static size_t parseLocationDirective(const std::vector<Token>& tokens,
-                                     size_t i,
-                                     LocationConfig& location) {
-  if (tokens[i].type == ATTRIBUTE || tokens[i].type == LEVEL) {
-    std::string locationDirective = tokens[i].value;
-    i++;
+// Where a directive may appear
+enum DirectiveContext {
+  IN_SERVER = 1,
+  IN_LOCATION = 2,
+  IN_BOTH = IN_SERVER | IN_LOCATION
+};
+
+#define ANY_ARGS static_cast<size_t>(-1)
+
+// The block being parsed: exactly one of server and location is set
+struct DirectiveTarget {
+  BaseBlock& block;
+  Server* server;
+  LocationConfig* location;
+};
+
+typedef void (*DirectiveHandler)(DirectiveTarget& target,
+                                 std::vector<std::string>& args);
+
+// Arguments are checked against minArgs/maxArgs before handle() runs
+struct Directive {
+  const char* name;
+  int contexts;
+  size_t minArgs;
+  size_t maxArgs;
+  DirectiveHandler handle;
+};
+
+static bool parseOnOff(const char* directive, const std::string& value) {
+  if (value != "on" && value != "off") {
+    throw std::runtime_error(std::string("Invalid value for '") + directive +
+                             "': " + value);
+  }
+  return value == "on";
+}
 
-    if (locationDirective == "root" && i < tokens.size()) {
-      location.setRoot(tokens[i].value);
-      i++;
-      if (i >= tokens.size() || tokens[i].value != ";") {
-        throw std::runtime_error("Expected ';' after 'root' directive");
-      }
-      i++;
-    } else if (locationDirective == "index" && i < tokens.size()) {
-      std::vector<std::string> indexFiles;
-      while (i < tokens.size() && tokens[i].value != ";") {
-        // Check if token is a valid index file (not another directive)
-        if (tokens[i].type == ATTRIBUTE || tokens[i].type == LEVEL) {
-          throw std::runtime_error("Expected ';' after 'index' directive");
-        }
-        indexFiles.push_back(tokens[i].value);
-        i++;
-      }
-      if (i >= tokens.size() || tokens[i].value != ";") {
-        throw std::runtime_error("Expected ';' after 'index' directive");
-      }
-      i++;
-      location.insertIndex(indexFiles);
-    } else if (locationDirective == "autoindex" && i < tokens.size()) {
-      if (tokens[i].value == "on") {
-        location.activateAutoIndex();
-      }
-      i++;
-      if (i >= tokens.size() || tokens[i].value != ";") {
-        throw std::runtime_error("Expected ';' after 'autoindex' directive");
-      }
-      i++;
-    } else if (locationDirective == "error_page" && i < tokens.size()) {
-      std::vector<u_int16_t> errorCodes;
-      std::string errorPage;
-      while (i < tokens.size() && tokens[i].value != ";" &&
-             tokens[i].type == NUMBER) {
-        errorCodes.push_back(
-            static_cast<u_int16_t>(std::atoi(tokens[i].value.c_str())));
-        i++;
-      }
+static void handleRoot(DirectiveTarget& t, std::vector<std::string>& args) {
+  // Server keeps its own root
+  if (t.server) {
+    t.server->setRoot(args[0]);
+  } else {
+    t.block.setRoot(args[0]);
+  }
+}
 
-      if (i < tokens.size() && tokens[i].value != ";") {
-        errorPage = tokens[i].value;
-        i++;
-      }
+static void handleIndex(DirectiveTarget& t, std::vector<std::string>& args) {
+  t.block.insertIndex(args);
+}
 
-      if (!errorCodes.empty() && !errorPage.empty()) {
-        for (size_t j = 0; j < errorCodes.size(); ++j) {
-          location.insertErrorPage(errorCodes[j], errorPage);
-        }
-      }
-      if (i >= tokens.size() || tokens[i].value != ";") {
-        throw std::runtime_error("Expected ';' after 'error_page' directive");
-      }
-      i++;
-    } else if (locationDirective == "upload_dir" && i < tokens.size()) {
-      location.setUploadDir(tokens[i].value);
-      i++;
-      if (i >= tokens.size() || tokens[i].value != ";") {
-        throw std::runtime_error("Expected ';' after 'upload_dir' directive");
-      }
-      i++;
-    } else if (locationDirective == "allow_methods" && i < tokens.size()) {
-      std::vector<std::string> methods;
-      while (i < tokens.size() && tokens[i].value != ";") {
-        // Check if token is a valid method (not another directive)
-        if (tokens[i].type == ATTRIBUTE || tokens[i].type == LEVEL) {
-          throw std::runtime_error(
-              "Expected ';' after 'allow_methods' directive");
-        }
-        methods.push_back(tokens[i].value);
-        i++;
-      }
-      if (i >= tokens.size() || tokens[i].value != ";") {
-        throw std::runtime_error(
-            "Expected ';' after 'allow_methods' directive");
-      }
-      i++;
-      if (!methods.empty()) {
-        location.setMethods(methods);
-      }
-    } else if (locationDirective == "cgi_enabled" && i < tokens.size()) {
-      std::string value = tokens[i].value;
-      i++;
-      if (i >= tokens.size() || tokens[i].value != ";") {
-        throw std::runtime_error("Expected ';' after 'cgi_enabled' directive");
-      }
-      i++;
-      if (value == "on") {
-        location.setCgiEnabled(true);
-      } else if (value == "off") {
-        location.setCgiEnabled(false);
-      } else {
-        throw std::runtime_error("Invalid value for 'cgi_enabled': " + value);
-      }
-    } else if (locationDirective == "transfer_encoding" && i < tokens.size()) {
-      std::string value = tokens[i].value;
-      i++;
-      if (i >= tokens.size() || tokens[i].value != ";") {
-        throw std::runtime_error(
-            "Expected ';' after 'transfer_encoding' directive");
-      }
-      i++;
-      if (value == "on") {
-        location.setTransferEncoding(true);
-      } else if (value == "off") {
-        location.setTransferEncoding(false);
-      } else {
-        throw std::runtime_error("Invalid value for 'transfer_encoding': " +
-                                 value);
-      }
-    } else if (locationDirective == "cgi_pass" && i + 1 < tokens.size()) {
-      std::string extension = tokens[i].value;
-      std::string interpreter = tokens[i + 1].value;
-      i += 2;
-      if (i >= tokens.size() || tokens[i].value != ";") {
-        throw std::runtime_error("Expected ';' after 'cgi_pass' directive");
-      }
-      i++;
-      location.setCgiPassMapping(extension, interpreter);
-    } else if (locationDirective == "return" && i < tokens.size()) {
-      // Parse: return <code> <url>;
-      if (tokens[i].type != NUMBER) {
-        throw std::runtime_error(
-            "Expected status code after 'return' directive");
-      }
-      u_int16_t code =
-          static_cast<u_int16_t>(std::atoi(tokens[i].value.c_str()));
-      i++;
-      std::string url;
-      if (i < tokens.size() && tokens[i].value != ";") {
-        url = tokens[i].value;
-        i++;
-      }
-      if (i >= tokens.size() || tokens[i].value != ";") {
-        throw std::runtime_error("Expected ';' after 'return' directive");
-      }
-      i++;
-      location.setReturn(code, url);
+static void handleAutoIndex(DirectiveTarget& t,
+                            std::vector<std::string>& args) {
+  if (args[0] == "on") {
+    t.block.activateAutoIndex();
+  }
+}
+
+// error_page <code>... <page>
+static void handleErrorPage(DirectiveTarget& t,
+                            std::vector<std::string>& args) {
+  const std::string& errorPage = args.back();
+  if (isAllDigits(errorPage)) {
+    throw std::runtime_error("Expected page after 'error_page' codes");
+  }
+  for (size_t j = 0; j + 1 < args.size(); ++j) {
+    if (!isAllDigits(args[j])) {
+      throw std::runtime_error("Invalid value for 'error_page': " + args[j]);
+    }
+    t.block.insertErrorPage(
+        static_cast<u_int16_t>(std::atoi(args[j].c_str())), errorPage);
+  }
+}
+
+static void handleUploadDir(DirectiveTarget& t,
+                            std::vector<std::string>& args) {
+  t.location->setUploadDir(args[0]);
+}
+
+static void handleAllowMethods(DirectiveTarget& t,
+                               std::vector<std::string>& args) {
+  t.location->setMethods(args);
+}
+
+static void handleCgiEnabled(DirectiveTarget& t,
+                             std::vector<std::string>& args) {
+  t.block.setCgiEnabled(parseOnOff("cgi_enabled", args[0]));
+}
+
+static void handleTransferEncoding(DirectiveTarget& t,
+                                   std::vector<std::string>& args) {
+  t.location->setTransferEncoding(parseOnOff("transfer_encoding", args[0]));
+}
+
+static void handleCgiPass(DirectiveTarget& t, std::vector<std::string>& args) {
+  t.block.setCgiPassMapping(args[0], args[1]);
+}
+
+static void handleCgiBuffers(DirectiveTarget& t,
+                             std::vector<std::string>& args) {
+  t.block.setCgiBuffers(args[0], args[1]);
+}
+
+static void handleCgiCollapsing(DirectiveTarget& t,
+                                std::vector<std::string>& args) {
+  t.block.setCgiCollapsing(parseOnOff("cgi_request_collapsing", args[0]));
+}
+
+static void handleGzip(DirectiveTarget& t, std::vector<std::string>& args) {
+  t.block.setGzip(parseOnOff("gzip", args[0]));
+}
+
+static void handleGzipStatic(DirectiveTarget& t,
+                             std::vector<std::string>& args) {
+  t.block.setGzipStatic(parseOnOff("gzip_static", args[0]));
+}
+
+static void handleCgiCache(DirectiveTarget& t,
+                           std::vector<std::string>& args) {
+  t.block.setCgiCache(args[0]);
+}
+
+static void handleCgiCacheKey(DirectiveTarget& t,
+                              std::vector<std::string>& args) {
+  t.block.setCgiCacheKey(args[0]);
+}
+
+static void handleCgiCacheValid(DirectiveTarget& t,
+                                std::vector<std::string>& args) {
+  t.block.setCgiCacheValid(args[0]);
+}
+
+static void handleMmap(DirectiveTarget& t, std::vector<std::string>& args) {
+  t.block.setMmap(args[0]);
+}
+
+static void handleRootPack(DirectiveTarget& t,
+                           std::vector<std::string>& args) {
+  t.block.setRootPack(args[0]);
+}
+
+static void handleGzipMinLength(DirectiveTarget& t,
+                                std::vector<std::string>& args) {
+  t.block.setGzipMinLength(args[0]);
+}
+
+static void handleGzipCompLevel(DirectiveTarget& t,
+                                std::vector<std::string>& args) {
+  t.block.setGzipCompLevel(args[0]);
+}
+
+static void handleExpires(DirectiveTarget& t, std::vector<std::string>& args) {
+  t.block.setExpires(args[0]);
+}
+
+static void handleOpenFileCache(DirectiveTarget& t,
+                                std::vector<std::string>& args) {
+  t.block.setOpenFileCache(args);
+}
+
+static void handleContentCache(DirectiveTarget& t,
+                               std::vector<std::string>& args) {
+  t.block.setContentCache(args);
+}
+
+static void handleGzipTypes(DirectiveTarget& t,
+                            std::vector<std::string>& args) {
+  t.block.setGzipTypes(args);
+}
+
+static void handleAddHeader(DirectiveTarget& t,
+                            std::vector<std::string>& args) {
+  t.block.addHeader(args);
+}
+
+// return <code> [url]
+static void handleReturn(DirectiveTarget& t, std::vector<std::string>& args) {
+  if (!isAllDigits(args[0])) {
+    throw std::runtime_error("Expected status code after 'return' directive");
+  }
+  t.block.setReturn(static_cast<u_int16_t>(std::atoi(args[0].c_str())),
+                    args.size() > 1 ? args[1] : "");
+}
+
+// listen <port> | <addr>:<port> ...
+static void handleListen(DirectiveTarget& t, std::vector<std::string>& args) {
+  for (size_t j = 0; j < args.size(); ++j) {
+    const std::string& listenValue = args[j];
+    size_t colonPos = listenValue.find(':');
+    std::string portStr = colonPos == std::string::npos
+                              ? listenValue
+                              : listenValue.substr(colonPos + 1);
+    u_int16_t port = 80;
+    if (!portStr.empty()) {
+      port = static_cast<u_int16_t>(std::atoi(portStr.c_str()));
+    }
+    if (colonPos != std::string::npos) {
+      t.server->insertListen(port, listenValue.substr(0, colonPos));
     } else {
-      while (i < tokens.size() && tokens[i].value != ";") {
-        i++;
-      }
-      if (i < tokens.size() && tokens[i].value == ";") {
-        i++;
-      }
-      throw std::runtime_error("Unknown location directive: " +
-                               locationDirective);
+      t.server->insertListen(port);
     }
-  } else {
-    throw std::runtime_error("Expected location directive, got: " +
-                             tokens[i].value);
   }
-  // Note: semicolons are now consumed by each directive handler
+}
+
+static void handleServerName(DirectiveTarget& t,
+                             std::vector<std::string>& args) {
+  for (size_t j = 0; j < args.size(); ++j) {
+    t.server->insertServerNames(args[j]);
+  }
+}
+
+static void handleDrainTimeout(DirectiveTarget& t,
+                               std::vector<std::string>& args) {
+  t.block.setDrainTimeout(args[0]);
+}
+
+static void handleWorkerProcesses(DirectiveTarget& t,
+                                  std::vector<std::string>& args) {
+  t.block.setWorkerProcesses(args[0]);
+}
+
+static void handleClientMaxBodySize(DirectiveTarget& t,
+                                    std::vector<std::string>& args) {
+  t.block.setClientMaxBodySize(args[0]);
+}
+
+static const Directive directives[] = {
+    {"root", IN_BOTH, 1, 1, handleRoot},
+    {"index", IN_BOTH, 1, ANY_ARGS, handleIndex},
+    {"autoindex", IN_BOTH, 1, 1, handleAutoIndex},
+    {"error_page", IN_BOTH, 2, ANY_ARGS, handleErrorPage},
+    {"return", IN_BOTH, 1, 2, handleReturn},
+    {"listen", IN_SERVER, 1, ANY_ARGS, handleListen},
+    {"server_name", IN_SERVER, 1, ANY_ARGS, handleServerName},
+    {"client_max_body_size", IN_SERVER, 1, 1, handleClientMaxBodySize},
+    {"drain_timeout", IN_SERVER, 1, 1, handleDrainTimeout},
+    {"worker_processes", IN_SERVER, 1, 1, handleWorkerProcesses},
+    {"upload_dir", IN_LOCATION, 1, 1, handleUploadDir},
+    {"allow_methods", IN_LOCATION, 1, ANY_ARGS, handleAllowMethods},
+    {"transfer_encoding", IN_LOCATION, 1, 1, handleTransferEncoding},
+    {"cgi_enabled", IN_BOTH, 1, 1, handleCgiEnabled},
+    {"cgi_pass", IN_BOTH, 2, 2, handleCgiPass},
+    {"cgi_buffers", IN_BOTH, 2, 2, handleCgiBuffers},
+    {"cgi_request_collapsing", IN_BOTH, 1, 1, handleCgiCollapsing},
+    {"cgi_cache", IN_BOTH, 1, 1, handleCgiCache},
+    {"cgi_cache_key", IN_BOTH, 1, 1, handleCgiCacheKey},
+    {"cgi_cache_valid", IN_BOTH, 1, 1, handleCgiCacheValid},
+    {"open_file_cache", IN_BOTH, 1, ANY_ARGS, handleOpenFileCache},
+    {"content_cache", IN_BOTH, 1, ANY_ARGS, handleContentCache},
+    {"mmap", IN_BOTH, 1, 1, handleMmap},
+    {"root_pack", IN_BOTH, 1, 1, handleRootPack},
+    {"gzip", IN_BOTH, 1, 1, handleGzip},
+    {"gzip_static", IN_BOTH, 1, 1, handleGzipStatic},
+    {"gzip_types", IN_BOTH, 1, ANY_ARGS, handleGzipTypes},
+    {"gzip_min_length", IN_BOTH, 1, 1, handleGzipMinLength},
+    {"gzip_comp_level", IN_BOTH, 1, 1, handleGzipCompLevel},
+    {"expires", IN_BOTH, 1, 1, handleExpires},
+    {"add_header", IN_BOTH, 1, ANY_ARGS, handleAddHeader},
+};
+
+static const Directive* findDirective(const char* name, size_t length) {
+  static HashTable<const Directive*> table;
+  if (table.size() == 0) {
+    for (size_t j = 0; j < sizeof(directives) / sizeof(directives[0]); ++j)
+      table.insert(directives[j].name, &directives[j]);
+  }
+  const Directive* const* found = table.find(name, length);
+  return found ? *found : NULL;
+}
+
+bool isDirective(const char* name, size_t length) {
+  return findDirective(name, length) != NULL;
+}
+
+// Reads "<directive> <arg>... ;" at i and applies it to the target
+static size_t parseDirective(const std::vector<Token>& tokens,
+                             size_t i,
+                             DirectiveTarget& target,
+                             DirectiveContext context) {
+  const char* blockName = context == IN_SERVER ? "server" : "location";
+  const Token& nameToken = tokens[i];
+  if (nameToken.type != ATTRIBUTE && nameToken.type != LEVEL) {
+    throw std::runtime_error(std::string("Expected ") + blockName +
+                             " directive, got: " + nameToken.value.str());
+  }
+  const Directive* directive =
+      findDirective(nameToken.value.data, nameToken.value.length);
+  if (!directive || !(directive->contexts & context)) {
+    throw std::runtime_error(std::string("Unknown ") + blockName +
+                             " directive: " + nameToken.value.str());
+  }
+  i++;
+
+  std::vector<std::string> args;
+  // Another directive or a brace before ';' means the ';' is missing
+  while (i < tokens.size() && tokens[i].type != SYMBOL &&
+         tokens[i].type != ATTRIBUTE && tokens[i].type != LEVEL) {
+    args.push_back(tokens[i].value);
+    i++;
+  }
+  if (i >= tokens.size() || tokens[i].value != ";" ||
+      args.size() > directive->maxArgs) {
+    throw std::runtime_error(std::string("Expected ';' after '") +
+                             directive->name + "' directive");
+  }
+  if (args.size() < directive->minArgs) {
+    throw std::runtime_error(std::string("Missing value for '") +
+                             directive->name + "' directive");
+  }
+  i++;
+  directive->handle(target, args);
   return i;
 }
 
+static size_t parseLocationDirective(const std::vector<Token>& tokens,
+                                     size_t i,
+                                     LocationConfig& location) {
+  DirectiveTarget target = {location, NULL, &location};
+  return parseDirective(tokens, i, target, IN_LOCATION);
+}
+
 static size_t parseLocation(const std::vector<Token>& tokens,
                             size_t i,
                             Server& server,
@@ -267,187 +423,29 @@ static size_t parseLocation(const std::vector<Token>& tokens,
                              "': missing '}'");
   }
 
-  location.inheritCgiFromParent(server.isCgiEnabled());
-
-  location.inheritCgiPassFromParent(server.getCgiPassMap());
-
   server.addLocation(location);
   return i;
 }
 
-static size_t parseErrorPageDirective(const std::vector<Token>& tokens,
-                                      size_t i,
-                                      Server& server) {
-  std::vector<u_int16_t> errorCodes;
-  std::string errorPage;
-  while (i < tokens.size() && tokens[i].value != ";" &&
-         tokens[i].type == NUMBER) {
-    errorCodes.push_back(
-        static_cast<u_int16_t>(std::atoi(tokens[i].value.c_str())));
-    i++;
-  }
-
-  if (i < tokens.size() && tokens[i].value != ";") {
-    errorPage = tokens[i].value;
-    i++;
-  }
-
-  if (!errorCodes.empty() && !errorPage.empty()) {
-    for (size_t j = 0; j < errorCodes.size(); ++j) {
-      server.insertErrorPage(errorCodes[j], errorPage);
-    }
-  }
-
-  if (i >= tokens.size() || tokens[i].value != ";") {
-    throw std::runtime_error("Expected ';' after 'error_page' directive");
-  }
-  i++;
-
-  return i;
-}
-
-static size_t parseIndexDirective(const std::vector<Token>& tokens,
-                                  size_t i,
-                                  Server& server) {
-  std::vector<std::string> indexFiles;
-  while (i < tokens.size() && tokens[i].value != ";") {
-    // Check if token is a valid index file (not another directive)
-    if (tokens[i].type == ATTRIBUTE || tokens[i].type == LEVEL) {
-      throw std::runtime_error("Expected ';' after 'index' directive");
-    }
-    indexFiles.push_back(tokens[i].value);
-    i++;
-  }
-  if (i >= tokens.size() || tokens[i].value != ";") {
-    throw std::runtime_error("Expected ';' after 'index' directive");
-  }
-  i++;
-  server.insertIndex(indexFiles);
-  return i;
-}
-
-static size_t parseBasicServerDirective(const std::vector<Token>& tokens,
-                                        size_t i,
-                                        Server& server,
-                                        const std::string& directive) {
-  if (directive == "listen" && i < tokens.size()) {
-    while (i < tokens.size() && tokens[i].value != ";") {
-      // Check if token is a valid listen value (not another directive)
-      if (tokens[i].type == ATTRIBUTE || tokens[i].type == LEVEL) {
-        throw std::runtime_error("Expected ';' after 'listen' directive");
-      }
-
-      std::string listenValue = tokens[i].value;
-      u_int16_t port = 80;
-      std::string addr = "0.0.0.0";
-
-      size_t colonPos = listenValue.find(':');
-      if (colonPos != std::string::npos) {
-        addr = listenValue.substr(0, colonPos);
-        std::string portStr = listenValue.substr(colonPos + 1);
-        if (!portStr.empty()) {
-          port = static_cast<u_int16_t>(std::atoi(portStr.c_str()));
-        }
-        server.insertListen(port, addr);
-      } else {
-        if (!listenValue.empty()) {
-          port = static_cast<u_int16_t>(std::atoi(listenValue.c_str()));
-        }
-        server.insertListen(port);
-      }
-      i++;
-    }
-    if (i >= tokens.size() || tokens[i].value != ";") {
-      throw std::runtime_error("Expected ';' after 'listen' directive");
-    }
-    i++;
-  } else if (directive == "server_name" && i < tokens.size()) {
-    while (i < tokens.size() && tokens[i].value != ";") {
-      // Check if token is a valid server name (not another directive)
-      if (tokens[i].type == ATTRIBUTE || tokens[i].type == LEVEL) {
-        throw std::runtime_error("Expected ';' after 'server_name' directive");
-      }
-      server.insertServerNames(tokens[i].value);
-      i++;
-    }
-    if (i >= tokens.size() || tokens[i].value != ";") {
-      throw std::runtime_error("Expected ';' after 'server_name' directive");
-    }
-    i++;
-  } else if (directive == "root" && i < tokens.size()) {
-    server.setRoot(tokens[i].value);
-    i++;
-    if (i >= tokens.size() || tokens[i].value != ";") {
-      throw std::runtime_error("Expected ';' after 'root' directive");
-    }
-    i++;
-  } else if (directive == "client_max_body_size" && i < tokens.size()) {
-    std::string sizeStr = tokens[i].value;
-    server.setClientMaxBodySize(sizeStr);
-    i++;
-    if (i >= tokens.size() || tokens[i].value != ";") {
-      throw std::runtime_error(
-          "Expected ';' after 'client_max_body_size' directive");
-    }
-    i++;
-  } else if (directive == "autoindex" && i < tokens.size()) {
-    if (tokens[i].value == "on") {
-      server.activateAutoIndex();
-    }
-    i++;
-    if (i >= tokens.size() || tokens[i].value != ";") {
-      throw std::runtime_error("Expected ';' after 'autoindex' directive");
-    }
-    i++;
-  } else if (directive == "cgi_enabled" && i < tokens.size()) {
-    if (tokens[i].value == "on") {
-      server.setCgiEnabled(true);
-    }
-    i++;
-    if (i >= tokens.size() || tokens[i].value != ";") {
-      throw std::runtime_error("Expected ';' after 'cgi_enabled' directive");
-    }
-    i++;
-  } else if (directive == "cgi_pass" && i + 1 < tokens.size()) {
-    std::string extension = tokens[i].value;
-    std::string interpreter = tokens[i + 1].value;
-    i += 2;
-    if (i >= tokens.size() || tokens[i].value != ";") {
-      throw std::runtime_error("Expected ';' after 'cgi_pass' directive");
-    }
-    i++;
-    server.setCgiPassMapping(extension, interpreter);
-  }
-  return i;
-}
-
 static size_t parseServerDirective(const std::vector<Token>& tokens,
                                    size_t i,
                                    Server& server,
                                    int& serverBraceLevel,
                                    int& httpBraceLevel) {
-  if (tokens[i].type == ATTRIBUTE || tokens[i].type == LEVEL) {
-    std::string directive = tokens[i].value;
-    i++;
-
-    if (directive == "index" && i < tokens.size()) {
-      i = parseIndexDirective(tokens, i, server);
-    } else if (directive == "error_page" && i < tokens.size()) {
-      i = parseErrorPageDirective(tokens, i, server);
-    } else if (directive == "location") {
-      i = parseLocation(tokens, i, server, serverBraceLevel, httpBraceLevel);
-    } else {
-      i = parseBasicServerDirective(tokens, i, server, directive);
-    }
+  if (tokens[i].type == LEVEL && tokens[i].value == "location") {
+    return parseLocation(tokens, i + 1, server, serverBraceLevel,
+                         httpBraceLevel);
   }
-  return i;
+  DirectiveTarget target = {server, &server, NULL};
+  return parseDirective(tokens, i, target, IN_SERVER);
 }
 
 static size_t parseServer(const std::vector<Token>& tokens,
                           size_t i,
                           Container& container,
                           int& httpBraceLevel) {
-  Server server;
+  // Parsed in place: a Server with its locations is costly to copy
+  Server& server = container.addServer();
   i++;
 
   int serverBraceLevel = 0;
@@ -482,7 +480,6 @@ static size_t parseServer(const std::vector<Token>& tokens,
     throw std::runtime_error("Unclosed 'server' block: missing '}'");
   }
 
-  container.insertServer(server);
   return i;
 }
 
@@ -498,6 +495,14 @@ Container parser(const std::vector<Token>& tokens) {
   // Check if config starts with 'http' block or directly with 'server' blocks
   bool hasHttpBlock = expect("http", tokens[0]);
 
+  // So the server list never reallocates while it is being filled
+  size_t serverCount = 0;
+  for (size_t j = 0; j < tokens.size(); ++j) {
+    if (tokens[j].type == LEVEL && tokens[j].value == "server")
+      serverCount++;
+  }
+  container.reserveServers(serverCount);
+
   if (hasHttpBlock) {
     // Parse with http block wrapper
     i = 1;
@@ -566,4 +571,12 @@ Container parser(const std::vector<Token>& tokens) {
   }
 
   return container;
-}
\ No newline at end of file
+}
+Container loadConfig(const std::string& filename) {
+  std::string content = readFile(filename);
+  std::vector<Token> tokens = lexer(content);
+  checks(tokens);
+  Container container = parser(tokens);
+  container.compile();
+  return container;
+}
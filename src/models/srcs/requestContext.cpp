@@ -1,5 +1,8 @@
 #include "requestContext.hpp"
-#include <fstream>
+#include "ContentCache.hpp"
+#include "HttpResponse.hpp"
+#include "HttpUtils.hpp"
+#include "OpenFileCache.hpp"
 #include <iostream>
 #include <sstream>
 
@@ -21,116 +24,87 @@ Location (Specific Path Configuration):
 */
 
 RequestContext::RequestContext(const Server& srv, const LocationConfig* loc)
-    : server(srv), location(loc), rootDir("") {
-  rootDir = server.getRoot();
-  // Only use location's root if it's explicitly set (not the default)
-  if (location && !location->getRoot().empty() &&
-      location->getRoot() != DEFAULT_ROOT_PATH)
-    rootDir = location->getRoot();
-}
+    : server(srv), location(loc), compiled(srv.getCompiled(loc)),
+      rootDir(compiled.root), openFileCache(NULL), contentCache(NULL),
+      pack(NULL) {}
 
 // index files are the default files that a web server serves when someone
 // requests a dir (instead of a specific file)
 const std::vector<std::string>& RequestContext::getIndexFiles() const {
-  if (location && !location->getIndexFiles().empty())
-    return location->getIndexFiles();
-  return server.getIndexFiles();
+  return compiled.indexFiles;
 }
 
-size_t RequestContext::getClientMaxBodySize() const {
+// The block whose settings apply: the location if one matched
+const BaseBlock& RequestContext::getBlock() const {
   if (location)
-    return location->getClientMaxBodySize();
-  return server.getClientMaxBodySize();
+    return *location;
+  return server;
+}
+
+// Called after this request changed the file, so the next one sees it
+void RequestContext::invalidateCachedPath(const std::string& fullPath) const {
+  std::string key = collapsePath(fullPath);
+  if (openFileCache)
+    openFileCache->invalidate(key);
+  if (contentCache)
+    contentCache->invalidate(key);
+}
+
+size_t RequestContext::getClientMaxBodySize() const {
+  return compiled.clientMaxBodySize;
+}
+
+size_t RequestContext::getCgiBufferLimit() const {
+  return compiled.cgiBufferLimit;
+}
+
+bool RequestContext::isCgiCollapsingEnabled() const {
+  return compiled.cgiCollapsing;
 }
 
 bool RequestContext::getAutoIndex() const {
-  if (location)
-    return location->getAutoIndex();
-  return server.getAutoIndex();
+  return compiled.autoIndex;
+}
+
+bool RequestContext::isCgiEnabled() const {
+  return compiled.cgiEnabled;
+}
+
+// upload_dir, else the server's root
+const std::string& RequestContext::getUploadDir() const {
+  return compiled.uploadDir;
+}
+
+const std::string* RequestContext::getCgiInterpreter(
+    const std::string& scriptPath) const {
+  return compiled.interpreterFor(scriptPath);
 }
 
 bool RequestContext::isMethodAllowed(const std::string& method) const {
-  if (location)
-    return location->isMethodAllowed(method);
-  return (method == "GET" || method == "HEAD" || method == "POST" ||
-          method == "PUT" || method == "DELETE" || method == "PATCH");
+  return compiled.isMethodAllowed(method);
 }
 
 // converts a relative URL path (from an HTTP request) into an absolute file
 // system path that your server can use to find the actual file.
 std::string RequestContext::getFullPath(const std::string& requestPath) const {
-  std::string fullPath = "";
-
-  // If empty, return rootDir
-  if (requestPath.empty())
-    return rootDir;
-
-  // Check if requestPath is absolute (starts with '/')
-  if (!requestPath.empty() && requestPath[0] == '/') {
-    // Treat absolute paths as relative to rootDir for security
-    fullPath = rootDir;
-    if (!fullPath.empty() && fullPath[fullPath.length() - 1] != '/')
-      fullPath += '/';
-
-    // Remove leading slash from requestPath
-    fullPath += requestPath.substr(1);
-  } else {
-    // Relative path, just combine with rootDir
-    fullPath = rootDir;
-    if (!fullPath.empty() && fullPath[fullPath.length() - 1] != '/')
-      fullPath += '/';
-
-    fullPath += requestPath;
-  }
-
-  return fullPath;
-}
-
-const std::string* RequestContext::getErrorPage(const u_int16_t code) const {
-  // Try location first, then server
-  if (location) {
-    const std::string* errorPage = location->getErrorPage(code);
-    if (errorPage)
-      return errorPage;
-  }
-  return server.getErrorPage(code);
+  return compiled.getFullPath(requestPath);
 }
 
-std::string RequestContext::getErrorPageContent(u_int16_t code) const {
-  const std::string* pagePath = getErrorPage(code);
-  if (!pagePath || pagePath->empty()) {
-    throw std::runtime_error("No error page configured for code");
-  }
-
-  std::string fullErrorPath = getFullPath(*pagePath);
-  std::ifstream file(fullErrorPath.c_str(), std::ios::binary);
-  if (!file.is_open()) {
-    throw std::runtime_error("Failed to open error page file: " +
-                             fullErrorPath);
-  }
-
-  std::string content;
-  char buffer[4096];
-  while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
-    content.append(buffer, file.gcount());
-  }
-
-  if (file.bad()) {
-    throw std::runtime_error("Failed to read error page file: " +
-                             fullErrorPath);
-  }
-
-  return content;
+// The page's content, read when the config was compiled
+const std::string* RequestContext::getErrorPage(u_int16_t code) const {
+  return compiled.getErrorPage(code);
 }
 
 bool RequestContext::hasReturn() const {
-  if (location && location->hasReturn())
-    return true;
-  return server.hasReturn();
+  return compiled.redirectCode != 0;
 }
 
-const std::pair<u_int16_t, std::string>& RequestContext::getReturnData() const {
-  if (location && location->hasReturn())
-    return location->getReturnData();
-  return server.getReturnData();
+// The rendered redirect is shared, not copied, into the response
+void RequestContext::setReturnResponse(HttpResponse& res,
+                                       bool includeBody) const {
+  res.setSharedContent(compiled.redirectHead,
+                       includeBody ? compiled.redirectBody
+                                   : SharedPtr<std::string>());
+  res.setStatus(compiled.redirectCode,
+                HttpResponse::reasonPhrase(compiled.redirectCode));
 }
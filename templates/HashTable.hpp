@@ -0,0 +1,95 @@
+#ifndef HASHTABLE_HPP
+#define HASHTABLE_HPP
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// String-keyed open-addressing table for lookups compiled at config load:
+// filled once, then only read. Linear probing over a power-of-two slot array
+// that is kept at most half full, so a probe always reaches an empty slot.
+// There is no removal.
+template <typename T>
+class HashTable {
+private:
+  struct Slot {
+    bool used;
+    uint32_t hash;
+    std::string key;
+    T value;
+
+    Slot() : used(false), hash(0), key(), value() {}
+  };
+  std::vector<Slot> slots;
+  size_t count;
+
+  // FNV-1a
+  static uint32_t hashKey(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+      hash ^= static_cast<unsigned char>(data[i]);
+      hash *= 16777619u;
+    }
+    return hash;
+  }
+
+  void place(const Slot& slot) {
+    size_t mask = slots.size() - 1;
+    size_t i = slot.hash & mask;
+    while (slots[i].used)
+      i = (i + 1) & mask;
+    slots[i] = slot;
+    ++count;
+  }
+
+  void grow() {
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.resize(old.empty() ? 8 : old.size() * 2);
+    count = 0;
+    for (size_t i = 0; i < old.size(); ++i) {
+      if (old[i].used)
+        place(old[i]);
+    }
+  }
+
+public:
+  HashTable() : slots(), count(0) {}
+
+  // false, leaving the table as it was, when key is already there
+  bool insert(const std::string& key, const T& value) {
+    if (find(key))
+      return false;
+    if ((count + 1) * 2 > slots.size())
+      grow();
+    Slot slot;
+    slot.used = true;
+    slot.hash = hashKey(key.data(), key.size());
+    slot.key = key;
+    slot.value = value;
+    place(slot);
+    return true;
+  }
+
+  const T* find(const char* key, size_t length) const {
+    if (slots.empty())
+      return NULL;
+    uint32_t hash = hashKey(key, length);
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; slots[i].used; i = (i + 1) & mask) {
+      if (slots[i].hash == hash && slots[i].key.size() == length &&
+          std::memcmp(slots[i].key.data(), key, length) == 0)
+        return &slots[i].value;
+    }
+    return NULL;
+  }
+
+  const T* find(const std::string& key) const {
+    return find(key.data(), key.size());
+  }
+
+  size_t size() const { return count; }
+};
+
+#endif
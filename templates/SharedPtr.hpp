@@ -0,0 +1,55 @@
+#ifndef SHAREDPTR_HPP
+#define SHAREDPTR_HPP
+
+#include <cstddef>
+
+// Minimal reference-counted owner for objects shared between the event loop's
+// consumers (send queues, caches). Single-threaded by design, like the loop.
+template <typename T>
+class SharedPtr {
+private:
+  T* ptr;
+  size_t* count;
+
+  void release() {
+    if (count && --(*count) == 0) {
+      delete ptr;
+      delete count;
+    }
+    ptr = NULL;
+    count = NULL;
+  }
+
+public:
+  SharedPtr() : ptr(NULL), count(NULL) {}
+
+  explicit SharedPtr(T* p) : ptr(p), count(p ? new size_t(1) : NULL) {}
+
+  SharedPtr(const SharedPtr& other) : ptr(other.ptr), count(other.count) {
+    if (count)
+      ++(*count);
+  }
+
+  SharedPtr& operator=(const SharedPtr& other) {
+    if (this != &other) {
+      if (other.count)
+        ++(*other.count);
+      release();
+      ptr = other.ptr;
+      count = other.count;
+    }
+    return *this;
+  }
+
+  ~SharedPtr() { release(); }
+
+  void reset(T* p = NULL) { *this = SharedPtr(p); }
+
+  T* get() const { return ptr; }
+  T& operator*() const { return *ptr; }
+  T* operator->() const { return ptr; }
+  bool isValid() const { return ptr != NULL; }
+  size_t useCount() const { return count ? *count : 0; }
+};
+
+#endif
@@ -0,0 +1,167 @@
+// Writes the precompressed siblings gzip_static serves.
+//
+//   compress <docroot>
+//
+// Every text-like file below the docroot gets a "name.gz" (zlib, level 9)
+// and a "name.br" (brotli, quality 11) next to it, stamped with the
+// original's mtime so the server takes them as current. A sibling that would
+// not be smaller is not written, and a stale one is removed.
+#include <brotli/encode.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <zlib.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "utils.hpp"
+
+struct Totals {
+    size_t files;
+    unsigned long long original;
+    unsigned long long gzip;
+    unsigned long long brotli;
+};
+
+static bool isCompressible(const std::string &path)
+{
+    std::string mime = getMimeType(path);
+    return mime.compare(0, 5, "text/") == 0 || mime == "application/javascript" ||
+           mime == "application/json" || endsWith(path, ".svg") || endsWith(path, ".txt") ||
+           endsWith(path, ".xml");
+}
+
+static std::string readAll(const std::string &path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in)
+        throw std::runtime_error("cannot read " + path);
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+static bool gzipEncode(const std::string &in, std::string &out)
+{
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    // 15 window bits + 16: gzip header and trailer instead of zlib's
+    if (deflateInit2(&stream, 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&stream, in.size()) + 32);
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    stream.avail_in = in.size();
+    stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    stream.avail_out = out.size();
+    int status = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return status == Z_STREAM_END;
+}
+
+static bool brotliEncode(const std::string &in, std::string &out)
+{
+    size_t size = BrotliEncoderMaxCompressedSize(in.size());
+    out.resize(size ? size : 64);
+    size = out.size();
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, in.size(),
+                               reinterpret_cast<const uint8_t *>(in.data()), &size,
+                               reinterpret_cast<uint8_t *>(&out[0])))
+        return false;
+    out.resize(size);
+    return true;
+}
+
+// Replaces path with content atomically and gives it the original's mtime
+static void writeSibling(const std::string &path, const std::string &content, const struct stat &original)
+{
+    std::string temp = path + ".tmp";
+    std::ofstream out(temp.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(content.data(), content.size());
+    out.close();
+    struct timeval times[2];
+    times[0].tv_sec = original.st_atime;
+    times[0].tv_usec = 0;
+    times[1].tv_sec = original.st_mtime;
+    times[1].tv_usec = 0;
+    if (!out || utimes(temp.c_str(), times) == -1 || std::rename(temp.c_str(), path.c_str()) == -1)
+    {
+        std::remove(temp.c_str());
+        throw std::runtime_error("cannot write " + path);
+    }
+}
+
+static unsigned long long compressFile(const std::string &path, const struct stat &st, bool (*encode)(const std::string &, std::string &),
+                                       const char *suffix, const std::string &content)
+{
+    std::string sibling = path + suffix;
+    std::string encoded;
+    if (!encode(content, encoded))
+        throw std::runtime_error(std::string("cannot compress ") + path);
+    if (encoded.size() >= content.size())
+    {
+        std::remove(sibling.c_str());
+        return content.size();
+    }
+    writeSibling(sibling, encoded, st);
+    return encoded.size();
+}
+
+static void walk(const std::string &dir, Totals &totals)
+{
+    DIR *handle = opendir(dir.c_str());
+    if (!handle)
+        throw std::runtime_error("cannot read " + dir + ": " + strerror(errno));
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL)
+    {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) == -1)
+            continue;
+        if (S_ISDIR(st.st_mode))
+        {
+            walk(path, totals);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) || !isCompressible(path))
+            continue;
+        std::string content = readAll(path);
+        totals.files++;
+        totals.original += content.size();
+        totals.gzip += compressFile(path, st, gzipEncode, ".gz", content);
+        totals.brotli += compressFile(path, st, brotliEncode, ".br", content);
+    }
+    closedir(handle);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: compress <docroot>" << std::endl;
+        return 1;
+    }
+    try
+    {
+        Totals totals;
+        std::memset(&totals, 0, sizeof(totals));
+        walk(argv[1], totals);
+        std::cout << argv[1] << ": " << totals.files << " files, " << totals.original << " bytes -> gzip "
+                  << totals.gzip << ", br " << totals.brotli << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "compress: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+// Packs a docroot into one archive for the root_pack directive.
+//
+//   pack <docroot> <archive>
+//
+// Every regular file becomes an entry keyed by its path below the docroot.
+// A "name.gz" or "name.br" sibling that is not older than "name" is stored
+// as that entry's precompressed variant instead of an entry of its own.
+// The archive is written next to the target and renamed over it, so a
+// running server never sees a half-written file.
+#include <dirent.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "PackArchive.hpp"
+#include "utils.hpp"
+
+struct SourceFile {
+    std::string key;
+    std::string variantPath[PACK_VARIANTS];
+    struct stat st;
+};
+
+static const char *variantSuffix[PACK_VARIANTS] = {"", ".gz", ".br"};
+
+static bool isVariantOf(const std::string &name, const std::map<std::string, struct stat> &files)
+{
+    for (int v = PACK_GZIP; v < PACK_VARIANTS; ++v)
+    {
+        std::string suffix = variantSuffix[v];
+        if (name.size() > suffix.size() && endsWith(name, suffix) &&
+            files.count(name.substr(0, name.size() - suffix.size())))
+            return true;
+    }
+    return false;
+}
+
+static void collect(const std::string &dir, const std::string &prefix, std::vector<SourceFile> &out)
+{
+    DIR *handle = opendir(dir.c_str());
+    if (!handle)
+        throw std::runtime_error("cannot read " + dir + ": " + strerror(errno));
+
+    std::map<std::string, struct stat> files;
+    std::vector<std::string> subdirs;
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL)
+    {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        struct stat st;
+        if (stat((dir + "/" + name).c_str(), &st) == -1)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            subdirs.push_back(name);
+        else if (S_ISREG(st.st_mode))
+            files[name] = st;
+    }
+    closedir(handle);
+
+    for (std::map<std::string, struct stat>::iterator it = files.begin(); it != files.end(); ++it)
+    {
+        if (isVariantOf(it->first, files))
+            continue;
+        SourceFile file;
+        file.key = prefix + "/" + it->first;
+        file.st = it->second;
+        file.variantPath[PACK_IDENTITY] = dir + "/" + it->first;
+        for (int v = PACK_GZIP; v < PACK_VARIANTS; ++v)
+        {
+            std::map<std::string, struct stat>::iterator sibling = files.find(it->first + variantSuffix[v]);
+            if (sibling != files.end() && sibling->second.st_mtime >= it->second.st_mtime)
+                file.variantPath[v] = dir + "/" + sibling->first;
+        }
+        out.push_back(file);
+    }
+    for (size_t i = 0; i < subdirs.size(); ++i)
+        collect(dir + "/" + subdirs[i], prefix + "/" + subdirs[i], out);
+}
+
+static PackString addString(std::string &table, const std::string &value)
+{
+    PackString s;
+    s.offset = table.size();
+    s.length = value.size();
+    table += value;
+    return s;
+}
+
+static uint64_t alignUp(uint64_t value)
+{
+    return (value + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+}
+
+static std::string readAll(const std::string &path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in)
+        throw std::runtime_error("cannot read " + path);
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: pack <docroot> <archive>" << std::endl;
+        return 1;
+    }
+    try
+    {
+        std::string root = argv[1];
+        while (root.size() > 1 && root[root.size() - 1] == '/')
+            root.erase(root.size() - 1);
+        std::vector<SourceFile> files;
+        collect(root, "", files);
+
+        PackHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+        header.entryCount = files.size();
+        header.bucketCount = 1;
+        while (header.bucketCount < files.size() * 2 + 1)
+            header.bucketCount <<= 1;
+
+        std::vector<PackRecord> records(files.size());
+        std::vector<uint32_t> buckets(header.bucketCount, 0);
+        std::string strings;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            PackRecord &record = records[i];
+            std::memset(&record, 0, sizeof(record));
+            record.path = addString(strings, files[i].key);
+            record.mimeType = addString(strings, getMimeType(files[i].key));
+            char etag[64];
+            std::snprintf(etag, sizeof(etag), "\"%lx-%lx\"", static_cast<unsigned long>(files[i].st.st_mtime),
+                          static_cast<unsigned long>(files[i].st.st_size));
+            record.etag = addString(strings, etag);
+            record.mtime = files[i].st.st_mtime;
+
+            uint32_t slot = packHash(files[i].key.data(), files[i].key.size()) & (header.bucketCount - 1);
+            while (buckets[slot] != 0)
+                slot = (slot + 1) & (header.bucketCount - 1);
+            buckets[slot] = i + 1;
+        }
+        header.stringsOffset = sizeof(header) + records.size() * sizeof(PackRecord) +
+                               buckets.size() * sizeof(uint32_t);
+        header.stringsSize = strings.size();
+
+        // Content offsets, each variant on its own page
+        uint64_t offset = alignUp(header.stringsOffset + header.stringsSize);
+        std::vector<std::string> order;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            for (int v = 0; v < PACK_VARIANTS; ++v)
+            {
+                if (files[i].variantPath[v].empty())
+                    continue;
+                struct stat st;
+                if (stat(files[i].variantPath[v].c_str(), &st) == -1)
+                    throw std::runtime_error("cannot stat " + files[i].variantPath[v]);
+                records[i].variants |= 1u << v;
+                records[i].offset[v] = offset;
+                records[i].length[v] = st.st_size;
+                order.push_back(files[i].variantPath[v]);
+                offset = alignUp(offset + st.st_size);
+            }
+        }
+
+        std::string target = argv[2];
+        std::string temp = target + ".tmp";
+        std::ofstream out(temp.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("cannot write " + temp);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        if (!records.empty())
+            out.write(reinterpret_cast<const char *>(&records[0]), records.size() * sizeof(PackRecord));
+        out.write(reinterpret_cast<const char *>(&buckets[0]), buckets.size() * sizeof(uint32_t));
+        out.write(strings.data(), strings.size());
+        uint64_t written = header.stringsOffset + header.stringsSize;
+        uint64_t contentBytes = 0;
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            uint64_t start = alignUp(written);
+            out.write(std::string(start - written, '\0').data(), start - written);
+            std::string content = readAll(order[i]);
+            out.write(content.data(), content.size());
+            written = start + content.size();
+            contentBytes += content.size();
+        }
+        out.close();
+        if (!out || std::rename(temp.c_str(), target.c_str()) == -1)
+        {
+            std::remove(temp.c_str());
+            throw std::runtime_error("cannot write " + target);
+        }
+        std::cout << target << ": " << files.size() << " files, " << order.size() - files.size()
+                  << " precompressed variants, " << contentBytes << " content bytes, " << written
+                  << " bytes total" << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "pack: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}